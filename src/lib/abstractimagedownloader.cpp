@@ -18,17 +18,23 @@
 
 #include "abstractimagedownloader.h"
 
+#include <QtCore/QDateTime>
 #include <QtCore/QFileInfo>
 #include <QtCore/QDir>
+#include <QtCore/QMetaEnum>
 #include <QtCore/QCryptographicHash>
 #include <QtCore/QStandardPaths>
+#include <QtCore/QRunnable>
 #include <QtGui/QImage>
+#include <QtGui/QImageReader>
 #include <QtNetwork/QNetworkAccessManager>
 #include <QtNetwork/QNetworkReply>
 #include <QtNetwork/QNetworkRequest>
 
 #include <QtDebug>
 
+#include <algorithm>
+
 #include "abstractimagedownloader_p.h"
 
 // The AbstractImageDownloader is a class used to build image downloader objects
@@ -44,17 +50,200 @@
 // To download an image, the AbstractImagesDownloader::queue slot
 // should be used, and when the download is completed, the
 // AbstractImagesDownloaderPrivate::imageDownloaded will be emitted.
+//
+// Validators (ETag and Last-Modified) sent by the server are stored
+// through dbQueueValidators. When an image is downloaded again and the
+// file it was saved to is still intact, a conditional request is sent,
+// and a 304 reply reuses the cached file without transferring it again.
+// Other replies are written next to the cached file, that is only
+// replaced once they succeed, and bodies of failed replies are dropped.
+//
+// Images that can be produced from a downloaded image, like thumbnails,
+// are provided by derivations. They are scaled down in a thread pool
+// and reported as if they were downloaded.
+//
+// Downloaded images are saved in the database in batches. A batch is
+// written when it contains maximumBatchSize images or maximumBytes bytes,
+// when its oldest image waited for maximumLatency ms, or when there is
+// nothing left to download. See setFlushPolicy. Other changes queued
+// by subclasses are written with the next batch, see scheduleDbWrite.
+//
+// Failed downloads are classified. Transient network errors and server
+// errors are retried with a jittered exponential backoff, using a timer
+// wheel. Other errors, like client errors or a full disk, and images that
+// failed too many times, are parked: they are not downloaded again for a
+// while, so that they are not requested again on every refresh of a model.
+// Failed downloads are neither saved nor reported by imageDownloaded.
+//
+// Metrics describing the activity of the downloader are collected
+// while it runs, and are reported by metricsUpdated at most once
+// per METRICS_INTERVAL.
+//
+// Images are requested on behalf of a requester, that is the "requester"
+// entry of the metadata. An image that is requested several times is
+// downloaded once, and is only cancelled by cancelRequester when none of
+// its requesters still need it. The requesters of an image are listed in
+// the "requesters" entry of the metadata reported by imageDownloaded, so
+// that a downloader shared by several clients can deliver each image to
+// the clients that requested it.
 
 static int MAX_SIMULTANEOUS_DOWNLOAD = 5;
-static int MAX_BATCH_SAVE = 50;
+static int DEFAULT_FLUSH_BATCH_SIZE = 200;
+static int DEFAULT_FLUSH_LATENCY = 2000;
+static qint64 DEFAULT_FLUSH_BYTES = 4 * 1024 * 1024;
+
+// Files are stored in DEFAULT_SHARD_LEVELS levels of directories,
+// named after DEFAULT_SHARD_WIDTH hex characters of a hash, that
+// is 65536 directories with the default values.
+static int DEFAULT_SHARD_LEVELS = 2;
+static int DEFAULT_SHARD_WIDTH = 2;
+static int MAXIMUM_SHARD_WIDTH = 4;
+
+// Retries: the delay before the nth retry is RETRY_DELAY * 2^(n-1),
+// bounded by MAXIMUM_RETRY_DELAY, and randomly reduced by up to half.
+// The wheel has RETRY_WHEEL_SLOTS slots of RETRY_WHEEL_TICK ms.
+static int MAXIMUM_ATTEMPTS = 5;
+static int RETRY_DELAY = 1000;
+static int MAXIMUM_RETRY_DELAY = 5 * 60 * 1000;
+static int RETRY_WHEEL_SLOTS = 64;
+static int RETRY_WHEEL_TICK = 250;
+
+// Time during which an image is not downloaded again after a failure
+static qint64 PARK_DURATION = 24 * 60 * 60 * 1000;
+static qint64 TRANSIENT_PARK_DURATION = 10 * 60 * 1000;
+static int MAX_SIMULTANEOUS_DERIVATION = 2;
+static int DERIVATION_QUALITY = 90;
+
+static const char *REQUESTER_KEY = "requester";
+static const char *REQUESTERS_KEY = "requesters";
+
+// Suffix of the file a revalidated image is downloaded to
+static const char *PARTIAL_SUFFIX = ".part";
+
+// Interval between two metrics updates, and number of
+// latencies used to compute the latency percentiles
+static const int METRICS_INTERVAL = 1000;
+static const int LATENCY_SAMPLES = 256;
+
+// Scale down an image to produce derived images
+//
+// QImageReader::setScaledSize lets the JPEG decoder decode
+// directly at a lower resolution, that is much faster than
+// decoding the full image and scaling it.
+class ImageDerivationTask: public QRunnable
+{
+public:
+    ImageDerivationTask(QObject *receiver, const QString &source,
+                        const QList<ImageDerivation> &derivations)
+        : m_receiver(receiver), m_source(source), m_derivations(derivations)
+    {
+    }
+
+    void run()
+    {
+        foreach (const ImageDerivation &derivation, m_derivations) {
+            bool ok = derive(derivation);
+            QMetaObject::invokeMethod(m_receiver, "derivationFinished", Qt::QueuedConnection,
+                                      Q_ARG(QString, derivation.url),
+                                      Q_ARG(QVariantMap, derivation.metadata),
+                                      Q_ARG(QString, derivation.file),
+                                      Q_ARG(bool, ok));
+        }
+    }
+
+private:
+    bool derive(const ImageDerivation &derivation) const
+    {
+        QImageReader reader (m_source);
+        QSize size = reader.size();
+        if (size.isValid() && derivation.size.isValid()) {
+            QSize scaledSize = size;
+            scaledSize.scale(derivation.size, Qt::KeepAspectRatioByExpanding);
+            if (scaledSize.width() < size.width()) {
+                reader.setScaledSize(scaledSize);
+            }
+        }
+
+        QImage image = reader.read();
+        if (image.isNull()) {
+            qWarning() << Q_FUNC_INFO << "Failed to read" << m_source << reader.errorString();
+            return false;
+        }
+
+        // The directory of the file is created by AbstractImageDownloaderPrivate::derive
+        if (!image.save(derivation.file, "JPG", DERIVATION_QUALITY)) {
+            qWarning() << Q_FUNC_INFO << "Failed to write" << derivation.file;
+            return false;
+        }
+
+        return true;
+    }
+
+    QObject *m_receiver;
+    QString m_source;
+    QList<ImageDerivation> m_derivations;
+};
+
+ImageDownloaderMetrics::ImageDownloaderMetrics()
+    : peakQueueDepth(0), completed(0), failed(0), dbFlushes(0), retries(0), bytesReceived(0)
+    , bytesPerSecond(0), latencyIndex(0), sampleBytes(0)
+{
+    latencies.reserve(LATENCY_SAMPLES);
+}
+
+// Latencies are kept in a ring buffer of the last LATENCY_SAMPLES requests
+void ImageDownloaderMetrics::addLatency(qint64 latency)
+{
+    if (latencies.count() < LATENCY_SAMPLES) {
+        latencies.append(latency);
+    } else {
+        latencies[latencyIndex] = latency;
+    }
+    latencyIndex = (latencyIndex + 1) % LATENCY_SAMPLES;
+}
+
+qint64 ImageDownloaderMetrics::latencyPercentile(int percentile) const
+{
+    if (latencies.isEmpty()) {
+        return -1;
+    }
+
+    QVector<qint64> sorted = latencies;
+    std::sort(sorted.begin(), sorted.end());
+    int index = (sorted.count() - 1) * percentile / 100;
+    return sorted.at(index);
+}
 
 AbstractImageDownloaderPrivate::AbstractImageDownloaderPrivate(AbstractImageDownloader *q)
-    : QObject(q), networkAccessManager(0), q_ptr(q), loadedCount(0)
+    : QObject(q), networkAccessManager(0), q_ptr(q), loadedCount(0), loadedBytes(0)
+    , maximumBatchSize(DEFAULT_FLUSH_BATCH_SIZE), maximumLatency(DEFAULT_FLUSH_LATENCY)
+    , maximumBytes(DEFAULT_FLUSH_BYTES), flushTimer(this), contentAddressed(false)
+    , shardLevels(DEFAULT_SHARD_LEVELS), shardWidth(DEFAULT_SHARD_WIDTH)
+    , retryWheel(RETRY_WHEEL_SLOTS), retryCursor(0), retryCount(0), retryTimer(this)
+    , metricsTimer(this)
 {
+    retryTimer.setInterval(RETRY_WHEEL_TICK);
+    connect(&retryTimer, &QTimer::timeout, this, &AbstractImageDownloaderPrivate::retryTick);
+
+    derivationPool.setMaxThreadCount(MAX_SIMULTANEOUS_DERIVATION);
+
+    flushTimer.setSingleShot(true);
+    connect(&flushTimer, &QTimer::timeout, this, &AbstractImageDownloaderPrivate::flush);
+
+    metricsTimer.setSingleShot(true);
+    metricsTimer.setInterval(METRICS_INTERVAL);
+    connect(&metricsTimer, &QTimer::timeout,
+            this, &AbstractImageDownloaderPrivate::sampleMetrics);
 }
 
 AbstractImageDownloaderPrivate::~AbstractImageDownloaderPrivate()
 {
+    // Tasks report to this object
+    derivationPool.clear();
+    derivationPool.waitForDone();
+
+    dropRetries(QString(), QString());
+    qDeleteAll(stack);
 }
 
 void AbstractImageDownloaderPrivate::manageStack()
@@ -64,15 +253,33 @@ void AbstractImageDownloaderPrivate::manageStack()
         // Create a reply to download the image
         ImageInfo *info = stack.takeLast();
 
-        info->file.setFileName(q->outputFile(info->url, info->data));
+        const QString outputFile = q->outputFile(info->url, info->data);
+        ensureDirectory(outputFile);
 
-        QDir parentDir = QFileInfo(info->file.fileName()).dir();
-        if (!parentDir.exists()) {
-            parentDir.mkpath(".");
+        // Only revalidate if the file described by the validators is still intact
+        ImageValidators validators;
+        if (q->dbValidators(info->url, info->data, &validators)) {
+            QFileInfo validatedFile (validators.file);
+            if (validatedFile.exists() && validatedFile.size() == validators.size) {
+                info->validators = validators;
+            }
         }
 
-        if (info->file.open(QIODevice::ReadWrite)) {
-            QNetworkReply *reply = q->createReply(info->url, info->data);
+        // A revalidated image is not written over the cached file,
+        // that is kept if the request fails
+        QIODevice::OpenMode mode = QIODevice::ReadWrite;
+        if (info->validators.file.isEmpty()) {
+            info->cachedFile.clear();
+            info->file.setFileName(outputFile);
+        } else {
+            info->cachedFile = outputFile;
+            info->file.setFileName(outputFile + QLatin1String(PARTIAL_SUFFIX));
+            mode |= QIODevice::Truncate;
+        }
+
+        if (info->file.open(mode)) {
+            info->elapsed.start();
+            QNetworkReply *reply = q->createReply(info->url, info->data, info->validators);
             reply->setReadBufferSize(250000);
 
             connect(reply, &QIODevice::readyRead, this, &AbstractImageDownloaderPrivate::readyRead);
@@ -82,29 +289,71 @@ void AbstractImageDownloaderPrivate::manageStack()
             runningReplies.insert(reply, info);
         } else {
             qWarning() << Q_FUNC_INFO << "Failed to open file for write" << info->file.errorString();
+            // The directory might have been removed meanwhile
+            createdDirectories.remove(QFileInfo(info->file.fileName()).absolutePath());
             delete info;
         }
     }
+
+    if (stack.count() > metrics.peakQueueDepth) {
+        metrics.peakQueueDepth = stack.count();
+    }
+    metricsChanged();
+}
+
+static bool isNotModified(QNetworkReply *reply)
+{
+    return reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 304;
 }
 
+// Only successful replies carry an image. Replies that are
+// not HTTP replies do not have a status code.
+static bool hasImage(QNetworkReply *reply)
+{
+    QVariant status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute);
+    return !status.isValid() || (status.toInt() >= 200 && status.toInt() < 300);
+}
+
+// Data is written at info->offset rather than appended, so that
+// a file that is downloaded again is overwritten from the start.
 static void readData(ImageInfo *info, QNetworkReply *reply)
 {
-    qint64 size = info->file.size();
     qint64 bytesAvailable = reply->bytesAvailable();
     if (bytesAvailable == 0)
         return;
 
-    info->file.resize(size + bytesAvailable);
-    if (uchar *fileData = info->file.map(size, bytesAvailable)) {
+    if (!hasImage(reply) || info->writeFailed) {
+        // The body of a 304 reply or of an error is not written
+        reply->readAll();
+        return;
+    }
+
+    qint64 size = info->offset;
+    uchar *fileData = 0;
+    if (info->file.resize(size + bytesAvailable)) {
+        fileData = info->file.map(size, bytesAvailable);
+    }
+
+    if (!fileData) {
+        // Most likely, the disk is full
+        qWarning() << Q_FUNC_INFO << "Failed to write" << info->file.fileName()
+                   << info->file.errorString();
+        info->writeFailed = true;
+        reply->readAll();
+        return;
+    }
+
+    {
         char *buffer = reinterpret_cast<char *>(fileData);
         while (bytesAvailable > 0) {
             qint64 bytesRead = reply->read(buffer, bytesAvailable);
-            bytesAvailable -= bytesRead;
-            buffer += bytesRead;
-
-            if (bytesRead > 0) {
+            if (bytesRead <= 0) {
                 break;
             }
+
+            bytesAvailable -= bytesRead;
+            buffer += bytesRead;
+            info->offset += bytesRead;
         }
         info->file.unmap(fileData);
     }
@@ -120,9 +369,110 @@ void AbstractImageDownloaderPrivate::readyRead()
     ImageInfo *info = runningReplies.value(reply);
     if (info) {
         readData(info, reply);
+        if (info->writeFailed) {
+            // There is no point in downloading the rest
+            reply->abort();
+        }
     }
 }
 
+// Classify the outcome of a download, to decide if it should be retried
+static int classifyError(ImageInfo *info, QNetworkReply *reply)
+{
+    if (info->writeFailed) {
+        return DiskImageError;
+    }
+
+    int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    if (status >= 500) {
+        return ServerImageError;
+    } else if (status == 408 || status == 429) {
+        return TransientImageError;
+    } else if (status >= 400) {
+        return ClientImageError;
+    } else if (status >= 300 && status != 304) {
+        // A redirection that was not followed does not carry the image
+        return ClientImageError;
+    }
+
+    switch (reply->error()) {
+    case QNetworkReply::NoError:
+        return NoImageError;
+    case QNetworkReply::ConnectionRefusedError:
+    case QNetworkReply::RemoteHostClosedError:
+    case QNetworkReply::HostNotFoundError:
+    case QNetworkReply::TimeoutError:
+    case QNetworkReply::TemporaryNetworkFailureError:
+    case QNetworkReply::NetworkSessionFailedError:
+    case QNetworkReply::UnknownNetworkError:
+    case QNetworkReply::ProxyConnectionRefusedError:
+    case QNetworkReply::ProxyConnectionClosedError:
+    case QNetworkReply::ProxyNotFoundError:
+    case QNetworkReply::ProxyTimeoutError:
+    case QNetworkReply::UnknownProxyError:
+        return TransientImageError;
+    case QNetworkReply::ServiceUnavailableError:
+    case QNetworkReply::InternalServerError:
+    case QNetworkReply::UnknownServerError:
+        return ServerImageError;
+    default:
+        return ClientImageError;
+    }
+}
+
+
+// Move a downloaded file to the content-addressed store
+//
+// The file is named after the hash of its content, so that an image
+// that is reachable through several identifiers is only stored once.
+// If the content is already stored, the downloaded file is removed.
+// Returns the path of the stored file.
+QString AbstractImageDownloaderPrivate::storeContent(ImageInfo *info)
+{
+    Q_Q(AbstractImageDownloader);
+    QCryptographicHash hash (QCryptographicHash::Sha1);
+    info->file.seek(0);
+    if (!hash.addData(&info->file)) {
+        return info->file.fileName();
+    }
+
+    QString contentFile = q->contentFile(hash.result().toHex(), info->url, info->data);
+    if (contentFile.isEmpty() || contentFile == info->file.fileName()) {
+        return info->file.fileName();
+    }
+
+    info->file.close();
+
+    if (QFile::exists(contentFile)) {
+        info->file.remove();
+        return contentFile;
+    }
+
+    ensureDirectory(contentFile);
+
+    if (!info->file.rename(contentFile)) {
+        qWarning() << Q_FUNC_INFO << "Failed to move" << info->file.fileName()
+                   << "to the content store:" << info->file.errorString();
+        return info->file.fileName();
+    }
+
+    return contentFile;
+}
+
+// Replace the cached file of a revalidated image by its new version
+//
+// Returns the path of the image.
+QString AbstractImageDownloaderPrivate::replaceCachedFile(ImageInfo *info)
+{
+    info->file.close();
+    QFile::remove(info->cachedFile);
+    if (!info->file.rename(info->cachedFile)) {
+        qWarning() << Q_FUNC_INFO << "Failed to move" << info->file.fileName()
+                   << "to" << info->cachedFile << info->file.errorString();
+    }
+
+    return info->file.fileName();
+}
 
 void AbstractImageDownloaderPrivate::slotFinished()
 {
@@ -138,25 +488,402 @@ void AbstractImageDownloaderPrivate::slotFinished()
     }
 
     readData(info, reply);
+    reply->deleteLater();
+
+    metrics.completed ++;
+    metrics.bytesReceived += info->offset;
+    metrics.addLatency(info->elapsed.elapsed());
+    if (reply->error() != QNetworkReply::NoError) {
+        metrics.failed ++;
+        metrics.failures[reply->error()] ++;
+    }
+
+    int errorClass = classifyError(info, reply);
+    if (errorClass != NoImageError) {
+        metrics.failureClasses[errorClass] ++;
+
+        // Do not leave a partial image behind
+        info->file.close();
+        if (info->offset > 0 || info->file.size() == 0) {
+            info->file.remove();
+        }
 
-    const QString fileName = info->file.fileName();
+        retry(info, errorClass);
+        resume();
+        return;
+    }
+
+    QString fileName = info->file.fileName();
+    const bool notModified = isNotModified(reply);
+
+    if (notModified) {
+        // The file we opened might not be the one that is revalidated, when
+        // it lives in the content-addressed store.
+        if (fileName != info->validators.file) {
+            if (info->file.size() == 0) {
+                info->file.remove();
+            }
+            fileName = info->validators.file;
+        }
+    } else {
+        // Drop what remains of a previous version of the file
+        info->file.resize(info->offset);
+    }
+
+    if (!notModified && contentAddressed) {
+        fileName = storeContent(info);
+    }
+
+    // A revalidated image that was moved to the content-addressed store
+    // does not replace the cached file. storeContent() renames info->file,
+    // so the downloaded file is compared with the path it had before.
+    if (!notModified && !info->cachedFile.isEmpty()
+            && fileName == info->cachedFile + QLatin1String(PARTIAL_SUFFIX)) {
+        fileName = replaceCachedFile(info);
+    }
 
     info->file.close();
 
+    if (!notModified) {
+        ImageValidators validators;
+        validators.file = fileName;
+        validators.etag = reply->rawHeader("ETag");
+        validators.lastModified = reply->rawHeader("Last-Modified");
+        validators.size = info->offset;
+        if (!validators.etag.isEmpty() || !validators.lastModified.isEmpty()) {
+            q->dbQueueValidators(info->url, info->data, validators);
+        }
+    }
+
+    addRequesters(&info->data, info->requesters);
     q->dbQueueImage(info->url, info->data, fileName);
 
     // Emit signal
     emit q->imageDownloaded(info->url, fileName, info->data);
 
+    derive(info->url, info->data, fileName);
+
+    qint64 bytes = info->offset;
+    delete info;
+
+    imageFinished(bytes);
+}
+
+// Produce the images that can be derived from a downloaded image
+//
+// Derived images that are queued are not downloaded anymore,
+// while images that are already being downloaded are not derived.
+void AbstractImageDownloaderPrivate::derive(const QString &url, const QVariantMap &metadata,
+                                            const QString &file)
+{
+    Q_Q(AbstractImageDownloader);
+    QList<ImageDerivation> derivations;
+    foreach (ImageDerivation derivation, q->derivations(url, metadata, file)) {
+        if (derivation.file.isEmpty() || pendingDerivations.contains(derivation.url)) {
+            continue;
+        }
+
+        bool running = false;
+        foreach (ImageInfo *info, runningReplies) {
+            if (info->url == derivation.url) {
+                running = true;
+                break;
+            }
+        }
+        if (running) {
+            continue;
+        }
+
+        // The derived image is reported to those who queued it too
+        for (int i = stack.count() - 1; i >= 0; --i) {
+            if (stack.at(i)->url == derivation.url) {
+                ImageInfo *info = stack.takeAt(i);
+                addRequesters(&derivation.metadata, info->requesters);
+                delete info;
+            }
+        }
+
+        ensureDirectory(derivation.file);
+        pendingDerivations.insert(derivation.url, QSet<QString>());
+        derivations.append(derivation);
+    }
+
+    if (!derivations.isEmpty()) {
+        derivationPool.start(new ImageDerivationTask(this, file, derivations));
+    }
+}
+
+void AbstractImageDownloaderPrivate::derivationFinished(const QString &url,
+                                                        const QVariantMap &metadata,
+                                                        const QString &file, bool ok)
+{
+    Q_Q(AbstractImageDownloader);
+    QSet<QString> requesters = pendingDerivations.take(url);
+    QVariantMap data = metadata;
+    addRequesters(&data, requesters);
+
+    if (!ok) {
+        // Download it instead
+        q->queue(url, data);
+        foreach (ImageInfo *info, stack) {
+            if (info->url == url) {
+                info->requesters.unite(requesters);
+                info->requesters.unite(data.value(QLatin1String(REQUESTERS_KEY))
+                                       .toStringList().toSet());
+            }
+        }
+        return;
+    }
+
+    q->dbQueueImage(url, data, file);
+    emit q->imageDownloaded(url, file, data);
+
+    imageFinished(QFileInfo(file).size());
+}
+
+// Abort a running download
+//
+// The partially written file is removed, unless nothing was written
+// in it yet, as it might still be a previously downloaded image.
+void AbstractImageDownloaderPrivate::abort(QNetworkReply *reply)
+{
+    ImageInfo *info = runningReplies.take(reply);
+
+    // Do not handle the finished signal emitted by abort()
+    reply->disconnect(this);
+    reply->abort();
+    reply->deleteLater();
+
+    if (!info) {
+        return;
+    }
+
+    info->file.close();
+    if (info->offset > 0 || info->file.size() == 0) {
+        info->file.remove();
+    }
+
     delete info;
+}
+
+// Schedule a failed download again, or park it
+//
+// Transient and server errors are retried after a delay, until
+// MAXIMUM_ATTEMPTS attempts were made. Other errors are not retried.
+void AbstractImageDownloaderPrivate::retry(ImageInfo *info, int errorClass)
+{
+    info->attempts ++;
+
+    const bool retryable = errorClass == TransientImageError || errorClass == ServerImageError;
+    if (!retryable || info->attempts >= MAXIMUM_ATTEMPTS) {
+        qint64 duration = errorClass == ClientImageError ? PARK_DURATION : TRANSIENT_PARK_DURATION;
+        parkedUrls.insert(info->url, QDateTime::currentMSecsSinceEpoch() + duration);
+        delete info;
+        return;
+    }
+
+    int delay = RETRY_DELAY << qMin(info->attempts - 1, 16);
+    delay = qMin(delay, MAXIMUM_RETRY_DELAY);
+    delay = delay / 2 + qrand() % (delay / 2 + 1);
+
+    info->offset = 0;
+    info->writeFailed = false;
+    info->validators = ImageValidators();
+    metrics.retries ++;
+
+    // Ticks are counted from the next one
+    int ticks = qMax(1, (delay + RETRY_WHEEL_TICK - 1) / RETRY_WHEEL_TICK);
+    RetryEntry entry;
+    entry.info = info;
+    entry.rounds = (ticks - 1) / RETRY_WHEEL_SLOTS;
+    retryWheel[(retryCursor + ticks) % RETRY_WHEEL_SLOTS].append(entry);
+    retryCount ++;
+
+    if (!retryTimer.isActive()) {
+        retryTimer.start();
+    }
+}
+
+// Advance the retry wheel, and queue the images that are due
+void AbstractImageDownloaderPrivate::retryTick()
+{
+    retryCursor = (retryCursor + 1) % RETRY_WHEEL_SLOTS;
+
+    QList<RetryEntry> &slot = retryWheel[retryCursor];
+    for (int i = slot.count() - 1; i >= 0; --i) {
+        if (slot.at(i).rounds > 0) {
+            slot[i].rounds --;
+            continue;
+        }
+
+        stack.append(slot.takeAt(i).info);
+        retryCount --;
+    }
+
+    if (retryCount == 0) {
+        retryTimer.stop();
+    }
+
+    manageStack();
+}
 
+// Find an image that waits to be retried
+ImageInfo * AbstractImageDownloaderPrivate::findRetry(const QString &url) const
+{
+    foreach (const QList<RetryEntry> &slot, retryWheel) {
+        foreach (const RetryEntry &entry, slot) {
+            if (entry.info->url == url) {
+                return entry.info;
+            }
+        }
+    }
+
+    return 0;
+}
+
+// Drop the images that wait to be retried
+//
+// If url is not empty, only this image is dropped. If requester is not
+// empty, the requester is removed, and images that are not requested
+// anymore are dropped.
+void AbstractImageDownloaderPrivate::dropRetries(const QString &url, const QString &requester)
+{
+    for (int i = 0; i < retryWheel.count(); ++i) {
+        QList<RetryEntry> &slot = retryWheel[i];
+        for (int j = slot.count() - 1; j >= 0; --j) {
+            ImageInfo *info = slot.at(j).info;
+            if (!url.isEmpty() && info->url != url) {
+                continue;
+            }
+            if (!requester.isEmpty()
+                && (!info->requesters.remove(requester) || !info->requesters.isEmpty())) {
+                continue;
+            }
+
+            delete info;
+            slot.removeAt(j);
+            retryCount --;
+        }
+    }
+
+    if (retryCount == 0) {
+        retryTimer.stop();
+    }
+}
+
+// Start the next downloads after images are cancelled or
+// failed, and save the images that are already downloaded
+// if there is nothing left to do.
+void AbstractImageDownloaderPrivate::resume()
+{
+    manageStack();
+
+    if (loadedCount > 0
+        && runningReplies.isEmpty() && stack.isEmpty() && pendingDerivations.isEmpty()) {
+        flush();
+    }
+}
+
+void AbstractImageDownloaderPrivate::flush()
+{
+    Q_Q(AbstractImageDownloader);
+    flushTimer.stop();
+    q->dbWrite();
+    loadedCount = 0;
+    loadedBytes = 0;
+    metrics.dbFlushes ++;
+    metricsChanged();
+}
+
+// Metrics are reported once METRICS_INTERVAL elapsed
+// after a change, to keep the overhead low.
+void AbstractImageDownloaderPrivate::metricsChanged()
+{
+    if (!metricsTimer.isActive()) {
+        metricsTimer.start();
+    }
+}
+
+void AbstractImageDownloaderPrivate::sampleMetrics()
+{
+    Q_Q(AbstractImageDownloader);
+    if (metrics.sampleTimer.isValid()) {
+        qint64 elapsed = metrics.sampleTimer.elapsed();
+        if (elapsed > 0) {
+            metrics.bytesPerSecond = (metrics.bytesReceived - metrics.sampleBytes) * 1000
+                                     / elapsed;
+        }
+    }
+    metrics.sampleTimer.start();
+    metrics.sampleBytes = metrics.bytesReceived;
+
+    emit q->metricsUpdated(q->metrics());
+}
+
+// Create the directory of a file if needed
+//
+// Directories that exist are remembered, so that
+// the filesystem is only checked once for each of them.
+bool AbstractImageDownloaderPrivate::ensureDirectory(const QString &file)
+{
+    QString path = QFileInfo(file).absolutePath();
+    if (createdDirectories.contains(path)) {
+        return true;
+    }
+
+    QDir dir (path);
+    if (!dir.exists() && !dir.mkpath(QLatin1String("."))) {
+        qWarning() << Q_FUNC_INFO << "Failed to create directory" << path;
+        return false;
+    }
+
+    createdDirectories.insert(path);
+    return true;
+}
+
+// List requesters in the "requesters" entry of the metadata
+void AbstractImageDownloaderPrivate::addRequesters(QVariantMap *metadata,
+                                                   const QSet<QString> &requesters)
+{
+    QStringList list = metadata->value(QLatin1String(REQUESTERS_KEY)).toStringList();
+    foreach (const QString &requester, requesters) {
+        if (!list.contains(requester)) {
+            list.append(requester);
+        }
+    }
+    metadata->insert(QLatin1String(REQUESTERS_KEY), list);
+}
+
+void AbstractImageDownloaderPrivate::imageFinished(qint64 bytes)
+{
     loadedCount ++;
+    loadedBytes += bytes;
     manageStack();
 
-    if (loadedCount > MAX_BATCH_SAVE
-        || (runningReplies.isEmpty() && stack.isEmpty())) {
-        q->dbWrite();
-        loadedCount = 0;
+    if ((maximumBatchSize > 0 && loadedCount >= maximumBatchSize)
+        || (maximumBytes > 0 && loadedBytes >= maximumBytes)
+        || (runningReplies.isEmpty() && stack.isEmpty() && pendingDerivations.isEmpty())) {
+        flush();
+    } else if (maximumLatency > 0 && !flushTimer.isActive()) {
+        flushTimer.start(maximumLatency);
+    }
+}
+
+// Changes that are not images do not trigger a write when there is
+// nothing left to download, so that they are grouped until the batch
+// is full or maximumLatency elapsed.
+void AbstractImageDownloaderPrivate::changesQueued()
+{
+    loadedCount ++;
+
+    if (maximumBatchSize > 0 && loadedCount >= maximumBatchSize) {
+        flush();
+    } else if (maximumLatency > 0) {
+        if (!flushTimer.isActive()) {
+            flushTimer.start(maximumLatency);
+        }
+    } else if (runningReplies.isEmpty() && stack.isEmpty() && pendingDerivations.isEmpty()) {
+        flush();
     }
 }
 
@@ -180,8 +907,30 @@ void AbstractImageDownloader::queue(const QString &url, const QVariantMap &metad
     }
 
 
+    QString requester = metadata.value(QLatin1String(REQUESTER_KEY)).toString();
+
+    // Do not try again images that failed recently
+    QHash<QString, qint64>::iterator parked = d->parkedUrls.find(url);
+    if (parked != d->parkedUrls.end()) {
+        if (parked.value() > QDateTime::currentMSecsSinceEpoch()) {
+            return;
+        }
+        d->parkedUrls.erase(parked);
+    }
+
+    if (ImageInfo *info = d->findRetry(url)) {
+        info->requesters.insert(requester);
+        return;
+    }
+
+    if (d->pendingDerivations.contains(url)) {
+        d->pendingDerivations[url].insert(requester);
+        return;
+    }
+
     foreach (ImageInfo *info, d->runningReplies) {
         if (info->url == url) {
+            info->requesters.insert(requester);
             return;
         }
     }
@@ -198,21 +947,237 @@ void AbstractImageDownloader::queue(const QString &url, const QVariantMap &metad
         info = new ImageInfo(url, metadata);
     }
 
+    info->requesters.insert(requester);
     d->stack.append(info);
     d->manageStack();
 }
 
+// Cancel the download of an image, whoever requested it
+void AbstractImageDownloader::cancel(const QString &url)
+{
+    Q_D(AbstractImageDownloader);
+    for (int i = d->stack.count() - 1; i >= 0; --i) {
+        if (d->stack.at(i)->url == url) {
+            delete d->stack.takeAt(i);
+        }
+    }
+
+    foreach (QNetworkReply *reply, d->runningReplies.keys()) {
+        if (d->runningReplies.value(reply)->url == url) {
+            d->abort(reply);
+        }
+    }
+
+    d->dropRetries(url, QString());
+    d->resume();
+}
+
+// Cancel the downloads of the images requested by a requester
+//
+// Images that were also requested by others are still downloaded.
+void AbstractImageDownloader::cancelRequester(const QString &requester)
+{
+    Q_D(AbstractImageDownloader);
+    if (requester.isEmpty()) {
+        return;
+    }
+
+    for (int i = d->stack.count() - 1; i >= 0; --i) {
+        ImageInfo *info = d->stack.at(i);
+        if (info->requesters.remove(requester) && info->requesters.isEmpty()) {
+            delete d->stack.takeAt(i);
+        }
+    }
+
+    foreach (QNetworkReply *reply, d->runningReplies.keys()) {
+        ImageInfo *info = d->runningReplies.value(reply);
+        if (info->requesters.remove(requester) && info->requesters.isEmpty()) {
+            d->abort(reply);
+        }
+    }
+
+    d->dropRetries(QString(), requester);
+    d->resume();
+}
+
+// Cancel all the downloads
+//
+// Images that are being derived are still reported.
+void AbstractImageDownloader::cancelAll()
+{
+    Q_D(AbstractImageDownloader);
+    qDeleteAll(d->stack);
+    d->stack.clear();
+
+    foreach (QNetworkReply *reply, d->runningReplies.keys()) {
+        d->abort(reply);
+    }
+
+    d->dropRetries(QString(), QString());
+    d->resume();
+}
+
+int AbstractImageDownloader::shardLevels() const
+{
+    Q_D(const AbstractImageDownloader);
+    return d->shardLevels;
+}
+
+int AbstractImageDownloader::shardWidth() const
+{
+    Q_D(const AbstractImageDownloader);
+    return d->shardWidth;
+}
+
+// Set the layout of the directories in which files are stored
+//
+// Files are stored in levels of directories, each of them named
+// after width hex characters of the hash of the file. Subclasses
+// pass these values to makeOutputFile and makeContentFile, and are
+// responsible for moving the files that use a previous layout.
+void AbstractImageDownloader::setSharding(int levels, int width)
+{
+    Q_D(AbstractImageDownloader);
+    width = qBound(1, width, MAXIMUM_SHARD_WIDTH);
+    levels = qBound(0, levels, 32 / width);
+    d->shardLevels = levels;
+    d->shardWidth = width;
+}
+
+bool AbstractImageDownloader::isContentAddressed() const
+{
+    Q_D(const AbstractImageDownloader);
+    return d->contentAddressed;
+}
+
+// Store downloaded images in a content-addressed store, where
+// files are named after the hash of their content, and are
+// shared by all identifiers pointing to the same image.
+// contentFile should be implemented to provide the path of the files.
+void AbstractImageDownloader::setContentAddressed(bool contentAddressed)
+{
+    Q_D(AbstractImageDownloader);
+    d->contentAddressed = contentAddressed;
+}
+
+// Describe the activity of the downloader
+//
+// Latencies are in milliseconds, and are computed over the
+// last requests. Failures are counted by network error, and by class:
+// transient, client, server and disk failures. Failed downloads that
+// are waiting to be retried, and parked images, are reported too.
+QVariantMap AbstractImageDownloader::metrics() const
+{
+    Q_D(const AbstractImageDownloader);
+    const ImageDownloaderMetrics &metrics = d->metrics;
+
+    QMetaEnum errors = QNetworkReply::staticMetaObject.enumerator(
+                QNetworkReply::staticMetaObject.indexOfEnumerator("NetworkError"));
+    QVariantMap failures;
+    for (QHash<int, int>::const_iterator i = metrics.failures.constBegin();
+         i != metrics.failures.constEnd(); ++i) {
+        const char *key = errors.isValid() ? errors.valueToKey(i.key()) : 0;
+        failures.insert(key ? QString::fromLatin1(key) : QString::number(i.key()), i.value());
+    }
+
+    QVariantMap result;
+    result.insert(QLatin1String("queueDepth"), d->stack.count());
+    result.insert(QLatin1String("peakQueueDepth"), metrics.peakQueueDepth);
+    result.insert(QLatin1String("runningCount"), d->runningReplies.count());
+    result.insert(QLatin1String("derivingCount"), d->pendingDerivations.count());
+    result.insert(QLatin1String("completedCount"), metrics.completed);
+    result.insert(QLatin1String("failedCount"), metrics.failed);
+    result.insert(QLatin1String("failures"), failures);
+    result.insert(QLatin1String("transientFailures"),
+                  metrics.failureClasses.value(TransientImageError));
+    result.insert(QLatin1String("clientFailures"), metrics.failureClasses.value(ClientImageError));
+    result.insert(QLatin1String("serverFailures"), metrics.failureClasses.value(ServerImageError));
+    result.insert(QLatin1String("diskFailures"), metrics.failureClasses.value(DiskImageError));
+    result.insert(QLatin1String("retryCount"), metrics.retries);
+    result.insert(QLatin1String("retryingCount"), d->retryCount);
+    result.insert(QLatin1String("parkedCount"), d->parkedUrls.count());
+    result.insert(QLatin1String("bytesReceived"), metrics.bytesReceived);
+    result.insert(QLatin1String("bytesPerSecond"), metrics.bytesPerSecond);
+    result.insert(QLatin1String("latencyP50"), metrics.latencyPercentile(50));
+    result.insert(QLatin1String("latencyP90"), metrics.latencyPercentile(90));
+    result.insert(QLatin1String("latencyP99"), metrics.latencyPercentile(99));
+    result.insert(QLatin1String("dbFlushCount"), metrics.dbFlushes);
+    return result;
+}
+
+// Set when downloaded images are saved in the database
+//
+// Images are saved once maximumBatchSize images or maximumBytes bytes are
+// downloaded, or maximumLatency ms after the first unsaved image was
+// downloaded. A value of 0 disables the corresponding limit.
+void AbstractImageDownloader::setFlushPolicy(int maximumBatchSize, int maximumLatency,
+                                             qint64 maximumBytes)
+{
+    Q_D(AbstractImageDownloader);
+    d->maximumBatchSize = maximumBatchSize;
+    d->maximumLatency = maximumLatency;
+    d->maximumBytes = maximumBytes;
+
+    if (d->loadedCount > 0 && maximumLatency > 0
+        && (!d->flushTimer.isActive() || d->flushTimer.interval() > maximumLatency)) {
+        d->flushTimer.start(maximumLatency);
+    } else if (maximumLatency <= 0) {
+        d->flushTimer.stop();
+    }
+}
+
 QNetworkReply *AbstractImageDownloader::createReply(const QString &url, const QVariantMap &metadata)
 {
     Q_UNUSED(metadata)
     Q_D(AbstractImageDownloader);
     QNetworkRequest request (url);
+    request.setAttribute(QNetworkRequest::FollowRedirectsAttribute, true);
+    return d->networkAccessManager->get(request);
+}
+
+QNetworkReply *AbstractImageDownloader::createReply(const QString &url, const QVariantMap &metadata,
+                                                    const ImageValidators &validators)
+{
+    if (validators.etag.isEmpty() && validators.lastModified.isEmpty()) {
+        return createReply(url, metadata);
+    }
+
+    Q_D(AbstractImageDownloader);
+    QNetworkRequest request (url);
+    request.setAttribute(QNetworkRequest::FollowRedirectsAttribute, true);
+    if (!validators.etag.isEmpty()) {
+        request.setRawHeader("If-None-Match", validators.etag);
+    }
+    if (!validators.lastModified.isEmpty()) {
+        request.setRawHeader("If-Modified-Since", validators.lastModified);
+    }
     return d->networkAccessManager->get(request);
 }
 
+// Directories in which a file is stored, made of
+// the first characters of the hash of the file
+static QString shardDirectory(const QByteArray &hash, int shardLevels, int shardWidth)
+{
+    QStringList directories;
+    for (int i = 0; i < shardLevels; ++i) {
+        directories.append(QString::fromLatin1(hash.mid(i * shardWidth, shardWidth)));
+    }
+    return directories.join(QLatin1String("/"));
+}
+
+// Output file of an identifier, with the default layout of directories
 QString AbstractImageDownloader::makeOutputFile(SocialSyncInterface::SocialNetwork socialNetwork,
                                                  SocialSyncInterface::DataType dataType,
                                                  const QString &identifier)
+{
+    return makeOutputFile(socialNetwork, dataType, identifier,
+                          DEFAULT_SHARD_LEVELS, DEFAULT_SHARD_WIDTH);
+}
+
+QString AbstractImageDownloader::makeOutputFile(SocialSyncInterface::SocialNetwork socialNetwork,
+                                                 SocialSyncInterface::DataType dataType,
+                                                 const QString &identifier,
+                                                 int shardLevels, int shardWidth)
 {
     if (identifier.isEmpty()) {
         return QString();
@@ -221,15 +1186,57 @@ QString AbstractImageDownloader::makeOutputFile(SocialSyncInterface::SocialNetwo
     QCryptographicHash hash (QCryptographicHash::Md5);
     hash.addData(identifier.toLocal8Bit());
     QByteArray hashedIdentifier = hash.result().toHex();
-    QString firstLetter = QString::fromLatin1(hashedIdentifier.left(1));
 
-    QString path = QString("%1/%2/%3/%4/%5.jpg").arg(PRIVILEGED_DATA_DIR,
-                                                        SocialSyncInterface::dataType(dataType),
-                                                        SocialSyncInterface::socialNetwork(socialNetwork),
-                                                        firstLetter, identifier);
+    QString path = QString("%1/%2/%3").arg(PRIVILEGED_DATA_DIR,
+                                           SocialSyncInterface::dataType(dataType),
+                                           SocialSyncInterface::socialNetwork(socialNetwork));
+    QString shard = shardDirectory(hashedIdentifier, shardLevels, shardWidth);
+    if (!shard.isEmpty()) {
+        path.append(QLatin1Char('/') + shard);
+    }
+    path.append(QString("/%1.jpg").arg(identifier));
+    return path;
+}
+
+QString AbstractImageDownloader::makeContentFile(SocialSyncInterface::SocialNetwork socialNetwork,
+                                                 SocialSyncInterface::DataType dataType,
+                                                 const QByteArray &contentHash,
+                                                 int shardLevels, int shardWidth)
+{
+    if (contentHash.isEmpty()) {
+        return QString();
+    }
+
+    QString path = QString("%1/%2/%3/blobs").arg(PRIVILEGED_DATA_DIR,
+                                                 SocialSyncInterface::dataType(dataType),
+                                                 SocialSyncInterface::socialNetwork(socialNetwork));
+    QString shard = shardDirectory(contentHash, shardLevels, shardWidth);
+    if (!shard.isEmpty()) {
+        path.append(QLatin1Char('/') + shard);
+    }
+    path.append(QString("/%1.jpg").arg(QString::fromLatin1(contentHash)));
     return path;
 }
 
+QString AbstractImageDownloader::contentFile(const QByteArray &contentHash, const QString &url,
+                                             const QVariantMap &metadata) const
+{
+    Q_UNUSED(contentHash)
+    Q_UNUSED(url)
+    Q_UNUSED(metadata)
+    return QString();
+}
+
+QList<ImageDerivation> AbstractImageDownloader::derivations(const QString &url,
+                                                            const QVariantMap &metadata,
+                                                            const QString &file)
+{
+    Q_UNUSED(url)
+    Q_UNUSED(metadata)
+    Q_UNUSED(file)
+    return QList<ImageDerivation>();
+}
+
 bool AbstractImageDownloader::dbInit()
 {
     return true;
@@ -243,10 +1250,33 @@ void AbstractImageDownloader::dbQueueImage(const QString &url, const QVariantMap
     Q_UNUSED(file)
 }
 
+bool AbstractImageDownloader::dbValidators(const QString &url, const QVariantMap &metadata,
+                                           ImageValidators *validators)
+{
+    Q_UNUSED(url)
+    Q_UNUSED(metadata)
+    Q_UNUSED(validators)
+    return false;
+}
+
+void AbstractImageDownloader::dbQueueValidators(const QString &url, const QVariantMap &metadata,
+                                                const ImageValidators &validators)
+{
+    Q_UNUSED(url)
+    Q_UNUSED(metadata)
+    Q_UNUSED(validators)
+}
+
 void AbstractImageDownloader::dbWrite()
 {
 }
 
+void AbstractImageDownloader::scheduleDbWrite()
+{
+    Q_D(AbstractImageDownloader);
+    d->changesQueued();
+}
+
 bool AbstractImageDownloader::dbClose()
 {
     return true;
@@ -22,8 +22,32 @@
 #include "socialsyncinterface.h"
 
 #include <QtCore/QObject>
+#include <QtCore/QList>
+#include <QtCore/QSize>
 #include <QtCore/QVariantMap>
 
+// Validators sent by the server along with an image, used
+// to revalidate a cached file with a conditional request.
+struct ImageValidators
+{
+    ImageValidators() : size(-1) {}
+
+    QString file;
+    QByteArray etag;
+    QByteArray lastModified;
+    qint64 size;
+};
+
+// An image that is produced locally by scaling down a downloaded image,
+// instead of downloading url. The scaled image covers size.
+struct ImageDerivation
+{
+    QString url;
+    QVariantMap metadata;
+    QString file;
+    QSize size;
+};
+
 class QNetworkReply;
 class AbstractImageDownloaderPrivate;
 class AbstractImageDownloader : public QObject
@@ -33,22 +57,55 @@ public:
     explicit AbstractImageDownloader();
     virtual ~AbstractImageDownloader();
 
+    bool isContentAddressed() const;
+    int shardLevels() const;
+    int shardWidth() const;
+    QVariantMap metrics() const;
+
 public Q_SLOTS:
     void queue(const QString &url, const QVariantMap &data);
+    void cancel(const QString &url);
+    void cancelRequester(const QString &requester);
+    void cancelAll();
+    void setContentAddressed(bool contentAddressed);
+    void setFlushPolicy(int maximumBatchSize, int maximumLatency, qint64 maximumBytes);
+    void setSharding(int levels, int width);
 
 Q_SIGNALS:
     void imageDownloaded(const QString &url, const QString &path, const QVariantMap &metadata);
+    void metricsUpdated(const QVariantMap &metrics);
 
 protected:
     static QString makeOutputFile(SocialSyncInterface::SocialNetwork socialNetwork,
                                   SocialSyncInterface::DataType dataType,
                                   const QString &identifier);
+    static QString makeOutputFile(SocialSyncInterface::SocialNetwork socialNetwork,
+                                  SocialSyncInterface::DataType dataType,
+                                  const QString &identifier,
+                                  int shardLevels, int shardWidth);
+    static QString makeContentFile(SocialSyncInterface::SocialNetwork socialNetwork,
+                                   SocialSyncInterface::DataType dataType,
+                                   const QByteArray &contentHash,
+                                   int shardLevels, int shardWidth);
 
     virtual QNetworkReply * createReply(const QString &url, const QVariantMap &metadata);
 
+    // Reply to a conditional request when validators are known, and
+    // createReply(url, metadata) otherwise
+    virtual QNetworkReply * createReply(const QString &url, const QVariantMap &metadata,
+                                        const ImageValidators &validators);
+
     // Output file based on passed data
     virtual QString outputFile(const QString &url, const QVariantMap &metadata) const = 0;
 
+    // File in the content-addressed store based on the hash of the content
+    virtual QString contentFile(const QByteArray &contentHash, const QString &url,
+                                const QVariantMap &metadata) const;
+
+    // Images that can be derived from a downloaded image
+    virtual QList<ImageDerivation> derivations(const QString &url, const QVariantMap &metadata,
+                                               const QString &file);
+
     // Init the database if not initialized
     // used to delay initialization of the database
     virtual bool dbInit();
@@ -57,9 +114,21 @@ protected:
     virtual void dbQueueImage(const QString &url, const QVariantMap &metadata,
                               const QString &file);
 
+    // Get the validators of a previously downloaded image
+    virtual bool dbValidators(const QString &url, const QVariantMap &metadata,
+                              ImageValidators *validators);
+
+    // Queue validators of a downloaded image in the database
+    virtual void dbQueueValidators(const QString &url, const QVariantMap &metadata,
+                                   const ImageValidators &validators);
+
     // Write in the database
     virtual void dbWrite();
 
+    // Write the changes that were queued in the database outside of
+    // downloads along with the next batch of images
+    void scheduleDbWrite();
+
     // Close the database.
     // We must close the database prior to gracefully terminating the thread / destroying the worker object.
     virtual bool dbClose();
@@ -33,19 +33,81 @@
 #define ABSTRACTIMAGEDOWNLOADER_P_H
 
 #include <QtCore/QObject>
+#include <QtCore/QElapsedTimer>
 #include <QtCore/QFile>
+#include <QtCore/QHash>
 #include <QtCore/QMap>
 #include <QtCore/QPair>
+#include <QtCore/QSet>
+#include <QtCore/QThreadPool>
+#include <QtCore/QTimer>
 #include <QtCore/QVariantMap>
+#include <QtCore/QVector>
 #include <QtNetwork/QNetworkAccessManager>
 
+#include "abstractimagedownloader.h"
+
+// Classes of errors, that are handled differently: transient and
+// server errors are retried, other errors are not.
+enum ImageErrorClass
+{
+    NoImageError,
+    TransientImageError,
+    ClientImageError,
+    ServerImageError,
+    DiskImageError
+};
+
 struct ImageInfo
 {
-    ImageInfo(const QString &url, const QVariantMap &data) : url(url), data(data) {}
+    ImageInfo(const QString &url, const QVariantMap &data)
+        : url(url), data(data), offset(0), attempts(0), writeFailed(false) {}
 
     QString url;
     QVariantMap data;
     QFile file;
+    ImageValidators validators;
+    QString cachedFile; // Replaced by file once downloaded, when revalidating
+    qint64 offset;
+    QSet<QString> requesters;
+    QElapsedTimer elapsed;
+    int attempts;
+    bool writeFailed;
+};
+
+// An image waiting in the retry wheel, for rounds more turns
+struct RetryEntry
+{
+    ImageInfo *info;
+    int rounds;
+};
+
+// Counters describing the activity of a downloader
+//
+// They are updated as images are downloaded, and
+// are sampled by AbstractImageDownloader::metrics().
+struct ImageDownloaderMetrics
+{
+    ImageDownloaderMetrics();
+
+    void addLatency(qint64 latency);
+    qint64 latencyPercentile(int percentile) const;
+
+    int peakQueueDepth;
+    int completed;
+    int failed;
+    int dbFlushes;
+    int retries;
+    qint64 bytesReceived;
+    qint64 bytesPerSecond;
+    QHash<int, int> failures;
+    QHash<int, int> failureClasses;
+    QVector<qint64> latencies;
+    int latencyIndex;
+
+    // Used to compute the bandwidth between two samples
+    QElapsedTimer sampleTimer;
+    qint64 sampleBytes;
 };
 
 
@@ -63,14 +125,50 @@ protected:
 
 private:
     void manageStack();
+    QString storeContent(ImageInfo *info);
+    QString replaceCachedFile(ImageInfo *info);
+    void derive(const QString &url, const QVariantMap &metadata, const QString &file);
+    void imageFinished(qint64 bytes);
+    void changesQueued();
+    bool ensureDirectory(const QString &file);
+    static void addRequesters(QVariantMap *metadata, const QSet<QString> &requesters);
+    void abort(QNetworkReply *reply);
+    void resume();
+    void retry(ImageInfo *info, int errorClass);
+    ImageInfo * findRetry(const QString &url) const;
+    void dropRetries(const QString &url, const QString &requester);
+    void metricsChanged();
     QMap<QNetworkReply *, ImageInfo *> runningReplies;
     QList<ImageInfo *> stack;
+    QHash<QString, QSet<QString> > pendingDerivations;
+    QThreadPool derivationPool;
     int loadedCount;
+    qint64 loadedBytes;
+    int maximumBatchSize;
+    int maximumLatency;
+    qint64 maximumBytes;
+    QTimer flushTimer;
+    bool contentAddressed;
+    int shardLevels;
+    int shardWidth;
+    QSet<QString> createdDirectories;
+    QVector<QList<RetryEntry> > retryWheel;
+    int retryCursor;
+    int retryCount;
+    QTimer retryTimer;
+    QHash<QString, qint64> parkedUrls;
+    ImageDownloaderMetrics metrics;
+    QTimer metricsTimer;
     Q_DECLARE_PUBLIC(AbstractImageDownloader)
 
 private Q_SLOTS:
     void readyRead();
     void slotFinished();
+    void derivationFinished(const QString &url, const QVariantMap &metadata,
+                            const QString &file, bool ok);
+    void sampleMetrics();
+    void flush();
+    void retryTick();
 };
 
 #endif // ABSTRACTIMAGEDOWNLOADER_P_H
@@ -39,6 +39,13 @@
 // it. dbBeginTransaction, dbWrite and dbCommitTransaction
 // are particularly handy, and can make write operations
 // into db very fast.
+//
+// Tables can also record their changes in a change log, so that
+// readers can only query what changed since they last read them.
+// The log is filled by triggers, and only keeps the last
+// CHANGE_LOG_SIZE changes.
+
+static const int CHANGE_LOG_SIZE = 10000;
 
 AbstractSocialCacheDatabasePrivate::AbstractSocialCacheDatabasePrivate(AbstractSocialCacheDatabase *q):
     q_ptr(q), mutex(0), valid(false)
@@ -198,6 +205,83 @@ bool AbstractSocialCacheDatabasePrivate::doDelete(const QString &table, const QS
     return allSucceeded;
 }
 
+static QString queryValue(const QVariant &value, QVariantMap *values)
+{
+    QString placeholder = QString(QLatin1String(":query%1")).arg(values->count());
+
+    // Dates are stored as seconds since epoch
+    if (value.type() == QVariant::DateTime) {
+        values->insert(placeholder, value.toDateTime().toTime_t());
+    } else {
+        values->insert(placeholder, value);
+    }
+    return placeholder;
+}
+
+void AbstractSocialCacheDatabasePrivate::queryClauses(const SocialCacheQuery &query,
+                                                      const QHash<QString, QString> &columns,
+                                                      QStringList *conditions, QString *orderBy,
+                                                      QVariantMap *values)
+{
+    for (QVariantMap::const_iterator i = query.filters.constBegin();
+         i != query.filters.constEnd(); ++i) {
+        const QString column = columns.value(i.key());
+        if (column.isEmpty()) {
+            qWarning() << Q_FUNC_INFO << "Cannot filter by" << i.key();
+            continue;
+        }
+
+        QStringList comparisons;
+        const QVariant &value = i.value();
+        if (value.type() == QVariant::Map) {
+            QVariantMap range = value.toMap();
+            if (range.contains(QLatin1String("from"))) {
+                comparisons.append(QLatin1String(">= ")
+                                   + queryValue(range.value(QLatin1String("from")), values));
+            }
+            if (range.contains(QLatin1String("to"))) {
+                comparisons.append(QLatin1String("<= ")
+                                   + queryValue(range.value(QLatin1String("to")), values));
+            }
+        } else if (value.type() == QVariant::List || value.type() == QVariant::StringList) {
+            QStringList placeholders;
+            foreach (const QVariant &item, value.toList()) {
+                placeholders.append(queryValue(item, values));
+            }
+            comparisons.append(QString(QLatin1String("IN (%1)"))
+                               .arg(placeholders.join(QLatin1String(", "))));
+        } else {
+            comparisons.append(QLatin1String("= ") + queryValue(value, values));
+        }
+
+        foreach (const QString &comparison, comparisons) {
+            if (column.contains(QLatin1String("%1"))) {
+                conditions->append(column.arg(comparison));
+            } else {
+                conditions->append(column + QLatin1Char(' ') + comparison);
+            }
+        }
+    }
+
+    if (!query.sortField.isEmpty()) {
+        const QString column = columns.value(query.sortField);
+        if (column.isEmpty() || column.contains(QLatin1String("%1"))) {
+            qWarning() << Q_FUNC_INFO << "Cannot sort by" << query.sortField;
+        } else {
+            *orderBy = column + (query.sortOrder == Qt::DescendingOrder
+                                 ? QLatin1String(" DESC") : QLatin1String(" ASC"));
+        }
+    }
+}
+
+void AbstractSocialCacheDatabasePrivate::bindQueryValues(QSqlQuery &query,
+                                                         const QVariantMap &values)
+{
+    for (QVariantMap::const_iterator i = values.constBegin(); i != values.constEnd(); ++i) {
+        query.bindValue(i.key(), i.value());
+    }
+}
+
 AbstractSocialCacheDatabase::AbstractSocialCacheDatabase()
     : d_ptr(new AbstractSocialCacheDatabasePrivate(this))
 {
@@ -341,6 +425,215 @@ bool AbstractSocialCacheDatabase::dbCreatePragmaVersion(int version)
     return true;
 }
 
+// Record the changes of a table in the change log
+//
+// The identifiers of inserted, updated and removed rows are recorded
+// under logName, so that several tables can be logged as one, when
+// they describe the same items.
+// Usually used when implementing dbCreateTable.
+bool AbstractSocialCacheDatabase::dbCreateChangeLog(const QString &table,
+                                                    const QString &identifierColumn,
+                                                    const QString &logName)
+{
+    Q_D(AbstractSocialCacheDatabase);
+    QSqlQuery query (d->db);
+    query.prepare("CREATE TABLE IF NOT EXISTS changes ("
+                  "sequence INTEGER PRIMARY KEY AUTOINCREMENT,"
+                  "tableName TEXT,"
+                  "identifier TEXT)");
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Unable to create changes table:" << query.lastError().text();
+        return false;
+    }
+
+    query.prepare("CREATE INDEX IF NOT EXISTS changes_tableName ON changes(tableName, sequence)");
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Unable to create changes tableName index:"
+                   << query.lastError().text();
+        return false;
+    }
+
+    static const char *events[] = { "INSERT", "UPDATE", "DELETE" };
+    for (int i = 0; i < 3; ++i) {
+        QString event = QLatin1String(events[i]);
+        QString row = event == QLatin1String("DELETE") ? QLatin1String("OLD")
+                                                       : QLatin1String("NEW");
+        QString queryString = QString(QLatin1String(
+                "CREATE TRIGGER IF NOT EXISTS %1_%2_changes AFTER %3 ON %1 "
+                "BEGIN INSERT INTO changes (tableName, identifier) VALUES ('%4', %5.%6); END"))
+                .arg(table, event.toLower(), event, logName, row, identifierColumn);
+        query.prepare(queryString);
+        if (!query.exec()) {
+            qWarning() << Q_FUNC_INFO << "Unable to create" << event << "trigger on" << table
+                       << query.lastError().text();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Remove old entries from the change log
+//
+// Should be called while writing, in a transaction.
+bool AbstractSocialCacheDatabase::dbPruneChangeLog()
+{
+    Q_D(AbstractSocialCacheDatabase);
+    QSqlQuery query (d->db);
+    query.prepare("DELETE FROM changes WHERE sequence <= "
+                  "(SELECT MAX(sequence) FROM changes) - :size");
+    query.bindValue(":size", CHANGE_LOG_SIZE);
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Failed to prune changes:" << query.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+// Sequence number of the last change recorded in the change log
+//
+// Changes that happen later have a greater sequence number. It is
+// used as a watermark, to query the changes that happened after it.
+qint64 AbstractSocialCacheDatabase::changeSequence(bool *ok) const
+{
+    AbstractSocialCacheDatabasePrivate * const d
+            = const_cast<AbstractSocialCacheDatabasePrivate *>(d_func());
+    if (ok) {
+        *ok = false;
+    }
+
+    if (!d->valid || !d->mutex->lock()) {
+        qWarning() << Q_FUNC_INFO << "unable to acquire lock";
+        return -1;
+    }
+
+    QSqlQuery query (d->db);
+    query.prepare("SELECT IFNULL(MAX(sequence), 0) FROM changes");
+    if (!query.exec() || !query.next()) {
+        qWarning() << Q_FUNC_INFO << "Failed to query changes:" << query.lastError().text();
+        d->mutex->unlock();
+        return -1;
+    }
+
+    qint64 sequence = query.value(0).toLongLong();
+    d->mutex->unlock();
+
+    if (ok) {
+        *ok = true;
+    }
+    return sequence;
+}
+
+// Check if all the changes that happened after a sequence
+// number are still in the change log
+//
+// It does not tell if there are such changes. An empty log is complete,
+// as pruning always keeps the last changes.
+bool AbstractSocialCacheDatabase::isChangeLogComplete(qint64 sequence) const
+{
+    AbstractSocialCacheDatabasePrivate * const d
+            = const_cast<AbstractSocialCacheDatabasePrivate *>(d_func());
+    if (sequence < 0) {
+        return false;
+    }
+
+    if (!d->valid || !d->mutex->lock()) {
+        qWarning() << Q_FUNC_INFO << "unable to acquire lock";
+        return false;
+    }
+
+    QSqlQuery query (d->db);
+    query.prepare("SELECT MIN(sequence) FROM changes");
+    if (!query.exec() || !query.next()) {
+        qWarning() << Q_FUNC_INFO << "Failed to query changes:" << query.lastError().text();
+        d->mutex->unlock();
+        return false;
+    }
+
+    QVariant first = query.value(0);
+    d->mutex->unlock();
+    return first.isNull() || first.toLongLong() <= sequence + 1;
+}
+
+// Names of the logged tables that changed after a sequence number
+//
+// Tables are listed under the name they are logged with.
+QStringList AbstractSocialCacheDatabase::changedTables(qint64 sequence, bool *ok) const
+{
+    AbstractSocialCacheDatabasePrivate * const d
+            = const_cast<AbstractSocialCacheDatabasePrivate *>(d_func());
+    if (ok) {
+        *ok = false;
+    }
+
+    if (!d->valid || !d->mutex->lock()) {
+        qWarning() << Q_FUNC_INFO << "unable to acquire lock";
+        return QStringList();
+    }
+
+    QSqlQuery query (d->db);
+    query.prepare("SELECT DISTINCT tableName FROM changes WHERE sequence > :sequence");
+    query.bindValue(":sequence", sequence);
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Failed to query changes:" << query.lastError().text();
+        d->mutex->unlock();
+        return QStringList();
+    }
+
+    QStringList tables;
+    while (query.next()) {
+        tables.append(query.value(0).toString());
+    }
+
+    d->mutex->unlock();
+
+    if (ok) {
+        *ok = true;
+    }
+    return tables;
+}
+
+// Path of the database file
+QString AbstractSocialCacheDatabase::databaseFile() const
+{
+    Q_D(const AbstractSocialCacheDatabase);
+    return d->db.databaseName();
+}
+
+// Version of the data of the database
+//
+// The version changes each time another connection, from this
+// process or from another one, commits a change to the database.
+// Changes committed by this connection do not change it.
+int AbstractSocialCacheDatabase::dataVersion(bool *ok) const
+{
+    AbstractSocialCacheDatabasePrivate * const d
+            = const_cast<AbstractSocialCacheDatabasePrivate *>(d_func());
+    if (ok) {
+        *ok = false;
+    }
+
+    if (!d->valid || !d->mutex->lock()) {
+        qWarning() << Q_FUNC_INFO << "unable to acquire lock";
+        return -1;
+    }
+
+    QSqlQuery query (d->db);
+    if (!query.exec(QLatin1String("PRAGMA data_version")) || !query.next()) {
+        qWarning() << Q_FUNC_INFO << "Failed to query data version:" << query.lastError().text();
+        d->mutex->unlock();
+        return -1;
+    }
+
+    int version = query.value(0).toInt();
+    d->mutex->unlock();
+
+    if (ok) {
+        *ok = true;
+    }
+    return version;
+}
+
 // Begin a transaction
 //
 // Begin a transaction, so that insertion
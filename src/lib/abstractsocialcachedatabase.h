@@ -21,7 +21,28 @@
 #define ABSTRACTSOCIALCACHEDATABASE_H
 
 #include <QtCore/QMap>
+#include <QtCore/QStringList>
 #include <QtCore/QVariantList>
+#include <QtCore/QVariantMap>
+
+// Sorting and filtering of the rows read from a database
+//
+// Fields are names that databases map to their columns, and fields
+// that a database does not know are ignored. A filter matches a value,
+// one of a list of values, or a range, given as a map with optional
+// "from" and "to" values. Databases with a search index also select
+// the rows matching a search text, ranked by relevance.
+struct SocialCacheQuery
+{
+    SocialCacheQuery() : sortOrder(Qt::AscendingOrder) {}
+
+    bool isEmpty() const { return sortField.isEmpty() && filters.isEmpty() && search.isEmpty(); }
+
+    QString sortField;
+    Qt::SortOrder sortOrder;
+    QVariantMap filters;
+    QString search;
+};
 
 class AbstractSocialCacheDatabasePrivate;
 class AbstractSocialCacheDatabase
@@ -35,6 +56,15 @@ public:
     bool closeDatabase();
     bool isValid() const;
 
+    // Change log
+    qint64 changeSequence(bool *ok = 0) const;
+    bool isChangeLogComplete(qint64 sequence) const;
+    QStringList changedTables(qint64 sequence, bool *ok = 0) const;
+
+    // Change notification
+    QString databaseFile() const;
+    int dataVersion(bool *ok = 0) const;
+
 protected:
     enum QueryMode {
         Insert,
@@ -51,6 +81,9 @@ protected:
     virtual bool dbCreateTables() = 0;
     virtual bool dbDropTables() = 0;
     bool dbCreatePragmaVersion(int version);
+    bool dbCreateChangeLog(const QString &table, const QString &identifierColumn,
+                           const QString &logName);
+    bool dbPruneChangeLog();
 
     bool dbBeginTransaction();
     bool dbWrite(const QString &table, const QStringList &keys,
@@ -21,7 +21,9 @@
 #define ABSTRACTSOCIALCACHEDATABASE_P_H
 
 #include <QtCore/QtGlobal>
+#include <QtCore/QHash>
 #include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlQuery>
 #include "semaphore_p.h"
 #include "abstractsocialcachedatabase.h"
 
@@ -34,6 +36,13 @@ public:
 
     QSqlDatabase db;
 
+    // Conditions and ordering of a query, for the fields that are mapped to
+    // columns. Columns containing %1 are conditions, where %1 is replaced
+    // by the comparison. Values are bound with bindQueryValues.
+    static void queryClauses(const SocialCacheQuery &query, const QHash<QString, QString> &columns,
+                             QStringList *conditions, QString *orderBy, QVariantMap *values);
+    static void bindQueryValues(QSqlQuery &query, const QVariantMap &values);
+
 protected:
     AbstractSocialCacheDatabase * const q_ptr;
     ProcessMutex *mutex; // Process (and thread) mutex to prevent concurrent write
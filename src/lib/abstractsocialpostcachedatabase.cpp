@@ -17,8 +17,9 @@
  */
 
 #include "abstractsocialpostcachedatabase.h"
-#include "abstractsocialcachedatabase_p.h"
+#include "abstractsocialpostcachedatabase_p.h"
 #include <QtCore/QDebug>
+#include <QtCore/QRegExp>
 #include <QtCore/QStringList>
 #include <QtSql/QSqlQuery>
 #include <QtSql/QSqlError>
@@ -27,6 +28,28 @@ static const char *INVALID = "invalid";
 static const char *PHOTO = "photo";
 static const char *VIDEO = "video";
 
+// Columns read by readPosts
+static const char *POST_COLUMNS = "posts.identifier, posts.name, posts.body, posts.timestamp";
+
+// Search index
+//
+// posts_fts is an FTS5 table indexing the name, the body, and the values
+// of the extra fields of posts, that contain the text of their attachments.
+// Its rows have the rowid of the indexed posts, and are written again
+// when a post is written, since replacing a post changes its rowid.
+// When FTS5 is not available, searches fall back to LIKE patterns
+// on the same columns, that match the name, the body or any extra value.
+static const char *SEARCH_INDEX_INSERT = "INSERT INTO posts_fts (rowid, name, body, extra) "\
+                                         "SELECT rowid, name, body, (SELECT group_concat(value, ' ') "\
+                                         "FROM extra WHERE extra.postId = posts.identifier) "\
+                                         "FROM posts";
+static const char *SEARCH_INDEX_DELETE = "DELETE FROM posts_fts WHERE rowid IN "\
+                                         "(SELECT rowid FROM posts WHERE identifier = :identifier)";
+
+// Markers around the matching terms of a highlighted body
+static const QChar MATCH_BEGIN = QChar(1);
+static const QChar MATCH_END = QChar(2);
+
 struct SocialPostImagePrivate
 {
     explicit SocialPostImagePrivate(const QString &url, SocialPostImage::ImageType type);
@@ -96,8 +119,7 @@ SocialPost::SocialPost(const QString &identifier, const QString &name, const QSt
                        const QDateTime &timestamp,
                        const QMap<int, SocialPostImage::ConstPtr> &images, const QVariantMap &extra,
                        const QList<int> &accounts)
-    : d_ptr(new SocialPostPrivate(identifier, body, name, timestamp ,extra,
-                                   accounts))
+    : d_ptr(new SocialPostPrivate(identifier, name, body, timestamp, extra, accounts))
 {
     setImages(images);
 }
@@ -198,34 +220,8 @@ void SocialPost::setAccounts(const QList<int> &accounts)
     d->accounts = accounts;
 }
 
-class AbstractSocialPostCacheDatabasePrivate: public AbstractSocialCacheDatabasePrivate
-{
-public:
-    AbstractSocialPostCacheDatabasePrivate(AbstractSocialPostCacheDatabase *q);
-private:
-    static void createPostsEntries(const QMap<QString, SocialPost::ConstPtr> &posts,
-                                    QStringList &postKeys,
-                                    QStringList &imageKeys, QStringList &extraKeys,
-                                    QMap<QString, QVariantList> &postEntries,
-                                    QMap<QString, QVariantList> &imageEntries,
-                                    QMap<QString, QVariantList> &extraEntries);
-    static void createAccountsEntries(const QMultiMap<QString, int> &accounts,
-                                      QStringList &keys,
-                                      QMap<QString, QVariantList> &entries);
-    QMap<QString, SocialPost::ConstPtr> queuedPosts;
-    QMultiMap<QString, int> queuedPostsAccounts;
-    QList<int> queuedRemovePostsForAccount;
-
-    QSqlQuery postQuery;
-    QSqlQuery imageQuery;
-    QSqlQuery extraQuery;
-    QSqlQuery accountQuery;
-
-    Q_DECLARE_PUBLIC(AbstractSocialPostCacheDatabase)
-};
-
 AbstractSocialPostCacheDatabasePrivate::AbstractSocialPostCacheDatabasePrivate(AbstractSocialPostCacheDatabase *q)
-    : AbstractSocialCacheDatabasePrivate(q)
+    : AbstractSocialCacheDatabasePrivate(q), searchIndex(false)
 {
 }
 
@@ -302,88 +298,362 @@ void AbstractSocialPostCacheDatabasePrivate::createAccountsEntries(const QMultiM
     }
 }
 
-AbstractSocialPostCacheDatabase::AbstractSocialPostCacheDatabase()
-    : AbstractSocialCacheDatabase(*(new AbstractSocialPostCacheDatabasePrivate(this)))
+// Words of a search text. Every word should match.
+QStringList AbstractSocialPostCacheDatabasePrivate::searchTokens(const QString &text)
 {
+    return text.split(QRegExp(QLatin1String("\\s+")), QString::SkipEmptyParts);
 }
 
-QList<SocialPost::ConstPtr> AbstractSocialPostCacheDatabase::posts() const
+// Ranges of the text between markers in a body highlighted by the search index
+SocialPostMatches AbstractSocialPostCacheDatabasePrivate::highlightMatches(const QString &highlight)
+{
+    SocialPostMatches matches;
+    int position = 0;
+    int begin = -1;
+    foreach (const QChar &c, highlight) {
+        if (c == MATCH_BEGIN) {
+            begin = position;
+        } else if (c == MATCH_END) {
+            if (begin >= 0 && position > begin) {
+                matches.append(qMakePair(begin, position - begin));
+            }
+            begin = -1;
+        } else {
+            ++position;
+        }
+    }
+    return matches;
+}
+
+// Ranges of a text containing the tokens of a search,
+// used when there is no search index
+SocialPostMatches AbstractSocialPostCacheDatabasePrivate::textMatches(const QString &text,
+                                                                      const QStringList &tokens)
+{
+    QMap<int, int> ranges;
+    foreach (const QString &token, tokens) {
+        int position = text.indexOf(token, 0, Qt::CaseInsensitive);
+        while (position >= 0) {
+            ranges.insert(position, qMax(ranges.value(position), token.length()));
+            position = text.indexOf(token, position + token.length(), Qt::CaseInsensitive);
+        }
+    }
+
+    SocialPostMatches matches;
+    for (QMap<int, int>::const_iterator i = ranges.constBegin(); i != ranges.constEnd(); ++i) {
+        matches.append(qMakePair(i.key(), i.value()));
+    }
+    return matches;
+}
+
+// Read the posts selected by a query, with their images, extra and accounts.
+// If matches is set, the ranges of the bodies matching the search are read
+// from the highlighted body selected after the other columns, or are
+// computed from the tokens of the search when there is no search index.
+QList<SocialPost::ConstPtr> AbstractSocialPostCacheDatabasePrivate::readPosts(QSqlQuery &query,
+                                                                            QList<SocialPostMatches> *matches,
+                                                                            const QStringList &tokens)
 {
     // This might be slow
-    AbstractSocialPostCacheDatabasePrivate * const d = const_cast<AbstractSocialPostCacheDatabasePrivate *>(d_func());
 
-    if (!d->postQuery.exec()) {
-        qWarning() << Q_FUNC_INFO << "Error reading from posts table:" << d->postQuery.lastError();
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Error reading from posts table:" << query.lastError();
         return QList<SocialPost::ConstPtr>();
     }
 
     QList<SocialPost::ConstPtr> posts;
-    while (d->postQuery.next()) {
-        QString identifier = d->postQuery.value(0).toString();
+    while (query.next()) {
+        QString identifier = query.value(0).toString();
 
-        QString name = d->postQuery.value(1).toString();
-        QString body = d->postQuery.value(2).toString();
-        int timestamp = d->postQuery.value(3).toInt();
+        QString name = query.value(1).toString();
+        QString body = query.value(2).toString();
+        int timestamp = query.value(3).toInt();
         SocialPost::Ptr post = SocialPost::create(identifier, name, body,
                                                   QDateTime::fromTime_t(timestamp));
 
-        d->imageQuery.bindValue(":postId", identifier);
+        imageQuery.bindValue(":postId", identifier);
 
         QMap<int, SocialPostImage::ConstPtr> images;
-        if (d->imageQuery.exec()) {
-            while (d->imageQuery.next()) {
+        if (imageQuery.exec()) {
+            while (imageQuery.next()) {
                 SocialPostImage::ImageType type = SocialPostImage::Invalid;
-                QString typeString = d->imageQuery.value(2).toString();
+                QString typeString = imageQuery.value(2).toString();
                 if (typeString == QLatin1String(PHOTO)) {
                     type = SocialPostImage::Photo;
                 } else if (typeString == QLatin1String(VIDEO)) {
                     type = SocialPostImage::Video;
                 }
 
-                int position = d->imageQuery.value(0).toInt();
-                SocialPostImage::Ptr image  = SocialPostImage::create(d->imageQuery.value(1).toString(),
+                int position = imageQuery.value(0).toInt();
+                SocialPostImage::Ptr image  = SocialPostImage::create(imageQuery.value(1).toString(),
                                                                       type);
                 images.insert(position, image);
             }
             post->setImages(images);
         } else {
             qWarning() << Q_FUNC_INFO << "Error reading from images table:"
-                       << d->imageQuery.lastError();
+                       << imageQuery.lastError();
         }
 
-        d->extraQuery.bindValue(":postId", identifier);
+        extraQuery.bindValue(":postId", identifier);
 
         QVariantMap extra;
-        if (d->extraQuery.exec()) {
-            while (d->extraQuery.next()) {
-                QString key = d->extraQuery.value(0).toString();
-                QVariant value = d->extraQuery.value(1);
+        if (extraQuery.exec()) {
+            while (extraQuery.next()) {
+                QString key = extraQuery.value(0).toString();
+                QVariant value = extraQuery.value(1);
                 extra.insert(key, value);
             }
         } else {
             qWarning() << Q_FUNC_INFO << "Error reading from extra table:"
-                       << d->extraQuery.lastError();
+                       << extraQuery.lastError();
         }
 
         post->setExtra(extra);
 
-        d->accountQuery.bindValue(":postId", identifier);
+        accountQuery.bindValue(":postId", identifier);
 
         QList<int> accounts;
-        if (d->accountQuery.exec()) {
-            while (d->accountQuery.next()) {
-                accounts.append(d->accountQuery.value(0).toInt());
+        if (accountQuery.exec()) {
+            while (accountQuery.next()) {
+                accounts.append(accountQuery.value(0).toInt());
             }
         }
 
         post->setAccounts(accounts);
 
+        if (matches) {
+            matches->append(searchIndex ? highlightMatches(query.value(4).toString())
+                                        : textMatches(body, tokens));
+        }
+
         posts.append(post);
     }
 
     return posts;
 }
 
+// Prepare a query selecting sorted and filtered posts. Posts can be
+// sorted by name and timestamp, and filtered by name, timestamp,
+// accountId and mediaType, that is the type of their images. Posts
+// matching a search are ranked by relevance, unless they are sorted.
+bool AbstractSocialPostCacheDatabasePrivate::prepareQuery(QSqlQuery &query, const QString &columns,
+                                                          qint64 changedSince,
+                                                          const SocialCacheQuery &postQuery)
+{
+    QHash<QString, QString> queryColumns;
+    queryColumns.insert(QLatin1String("name"), QLatin1String("posts.name"));
+    queryColumns.insert(QLatin1String("timestamp"), QLatin1String("posts.timestamp"));
+    queryColumns.insert(QLatin1String("accountId"),
+                        QLatin1String("posts.identifier IN (SELECT postId FROM "\
+                                      "link_post_account WHERE account %1)"));
+    queryColumns.insert(QLatin1String("mediaType"),
+                        QLatin1String("posts.identifier IN (SELECT postId FROM images "\
+                                      "WHERE type %1)"));
+
+    QStringList conditions;
+    QString orderBy;
+    QVariantMap values;
+    queryClauses(postQuery, queryColumns, &conditions, &orderBy, &values);
+    if (changedSince >= 0) {
+        conditions.append(QLatin1String("posts.identifier IN (SELECT identifier FROM changes "\
+                                        "WHERE tableName = 'posts' AND sequence > :since)"));
+    }
+
+    QString tables = QLatin1String("posts");
+    const QStringList tokens = searchTokens(postQuery.search);
+    if (!tokens.isEmpty() && searchIndex) {
+        // Words are quoted, so that they are not read as operators
+        QStringList phrases;
+        foreach (QString token, tokens) {
+            token.replace(QLatin1Char('"'), QLatin1String("\"\""));
+            phrases.append(QLatin1Char('"') + token + QLatin1Char('"'));
+        }
+
+        tables.append(QLatin1String(" INNER JOIN posts_fts ON posts_fts.rowid = posts.rowid"));
+        conditions.append(QLatin1String("posts_fts MATCH :search"));
+        values.insert(QLatin1String(":search"), phrases.join(QLatin1String(" ")));
+        if (orderBy.isEmpty()) {
+            orderBy = QLatin1String("bm25(posts_fts)");
+        }
+    } else {
+        for (int i = 0; i < tokens.count(); ++i) {
+            QString pattern = tokens.at(i);
+            pattern.replace(QLatin1Char('\\'), QLatin1String("\\\\"));
+            pattern.replace(QLatin1Char('%'), QLatin1String("\\%"));
+            pattern.replace(QLatin1Char('_'), QLatin1String("\\_"));
+
+            const QString placeholder = QString(QLatin1String(":search%1")).arg(i);
+            conditions.append(QString(QLatin1String("(posts.name LIKE %1 ESCAPE '\\' "\
+                                                    "OR posts.body LIKE %1 ESCAPE '\\' "\
+                                                    "OR posts.identifier IN (SELECT postId FROM extra "\
+                                                    "WHERE value LIKE %1 ESCAPE '\\'))"))
+                              .arg(placeholder));
+            values.insert(placeholder, QLatin1Char('%') + pattern + QLatin1Char('%'));
+        }
+    }
+
+    QString queryString = QString(QLatin1String("SELECT %1 FROM %2")).arg(columns, tables);
+    if (!conditions.isEmpty()) {
+        queryString.append(QLatin1String(" WHERE "));
+        queryString.append(conditions.join(QLatin1String(" AND ")));
+    }
+    queryString.append(QLatin1String(" ORDER BY "));
+    queryString.append(orderBy.isEmpty() ? QLatin1String("posts.timestamp DESC") : orderBy);
+
+    query = QSqlQuery(db);
+    if (!query.prepare(queryString)) {
+        qWarning() << Q_FUNC_INFO << "Failed to prepare posts query" << query.lastError();
+        return false;
+    }
+
+    if (changedSince >= 0) {
+        query.bindValue(":since", changedSince);
+    }
+    bindQueryValues(query, values);
+    return true;
+}
+
+// The index is created with the tables, and filled with the posts
+// written before, if it was not available when they were written.
+bool AbstractSocialPostCacheDatabasePrivate::createSearchIndex()
+{
+    QSqlQuery query (db);
+    if (query.exec(QLatin1String("SELECT rowid FROM posts_fts LIMIT 1"))) {
+        searchIndex = true;
+        return true;
+    }
+
+    if (!query.exec(QLatin1String("CREATE VIRTUAL TABLE posts_fts USING fts5(name, body, extra)"))) {
+        qWarning() << Q_FUNC_INFO << "Full-text search is not available, posts will be searched "\
+                      "without index" << query.lastError().text();
+        searchIndex = false;
+        return true;
+    }
+
+    if (!query.exec(QLatin1String(SEARCH_INDEX_INSERT))) {
+        qWarning() << Q_FUNC_INFO << "Unable to fill search index" << query.lastError().text();
+        return false;
+    }
+
+    searchIndex = true;
+    return true;
+}
+
+// Run a statement maintaining the index, for each of the given posts
+bool AbstractSocialPostCacheDatabasePrivate::updateSearchIndex(const QString &statement,
+                                                               const QVariantList &identifiers)
+{
+    if (!searchIndex || identifiers.isEmpty()) {
+        return true;
+    }
+
+    QSqlQuery query (db);
+    if (!query.prepare(statement)) {
+        qWarning() << Q_FUNC_INFO << "Failed to prepare search index query" << statement
+                   << query.lastError().text();
+        return false;
+    }
+
+    query.bindValue(QLatin1String(":identifier"), identifiers);
+    if (!query.execBatch()) {
+        qWarning() << Q_FUNC_INFO << "Failed to update search index" << query.lastError().text();
+        return false;
+    }
+    return true;
+}
+
+AbstractSocialPostCacheDatabase::AbstractSocialPostCacheDatabase()
+    : AbstractSocialCacheDatabase(*(new AbstractSocialPostCacheDatabasePrivate(this)))
+{
+}
+
+QList<SocialPost::ConstPtr> AbstractSocialPostCacheDatabase::posts() const
+{
+    AbstractSocialPostCacheDatabasePrivate * const d = const_cast<AbstractSocialPostCacheDatabasePrivate *>(d_func());
+    return d->readPosts(d->postQuery);
+}
+
+// Sorted and filtered posts
+QList<SocialPost::ConstPtr> AbstractSocialPostCacheDatabase::posts(const SocialCacheQuery &query) const
+{
+    AbstractSocialPostCacheDatabasePrivate * const d = const_cast<AbstractSocialPostCacheDatabasePrivate *>(d_func());
+    if (query.isEmpty()) {
+        return d->readPosts(d->postQuery);
+    }
+
+    QSqlQuery postQuery;
+    if (!d->prepareQuery(postQuery, QLatin1String(POST_COLUMNS), -1, query)) {
+        return QList<SocialPost::ConstPtr>();
+    }
+    return d->readPosts(postQuery);
+}
+
+// Posts that changed after a sequence number of the change log
+QList<SocialPost::ConstPtr> AbstractSocialPostCacheDatabase::posts(qint64 changedSince,
+                                                                   const SocialCacheQuery &query) const
+{
+    AbstractSocialPostCacheDatabasePrivate * const d = const_cast<AbstractSocialPostCacheDatabasePrivate *>(d_func());
+    if (query.isEmpty()) {
+        d->changedPostQuery.bindValue(":since", changedSince);
+        return d->readPosts(d->changedPostQuery);
+    }
+
+    QSqlQuery postQuery;
+    if (!d->prepareQuery(postQuery, QLatin1String(POST_COLUMNS), changedSince,
+                         query)) {
+        return QList<SocialPost::ConstPtr>();
+    }
+    return d->readPosts(postQuery);
+}
+
+// Identifiers of the posts, in the order used by posts()
+QStringList AbstractSocialPostCacheDatabase::postIds(bool *ok, const SocialCacheQuery &query) const
+{
+    AbstractSocialPostCacheDatabasePrivate * const d = const_cast<AbstractSocialPostCacheDatabasePrivate *>(d_func());
+    if (ok) {
+        *ok = false;
+    }
+
+    QStringList ids;
+    QSqlQuery idQuery = d->postIdQuery;
+    if (!query.isEmpty() && !d->prepareQuery(idQuery, QLatin1String("posts.identifier"), -1, query)) {
+        return ids;
+    }
+
+    if (!idQuery.exec()) {
+        qWarning() << Q_FUNC_INFO << "Error reading from posts table:" << idQuery.lastError();
+        return ids;
+    }
+
+    while (idQuery.next()) {
+        ids.append(idQuery.value(0).toString());
+    }
+
+    if (ok) {
+        *ok = true;
+    }
+    return ids;
+}
+
+// Posts matching the search of a query, ranked by relevance unless the
+// query sorts them, with the ranges of their bodies matching the search
+QList<SocialPost::ConstPtr> AbstractSocialPostCacheDatabase::search(const SocialCacheQuery &query,
+                                                                    QList<SocialPostMatches> *matches) const
+{
+    AbstractSocialPostCacheDatabasePrivate * const d = const_cast<AbstractSocialPostCacheDatabasePrivate *>(d_func());
+    QString columns = QLatin1String(POST_COLUMNS);
+    if (matches && d->searchIndex) {
+        columns.append(QLatin1String(", highlight(posts_fts, 1, char(1), char(2))"));
+    }
+
+    QSqlQuery postQuery;
+    if (!d->prepareQuery(postQuery, columns, -1, query)) {
+        return QList<SocialPost::ConstPtr>();
+    }
+    return d->readPosts(postQuery, matches, d->searchTokens(query.search));
+}
+
 void AbstractSocialPostCacheDatabase::addPost(const QString &identifier, const QString &name,
                                               const QString &body, const QDateTime &timestamp,
                                               const QString &icon,
@@ -459,7 +729,8 @@ bool AbstractSocialPostCacheDatabase::write()
             deleteOtherTablesEntries.insert(QString::fromLatin1("postId"), postIdsToRemove);
             deletePostsEntries.insert(QString::fromLatin1("identifier"), postIdsToRemove);
             QStringList deletePostsKeys("identifier"), deleteOtherTablesKeys("postId");
-            if (!dbWrite(QLatin1String("link_post_account"), deleteOtherTablesKeys, deleteOtherTablesEntries, Delete)
+            if (!d->updateSearchIndex(QLatin1String(SEARCH_INDEX_DELETE), postIdsToRemove)
+                    || !dbWrite(QLatin1String("link_post_account"), deleteOtherTablesKeys, deleteOtherTablesEntries, Delete)
                     || !dbWrite(QLatin1String("extra"), deleteOtherTablesKeys, deleteOtherTablesEntries, Delete)
                     || !dbWrite(QLatin1String("images"), deleteOtherTablesKeys, deleteOtherTablesEntries, Delete)
                     || !dbWrite(QLatin1String("posts"), deletePostsKeys, deletePostsEntries, Delete)) {
@@ -473,6 +744,13 @@ bool AbstractSocialPostCacheDatabase::write()
     d->createPostsEntries(d->queuedPosts, postKeys, imageKeys, extraKeys, postEntries,
                           imageEntries, extraEntries);
 
+    // Posts that are written again are indexed again
+    const QVariantList postIds = postEntries.value(QLatin1String("identifier"));
+    if (!d->updateSearchIndex(QLatin1String(SEARCH_INDEX_DELETE), postIds)) {
+        dbRollbackTransaction();
+        return false;
+    }
+
     if (!dbWrite(QLatin1String("posts"), postKeys, postEntries, InsertOrReplace)) {
         dbRollbackTransaction();
         return false;
@@ -488,6 +766,12 @@ bool AbstractSocialPostCacheDatabase::write()
         return false;
     }
 
+    if (!d->updateSearchIndex(QString(QLatin1String(SEARCH_INDEX_INSERT))
+                              + QLatin1String(" WHERE identifier = :identifier"), postIds)) {
+        dbRollbackTransaction();
+        return false;
+    }
+
     QStringList keys;
     QMap<QString, QVariantList> entries;
     d->createAccountsEntries(d->queuedPostsAccounts, keys, entries);
@@ -496,6 +780,11 @@ bool AbstractSocialPostCacheDatabase::write()
         return false;
     }
 
+    if (!dbPruneChangeLog()) {
+        dbRollbackTransaction();
+        return false;
+    }
+
     if (!dbCommitTransaction()) {
         dbRollbackTransaction();
         return false;
@@ -564,6 +853,23 @@ bool AbstractSocialPostCacheDatabase::dbCreateTables()
         return false;
     }
 
+    if (!d->createSearchIndex()) {
+        return false;
+    }
+
+    // Changes of a post and of its images, extra
+    // and accounts are logged for incremental refreshes
+    if (!dbCreateChangeLog(QLatin1String("posts"), QLatin1String("identifier"),
+                           QLatin1String("posts"))
+        || !dbCreateChangeLog(QLatin1String("images"), QLatin1String("postId"),
+                              QLatin1String("posts"))
+        || !dbCreateChangeLog(QLatin1String("extra"), QLatin1String("postId"),
+                              QLatin1String("posts"))
+        || !dbCreateChangeLog(QLatin1String("link_post_account"), QLatin1String("postId"),
+                              QLatin1String("posts"))) {
+        return false;
+    }
+
     if (!dbCreatePragmaVersion(POST_DB_VERSION)) {
         return false;
     }
@@ -575,6 +881,21 @@ bool AbstractSocialPostCacheDatabase::dbCreateTables()
         qWarning() << Q_FUNC_INFO << "Failed to prepare posts query" << d->postQuery.lastError();
     }
 
+    d->changedPostQuery = QSqlQuery(d->db);
+    if (!d->changedPostQuery.prepare("SELECT identifier, name, body, timestamp FROM posts "\
+                  "WHERE identifier IN (SELECT identifier FROM changes "\
+                  "WHERE tableName = 'posts' AND sequence > :since) "\
+                  "ORDER BY timestamp DESC")) {
+        qWarning() << Q_FUNC_INFO << "Failed to prepare changed posts query"
+                   << d->changedPostQuery.lastError();
+    }
+
+    d->postIdQuery = QSqlQuery(d->db);
+    if (!d->postIdQuery.prepare("SELECT identifier FROM posts ORDER BY timestamp DESC")) {
+        qWarning() << Q_FUNC_INFO << "Failed to prepare post identifiers query"
+                   << d->postIdQuery.lastError();
+    }
+
     d->imageQuery = QSqlQuery(d->db);
     if (!d->imageQuery.prepare("SELECT position, url, type FROM images WHERE postId = :postId")) {
         qWarning() << Q_FUNC_INFO << "Failed to prepare images query" << d->imageQuery.lastError();
@@ -625,5 +946,19 @@ bool AbstractSocialPostCacheDatabase::dbDropTables()
         return false;
     }
 
+    // The index cannot be dropped if FTS5 is not available, and is then left
+    query.prepare("DROP TABLE IF EXISTS posts_fts");
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Unable to delete posts_fts table"
+                   << query.lastError().text();
+    }
+
+    query.prepare("DROP TABLE IF EXISTS changes");
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Unable to delete changes table"
+                   << query.lastError().text();
+        return false;
+    }
+
     return true;
 }
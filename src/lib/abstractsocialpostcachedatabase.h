@@ -22,6 +22,7 @@
 #include "abstractsocialcachedatabase.h"
 #include <QtCore/QSharedPointer>
 #include <QtCore/QDateTime>
+#include <QtCore/QStringList>
 #include <QtCore/QVariantMap>
 
 class SocialPostImagePrivate;
@@ -94,6 +95,10 @@ private:
                         const QList<int> &accounts = QList<int>());
 };
 
+// Ranges of the body of a post that match a search,
+// as pairs of position and length
+typedef QList<QPair<int, int> > SocialPostMatches;
+
 class AbstractSocialPostCacheDatabasePrivate;
 class AbstractSocialPostCacheDatabase: public AbstractSocialCacheDatabase
 {
@@ -101,6 +106,12 @@ public:
     explicit AbstractSocialPostCacheDatabase();
 
     QList<SocialPost::ConstPtr> posts() const;
+    QList<SocialPost::ConstPtr> posts(const SocialCacheQuery &query) const;
+    QList<SocialPost::ConstPtr> posts(qint64 changedSince,
+                                      const SocialCacheQuery &query = SocialCacheQuery()) const;
+    QStringList postIds(bool *ok = 0, const SocialCacheQuery &query = SocialCacheQuery()) const;
+    QList<SocialPost::ConstPtr> search(const SocialCacheQuery &query,
+                                       QList<SocialPostMatches> *matches = 0) const;
 
     void addPost(const QString &identifier, const QString &name,
                  const QString &body, const QDateTime &timestamp,
@@ -120,6 +131,6 @@ private:
     Q_DECLARE_PRIVATE(AbstractSocialPostCacheDatabase)
 };
 
-static const int POST_DB_VERSION = 1;
+static const int POST_DB_VERSION = 2;
 
 #endif // ABSTRACTSOCIALPOSTCACHEDATABASE_H
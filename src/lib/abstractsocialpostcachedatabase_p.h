@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2013 Lucien Xu <sfietkonstantin@free.fr>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef ABSTRACTSOCIALPOSTCACHEDATABASE_P_H
+#define ABSTRACTSOCIALPOSTCACHEDATABASE_P_H
+
+#include "abstractsocialcachedatabase_p.h"
+#include "abstractsocialpostcachedatabase.h"
+#include <QtCore/QMap>
+#include <QtCore/QMultiMap>
+#include <QtCore/QStringList>
+#include <QtSql/QSqlQuery>
+
+class AbstractSocialPostCacheDatabasePrivate: public AbstractSocialCacheDatabasePrivate
+{
+public:
+    AbstractSocialPostCacheDatabasePrivate(AbstractSocialPostCacheDatabase *q);
+
+    // If posts are searched with the index, rather than with LIKE patterns
+    bool searchIndex;
+
+private:
+    static void createPostsEntries(const QMap<QString, SocialPost::ConstPtr> &posts,
+                                    QStringList &postKeys,
+                                    QStringList &imageKeys, QStringList &extraKeys,
+                                    QMap<QString, QVariantList> &postEntries,
+                                    QMap<QString, QVariantList> &imageEntries,
+                                    QMap<QString, QVariantList> &extraEntries);
+    static void createAccountsEntries(const QMultiMap<QString, int> &accounts,
+                                      QStringList &keys,
+                                      QMap<QString, QVariantList> &entries);
+    static QStringList searchTokens(const QString &text);
+    static SocialPostMatches highlightMatches(const QString &highlight);
+    static SocialPostMatches textMatches(const QString &text, const QStringList &tokens);
+    QMap<QString, SocialPost::ConstPtr> queuedPosts;
+    QMultiMap<QString, int> queuedPostsAccounts;
+    QList<int> queuedRemovePostsForAccount;
+
+    QList<SocialPost::ConstPtr> readPosts(QSqlQuery &query,
+                                          QList<SocialPostMatches> *matches = 0,
+                                          const QStringList &tokens = QStringList());
+    bool prepareQuery(QSqlQuery &query, const QString &columns, qint64 changedSince,
+                      const SocialCacheQuery &postQuery);
+    bool createSearchIndex();
+    bool updateSearchIndex(const QString &statement, const QVariantList &identifiers);
+
+    QSqlQuery postQuery;
+    QSqlQuery changedPostQuery;
+    QSqlQuery postIdQuery;
+    QSqlQuery imageQuery;
+    QSqlQuery extraQuery;
+    QSqlQuery accountQuery;
+
+    Q_DECLARE_PUBLIC(AbstractSocialPostCacheDatabase)
+};
+
+#endif // ABSTRACTSOCIALPOSTCACHEDATABASE_P_H
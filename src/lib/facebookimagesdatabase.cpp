@@ -24,14 +24,28 @@
 #include <QtSql/QSqlQuery>
 #include <QtSql/QSqlError>
 #include <QtCore/QFile>
+#include <QtCore/QSet>
 
 #include <QtDebug>
 
 static const char *DB_NAME = "facebook.db";
-static const int VERSION = 3;
+static const int VERSION = 6;
 
 static const char *THUMBNAIL_FILE_KEY = "thumbnailFile";
 static const char *IMAGE_FILE_KEY = "imageFile";
+static const char *VALIDATOR_FILE_KEY = "file";
+static const char *VALIDATOR_ETAG_KEY = "etag";
+static const char *VALIDATOR_LAST_MODIFIED_KEY = "lastModified";
+static const char *VALIDATOR_SIZE_KEY = "size";
+
+// Names of users, albums and images are searched with the nameTokens
+// table, that stores the words of the names, folded to lower case and
+// without diacritics. A word of a search matches the words that start
+// with it, found with a range of the index of the table, so that names
+// can be searched as they are typed.
+static const char *NAME_TABLES[] = { "users", "albums", "images" };
+static const char *NAME_KEYS[] = { "fbUserId", "fbAlbumId", "fbImageId" };
+static const int NAME_TABLE_COUNT = 3;
 
 struct FacebookUserPrivate
 {
@@ -333,9 +347,21 @@ private:
     static void createUpdatedEntries(const QMap<QString, QMap<QString, QVariant> > &input,
                                      const QString &primary,
                                      QMap<QString, QVariantList> &entries);
-    static void clearCachedImages(QSqlQuery &query);
-
-    QList<FacebookImage::ConstPtr> queryImages(const QString &fbUserId, const QString &fbAlbumId);
+    static void createValidatorsEntries(const QMap<QString, QMap<QString, QVariant> > &validators,
+                                        QStringList &keys,
+                                        QMap<QString, QVariantList> &entries);
+    void clearCachedImages(QSqlQuery &query, QStringList &files);
+    void collectUnreferencedFiles(const QStringList &files, QStringList &unreferencedFiles);
+    static void removeFiles(const QStringList &files);
+    void collectReplacedFiles(QStringList &files);
+    bool indexNames(const QString &table, const QMap<QString, QString> &names);
+
+    QList<FacebookImage::ConstPtr> queryImages(const QString &fbUserId, const QString &fbAlbumId,
+                                               qint64 changedSince,
+                                               const SocialCacheQuery &imageQuery);
+    QStringList queryImageIds(const QString &fbUserId, const QString &fbAlbumId, bool *ok,
+                              const SocialCacheQuery &imageQuery);
+    QList<FacebookImage::ConstPtr> queryImagesById(const QStringList &fbImageIds);
 
     QMap<QString, FacebookUser::ConstPtr> queuedUsers;
     QMap<QString, FacebookAlbum::ConstPtr> queuedAlbums;
@@ -343,6 +369,11 @@ private:
 
     QMap<QString, QMap<QString, QVariant> > queuedUpdatedUsers;
     QMap<QString, QMap<QString, QVariant> > queuedUpdatedImages;
+    QMap<QString, QMap<QString, QVariant> > queuedValidators;
+    QStringList queuedRemovedValidators;
+    QMap<QString, uint> queuedAccessTimes;
+    QMap<QString, int> queuedAtlasSlots;
+    QMap<QString, int> queuedAtlasGenerations;
 };
 
 FacebookImagesDatabasePrivate::FacebookImagesDatabasePrivate(FacebookImagesDatabase *q)
@@ -460,31 +491,327 @@ void FacebookImagesDatabasePrivate::createUpdatedEntries(const QMap<QString, QMa
     }
 }
 
-void FacebookImagesDatabasePrivate::clearCachedImages(QSqlQuery &query)
+void FacebookImagesDatabasePrivate::createValidatorsEntries(const QMap<QString, QMap<QString, QVariant> > &validators,
+                                                            QStringList &keys,
+                                                            QMap<QString, QVariantList> &entries)
+{
+    keys.clear();
+    keys << QLatin1String("url") << QLatin1String(VALIDATOR_FILE_KEY)
+         << QLatin1String(VALIDATOR_ETAG_KEY) << QLatin1String(VALIDATOR_LAST_MODIFIED_KEY)
+         << QLatin1String(VALIDATOR_SIZE_KEY);
+
+    entries.clear();
+
+    for (QMap<QString, QMap<QString, QVariant> >::const_iterator i = validators.begin();
+         i != validators.end(); i++) {
+        const QMap<QString, QVariant> &validator = i.value();
+        entries[QLatin1String("url")].append(i.key());
+        entries[QLatin1String(VALIDATOR_FILE_KEY)].append(validator.value(QLatin1String(VALIDATOR_FILE_KEY)));
+        entries[QLatin1String(VALIDATOR_ETAG_KEY)].append(validator.value(QLatin1String(VALIDATOR_ETAG_KEY)));
+        entries[QLatin1String(VALIDATOR_LAST_MODIFIED_KEY)].append(validator.value(QLatin1String(VALIDATOR_LAST_MODIFIED_KEY)));
+        entries[QLatin1String(VALIDATOR_SIZE_KEY)].append(validator.value(QLatin1String(VALIDATOR_SIZE_KEY)));
+    }
+}
+
+// Collect the cached files selected by query, and remove the
+// validators of the URLs they were downloaded from.
+//
+// Files are not removed here, since they might be shared with
+// other images. collectUnreferencedFiles should be called once
+// the images are removed.
+void FacebookImagesDatabasePrivate::clearCachedImages(QSqlQuery &query, QStringList &files)
 {
+    QVariantList urls;
     while (query.next()) {
         QString thumb = query.value(0).toString();
         QString image = query.value(1).toString();
 
         if (!thumb.isEmpty()) {
-            QFile thumbFile (thumb);
-            if (thumbFile.exists()) {
-                thumbFile.remove();
-            }
+            files.append(thumb);
         }
 
         if (!image.isEmpty()) {
-            QFile imageFile (image);
-            if (imageFile.exists()) {
-                imageFile.remove();
+            files.append(image);
+        }
+
+        urls.append(query.value(2).toString());
+        urls.append(query.value(3).toString());
+    }
+
+    if (urls.isEmpty()) {
+        return;
+    }
+
+    QSqlQuery validatorsQuery (db);
+    if (!validatorsQuery.prepare("DELETE FROM validators WHERE url = ?")) {
+        qWarning() << Q_FUNC_INFO << "Failed to prepare validators cleanup query:"
+                   << validatorsQuery.lastError().text();
+        return;
+    }
+
+    validatorsQuery.addBindValue(urls);
+    if (!validatorsQuery.execBatch()) {
+        qWarning() << Q_FUNC_INFO << "Failed to clean validators:"
+                   << validatorsQuery.lastError().text();
+    }
+}
+
+// Collect the files that are not referenced anymore
+//
+// A file is referenced by the images that use it as thumbnail
+// or as image, and by the validators that describe it. Several
+// references to the same file exist when images are stored
+// in the content-addressed store.
+//
+// References are counted in the transaction that removes them,
+// but the files are only removed with removeFiles once it is
+// committed, so that they are kept if the transaction fails.
+void FacebookImagesDatabasePrivate::collectUnreferencedFiles(const QStringList &files,
+                                                             QStringList &unreferencedFiles)
+{
+    if (files.isEmpty()) {
+        return;
+    }
+
+    QSqlQuery query (db);
+    if (!query.prepare("SELECT (SELECT COUNT(*) FROM images "\
+                       "WHERE thumbnailFile = ? OR imageFile = ?) + "\
+                       "(SELECT COUNT(*) FROM validators WHERE file = ?)")) {
+        qWarning() << Q_FUNC_INFO << "Failed to prepare references query:"
+                   << query.lastError().text();
+        return;
+    }
+
+    QSet<QString> checkedFiles;
+    foreach (const QString &file, files) {
+        if (file.isEmpty() || checkedFiles.contains(file)) {
+            continue;
+        }
+        checkedFiles.insert(file);
+
+        query.addBindValue(file);
+        query.addBindValue(file);
+        query.addBindValue(file);
+        if (!query.exec() || !query.next()) {
+            qWarning() << Q_FUNC_INFO << "Failed to count references to" << file
+                       << query.lastError().text();
+            continue;
+        }
+
+        int references = query.value(0).toInt();
+        query.finish();
+        if (references == 0) {
+            unreferencedFiles.append(file);
+        }
+    }
+}
+
+void FacebookImagesDatabasePrivate::removeFiles(const QStringList &files)
+{
+    foreach (const QString &file, files) {
+        QFile cachedFile (file);
+        if (cachedFile.exists()) {
+            cachedFile.remove();
+        }
+    }
+}
+
+// Collect the files currently used by the images and validators
+// that are going to be replaced or updated by write()
+void FacebookImagesDatabasePrivate::collectReplacedFiles(QStringList &files)
+{
+    QSet<QString> fbImageIds;
+    foreach (const QString &fbImageId, queuedImages.keys()) {
+        fbImageIds.insert(fbImageId);
+    }
+    foreach (const QString &fbImageId, queuedUpdatedImages.keys()) {
+        fbImageIds.insert(fbImageId);
+    }
+
+    QSqlQuery query (db);
+    if (!fbImageIds.isEmpty()) {
+        query.prepare("SELECT thumbnailFile, imageFile FROM images WHERE fbImageId = :fbImageId");
+        foreach (const QString &fbImageId, fbImageIds) {
+            query.bindValue(":fbImageId", fbImageId);
+            if (!query.exec()) {
+                qWarning() << Q_FUNC_INFO << "Failed to query cached images:"
+                           << query.lastError().text();
+                continue;
+            }
+
+            while (query.next()) {
+                files.append(query.value(0).toString());
+                files.append(query.value(1).toString());
+            }
+        }
+    }
+
+    if (!queuedValidators.isEmpty() || !queuedRemovedValidators.isEmpty()) {
+        query.prepare("SELECT file FROM validators WHERE url = :url");
+        foreach (const QString &url, queuedValidators.keys() + queuedRemovedValidators) {
+            query.bindValue(":url", url);
+            if (!query.exec()) {
+                qWarning() << Q_FUNC_INFO << "Failed to query validators:"
+                           << query.lastError().text();
+                continue;
+            }
+
+            while (query.next()) {
+                files.append(query.value(0).toString());
+            }
+        }
+    }
+}
+
+// Words of a name, as they are stored in nameTokens
+static QStringList nameTokens(const QString &name)
+{
+    QStringList tokens;
+    QString token;
+    // Iterate by code point, so that letters outside of the BMP are kept
+    foreach (uint c, name.normalized(QString::NormalizationForm_KD).toLower().toUcs4()) {
+        if (QChar::isLetterOrNumber(c)) {
+            token.append(QString::fromUcs4(&c, 1));
+        } else if (!QChar::isMark(c) && !token.isEmpty()) {
+            tokens.append(token);
+            token.clear();
+        }
+    }
+    if (!token.isEmpty()) {
+        tokens.append(token);
+    }
+
+    tokens.removeDuplicates();
+    return tokens;
+}
+
+// Conditions selecting the rows of a table with a name containing
+// words starting with the words of a search. column is the
+// qualified identifier column of the table.
+static void nameSearchClauses(const QString &table, const QString &column, const QString &search,
+                              QStringList *conditions, QVariantMap *values)
+{
+    const QStringList tokens = nameTokens(search);
+    for (int i = 0; i < tokens.count(); ++i) {
+        const QString from = QString(QLatin1String(":nameFrom%1")).arg(i);
+        const QString to = QString(QLatin1String(":nameTo%1")).arg(i);
+        conditions->append(QString(QLatin1String("%1 IN (SELECT identifier FROM nameTokens "\
+                                                 "WHERE kind = '%2' AND token >= %3 "\
+                                                 "AND token < %4)"))
+                           .arg(column, table, from, to));
+        values->insert(from, tokens.at(i));
+        // Tokens are compared as UTF-8, in code point order, and only
+        // contain characters that are lower than U+10FFFF
+        values->insert(to, QString(tokens.at(i) + QChar(0xdbff) + QChar(0xdfff)));
+    }
+}
+
+// Store the words of the names of the users, albums or images written
+// by write(). The words of removed rows are removed by triggers.
+bool FacebookImagesDatabasePrivate::indexNames(const QString &table,
+                                               const QMap<QString, QString> &names)
+{
+    if (names.isEmpty()) {
+        return true;
+    }
+
+    QSqlQuery deleteQuery (db);
+    QSqlQuery insertQuery (db);
+    if (!deleteQuery.prepare("DELETE FROM nameTokens WHERE kind = :kind AND identifier = :identifier")
+        || !insertQuery.prepare("INSERT INTO nameTokens (kind, identifier, token) "\
+                                "VALUES (:kind, :identifier, :token)")) {
+        qWarning() << Q_FUNC_INFO << "Failed to prepare name queries:"
+                   << deleteQuery.lastError().text() << insertQuery.lastError().text();
+        return false;
+    }
+
+    for (QMap<QString, QString>::const_iterator i = names.constBegin(); i != names.constEnd(); ++i) {
+        deleteQuery.bindValue(":kind", table);
+        deleteQuery.bindValue(":identifier", i.key());
+        if (!deleteQuery.exec()) {
+            qWarning() << Q_FUNC_INFO << "Failed to remove name of" << i.key()
+                       << deleteQuery.lastError().text();
+            return false;
+        }
+
+        foreach (const QString &token, nameTokens(i.value())) {
+            insertQuery.bindValue(":kind", table);
+            insertQuery.bindValue(":identifier", i.key());
+            insertQuery.bindValue(":token", token);
+            if (!insertQuery.exec()) {
+                qWarning() << Q_FUNC_INFO << "Failed to write name of" << i.key()
+                           << insertQuery.lastError().text();
+                return false;
             }
         }
     }
 
+    return true;
+}
+
+// Fields of images that can be used to sort and filter them
+static QHash<QString, QString> imageQueryColumns()
+{
+    QHash<QString, QString> columns;
+    columns.insert(QLatin1String("accountId"), QLatin1String("accounts.accountId"));
+    columns.insert(QLatin1String("userId"), QLatin1String("images.fbUserId"));
+    columns.insert(QLatin1String("albumId"), QLatin1String("images.fbAlbumId"));
+    columns.insert(QLatin1String("createdTime"), QLatin1String("images.createdTime"));
+    columns.insert(QLatin1String("updatedTime"), QLatin1String("images.updatedTime"));
+    columns.insert(QLatin1String("name"), QLatin1String("images.imageName"));
+    columns.insert(QLatin1String("width"), QLatin1String("images.width"));
+    columns.insert(QLatin1String("height"), QLatin1String("images.height"));
+    return columns;
+}
+
+// Query string selecting images of an user or of an album, ordered like
+// the models display them. If changedSince is not negative, only the images
+// that changed after this sequence number of the change log are selected.
+// The values of the sort and filters are added to values.
+static QString imagesQueryString(const QString &columns, const QString &fbUserId,
+                                 const QString &fbAlbumId, qint64 changedSince,
+                                 const SocialCacheQuery &query, QVariantMap *values)
+{
+    QStringList conditions;
+    QString orderBy;
+    AbstractSocialCacheDatabasePrivate::queryClauses(query, imageQueryColumns(),
+                                                     &conditions, &orderBy, values);
+    nameSearchClauses(QLatin1String("images"), QLatin1String("images.fbImageId"), query.search,
+                      &conditions, values);
+    if (!fbUserId.isEmpty()) {
+        conditions.append(QLatin1String("images.fbUserId = :fbUserId"));
+    } else if (!fbAlbumId.isEmpty()) {
+        conditions.append(QLatin1String("images.fbAlbumId = :fbAlbumId"));
+    }
+    if (changedSince >= 0) {
+        conditions.append(QLatin1String("images.fbImageId IN (SELECT identifier FROM changes "\
+                                        "WHERE tableName = 'images' AND sequence > :since)"));
+    }
+
+    QString queryString = QString(QLatin1String("SELECT %1 FROM images "\
+                                                "INNER JOIN accounts "\
+                                                "ON accounts.fbUserId = images.fbUserId")).arg(columns);
+    if (!conditions.isEmpty()) {
+        queryString.append(QLatin1String(" WHERE "));
+        queryString.append(conditions.join(QLatin1String(" AND ")));
+    }
+
+    // Images of an album are sorted in ascending order
+    if (!orderBy.isEmpty()) {
+        queryString.append(QLatin1String(" ORDER BY "));
+        queryString.append(orderBy);
+    } else if (fbAlbumId.isEmpty()) {
+        queryString.append(QLatin1String(" ORDER BY images.updatedTime DESC"));
+    } else {
+        queryString.append(QLatin1String(" ORDER BY images.updatedTime"));
+    }
+    return queryString;
 }
 
 QList<FacebookImage::ConstPtr> FacebookImagesDatabasePrivate::queryImages(const QString &fbUserId,
-                                                                          const QString &fbAlbumId)
+                                                                          const QString &fbAlbumId,
+                                                                          qint64 changedSince,
+                                                                          const SocialCacheQuery &imageQuery)
 {
     QList<FacebookImage::ConstPtr> data;
 
@@ -493,26 +820,15 @@ QList<FacebookImage::ConstPtr> FacebookImagesDatabasePrivate::queryImages(const
         return data;
     }
 
-    QString queryString = QLatin1String("SELECT images.fbImageId, images.fbAlbumId, "\
-                                        "images.fbUserId, images.createdTime, "\
-                                        "images.updatedTime, images.imageName, images.width, "\
-                                        "images.height, images.thumbnailUrl, images.imageUrl, "\
-                                        "images.thumbnailFile, images.imageFile, "\
-                                        "accounts.accountId "\
-                                        "FROM images "\
-                                        "INNER JOIN accounts "\
-                                        "ON accounts.fbUserId = images.fbUserId%1 "\
-                                        "ORDER BY images.updatedTime %2");
-
-    if (!fbUserId.isEmpty()) {
-        queryString = queryString.arg(QLatin1String(" WHERE images.fbUserId = :fbUserId"),
-                                      QLatin1String("DESC"));
-    } else if (!fbAlbumId.isEmpty()){
-        queryString = queryString.arg(QLatin1String(" WHERE images.fbAlbumId = :fbAlbumId"),
-                                      QString());
-    } else {
-        queryString = queryString.arg(QString(), QLatin1String("DESC"));
-    }
+    QVariantMap values;
+    QString queryString = imagesQueryString(QLatin1String("images.fbImageId, images.fbAlbumId, "\
+                                                          "images.fbUserId, images.createdTime, "\
+                                                          "images.updatedTime, images.imageName, "\
+                                                          "images.width, images.height, "\
+                                                          "images.thumbnailUrl, images.imageUrl, "\
+                                                          "images.thumbnailFile, images.imageFile, "\
+                                                          "accounts.accountId"),
+                                            fbUserId, fbAlbumId, changedSince, imageQuery, &values);
 
     if (!mutex->lock()) {
         qWarning() << Q_FUNC_INFO << "unable to acquire lock";
@@ -527,6 +843,10 @@ QList<FacebookImage::ConstPtr> FacebookImagesDatabasePrivate::queryImages(const
     if (!fbAlbumId.isEmpty()) {
         query.bindValue(":fbAlbumId", fbAlbumId);
     }
+    if (changedSince >= 0) {
+        query.bindValue(":since", changedSince);
+    }
+    bindQueryValues(query, values);
 
     if (!query.exec()) {
         qWarning() << Q_FUNC_INFO << "Failed to query all albums:" << query.lastError().text();
@@ -550,6 +870,103 @@ QList<FacebookImage::ConstPtr> FacebookImagesDatabasePrivate::queryImages(const
     return data;
 }
 
+QStringList FacebookImagesDatabasePrivate::queryImageIds(const QString &fbUserId,
+                                                        const QString &fbAlbumId, bool *ok,
+                                                        const SocialCacheQuery &imageQuery)
+{
+    QStringList ids;
+    if (ok) {
+        *ok = false;
+    }
+
+    if (!mutex->lock()) {
+        qWarning() << Q_FUNC_INFO << "unable to acquire lock";
+        return ids;
+    }
+
+    QVariantMap values;
+    QSqlQuery query (db);
+    query.prepare(imagesQueryString(QLatin1String("images.fbImageId"), fbUserId, fbAlbumId, -1,
+                                    imageQuery, &values));
+    if (!fbUserId.isEmpty()) {
+        query.bindValue(":fbUserId", fbUserId);
+    } else if (!fbAlbumId.isEmpty()) {
+        query.bindValue(":fbAlbumId", fbAlbumId);
+    }
+    bindQueryValues(query, values);
+
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Failed to query image identifiers:" << query.lastError().text();
+        mutex->unlock();
+        return ids;
+    }
+
+    while (query.next()) {
+        ids.append(query.value(0).toString());
+    }
+
+    mutex->unlock();
+    if (ok) {
+        *ok = true;
+    }
+    return ids;
+}
+
+QList<FacebookImage::ConstPtr> FacebookImagesDatabasePrivate::queryImagesById(
+        const QStringList &fbImageIds)
+{
+    QList<FacebookImage::ConstPtr> data;
+    if (fbImageIds.isEmpty()) {
+        return data;
+    }
+
+    QString queryString = QLatin1String("SELECT images.fbImageId, images.fbAlbumId, "\
+                                        "images.fbUserId, images.createdTime, "\
+                                        "images.updatedTime, images.imageName, "\
+                                        "images.width, images.height, "\
+                                        "images.thumbnailUrl, images.imageUrl, "\
+                                        "images.thumbnailFile, images.imageFile, "\
+                                        "accounts.accountId FROM images "\
+                                        "INNER JOIN accounts "\
+                                        "ON accounts.fbUserId = images.fbUserId "\
+                                        "WHERE images.fbImageId IN (");
+    queryString.append(QString(QLatin1String("?, ")).repeated(fbImageIds.count()));
+    queryString.chop(2);
+    queryString.append(QLatin1String(")"));
+
+    if (!mutex->lock()) {
+        qWarning() << Q_FUNC_INFO << "unable to acquire lock";
+        return data;
+    }
+
+    QSqlQuery query (db);
+    query.prepare(queryString);
+    foreach (const QString &fbImageId, fbImageIds) {
+        query.addBindValue(fbImageId);
+    }
+
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Failed to query images:" << query.lastError().text();
+        mutex->unlock();
+        return data;
+    }
+
+    while (query.next()) {
+        data.append(FacebookImage::create(query.value(0).toString(), query.value(1).toString(),
+                                          query.value(2).toString(),
+                                          QDateTime::fromTime_t(query.value(3).toUInt()),
+                                          QDateTime::fromTime_t(query.value(4).toUInt()),
+                                          query.value(5).toString(),
+                                          query.value(6).toInt(), query.value(7).toInt(),
+                                          query.value(8).toString(), query.value(9).toString(),
+                                          query.value(10).toString(), query.value(11).toString(),
+                                          query.value(12).toInt()));
+    }
+
+    mutex->unlock();
+    return data;
+}
+
 bool operator==(const FacebookUser::ConstPtr &user1, const FacebookUser::ConstPtr &user2)
 {
     return user1->fbUserId() == user2->fbUserId();
@@ -619,6 +1036,7 @@ bool FacebookImagesDatabase::syncAccount(int accountId, const QString &fbUserId)
 void FacebookImagesDatabase::purgeAccount(int accountId)
 {
     Q_D(FacebookImagesDatabase);
+    QStringList cachedFiles;
     // We will kill all data linked to an an account id.
     // If it kills data that should not be killed, another
     // sync will bring them back.
@@ -665,7 +1083,7 @@ void FacebookImagesDatabase::purgeAccount(int accountId)
 
     // Clean images
     foreach (const QVariant &userId, userIds) {
-        if (!query.prepare("SELECT thumbnailFile, imageFile FROM images WHERE fbUserId = :fbUserId")) {
+        if (!query.prepare("SELECT thumbnailFile, imageFile, thumbnailUrl, imageUrl FROM images WHERE fbUserId = :fbUserId")) {
             qWarning() << Q_FUNC_INFO << "Failed to prepare cached images selection query:"
                        << query.lastError().text();
         } else {
@@ -674,7 +1092,7 @@ void FacebookImagesDatabase::purgeAccount(int accountId)
                 qWarning() << Q_FUNC_INFO << "Failed to exec cached images selection query:"
                            << query.lastError().text();
             } else {
-                d->clearCachedImages(query);
+                d->clearCachedImages(query, cachedFiles);
             }
         }
     }
@@ -688,11 +1106,16 @@ void FacebookImagesDatabase::purgeAccount(int accountId)
         }
     }
 
+    QStringList unreferencedFiles;
+    d->collectUnreferencedFiles(cachedFiles, unreferencedFiles);
+
     if (!dbCommitTransaction()) {
         qWarning() << Q_FUNC_INFO << "Failed to commit transaction";
         dbRollbackTransaction();
         return;
     }
+
+    d->removeFiles(unreferencedFiles);
 }
 
 // Returns the user but do not return a count
@@ -732,6 +1155,7 @@ void FacebookImagesDatabase::addUser(const QString &fbUserId, const QDateTime &u
 void FacebookImagesDatabase::removeUser(const QString &fbUserId)
 {
     Q_D(FacebookImagesDatabase);
+    QStringList cachedFiles;
     if (!dbBeginTransaction()) {
         return;
     }
@@ -765,7 +1189,7 @@ void FacebookImagesDatabase::removeUser(const QString &fbUserId)
     }
 
     // Clean images
-    if (!query.prepare("SELECT thumbnailFile, imageFile FROM images WHERE fbUserId = :fbUserId")) {
+    if (!query.prepare("SELECT thumbnailFile, imageFile, thumbnailUrl, imageUrl FROM images WHERE fbUserId = :fbUserId")) {
         qWarning() << Q_FUNC_INFO << "Failed to prepare cached images selection query:"
                    << query.lastError().text();
     } else {
@@ -774,7 +1198,7 @@ void FacebookImagesDatabase::removeUser(const QString &fbUserId)
             qWarning() << Q_FUNC_INFO << "Failed to exec cached images selection query:"
                        << query.lastError().text();
         } else {
-            d->clearCachedImages(query);
+            d->clearCachedImages(query, cachedFiles);
         }
     }
 
@@ -787,25 +1211,43 @@ void FacebookImagesDatabase::removeUser(const QString &fbUserId)
         return;
     }
 
+    QStringList unreferencedFiles;
+    d->collectUnreferencedFiles(cachedFiles, unreferencedFiles);
+
     if (!dbCommitTransaction()) {
         qWarning() << Q_FUNC_INFO << "Failed to commit transaction";
         dbRollbackTransaction();
         return;
     }
+
+    d->removeFiles(unreferencedFiles);
 }
 
-QList<FacebookUser::ConstPtr> FacebookImagesDatabase::users() const
+// Users, or the users with a name matching a search
+QList<FacebookUser::ConstPtr> FacebookImagesDatabase::users(const QString &search) const
 {
     Q_D(const FacebookImagesDatabase);
     QList<FacebookUser::ConstPtr> data;
 
+    QStringList conditions;
+    QVariantMap values;
+    nameSearchClauses(QLatin1String("users"), QLatin1String("users.fbUserId"), search,
+                      &conditions, &values);
+
+    QString queryString = QLatin1String("SELECT users.fbUserId, users.updatedTime, users.userName, "\
+                                        "COUNT(fbImageId) as count "\
+                                        "FROM users "\
+                                        "LEFT JOIN images ON images.fbUserId = users.fbUserId ");
+    if (!conditions.isEmpty()) {
+        queryString.append(QLatin1String("WHERE "));
+        queryString.append(conditions.join(QLatin1String(" AND ")));
+        queryString.append(QLatin1Char(' '));
+    }
+    queryString.append(QLatin1String("GROUP BY users.fbUserId ORDER BY users.fbUserId"));
+
     QSqlQuery query (d->db);
-    query.prepare("SELECT users.fbUserId, users.updatedTime, users.userName, "\
-                  "COUNT(fbImageId) as count "\
-                  "FROM users "\
-                  "LEFT JOIN images ON images.fbUserId = users.fbUserId "\
-                  "GROUP BY users.fbUserId "\
-                  "ORDER BY users.fbUserId");
+    query.prepare(queryString);
+    AbstractSocialCacheDatabasePrivate::bindQueryValues(query, values);
     if (!query.exec()) {
         qWarning() << Q_FUNC_INFO << "Failed to query all users:" << query.lastError().text();
         return data;
@@ -885,6 +1327,7 @@ void FacebookImagesDatabase::addAlbum(const QString &fbAlbumId, const QString &f
 void FacebookImagesDatabase::removeAlbum(const QString &fbAlbumId)
 {
     Q_D(FacebookImagesDatabase);
+    QStringList cachedFiles;
     if (!dbBeginTransaction()) {
         return;
     }
@@ -900,7 +1343,7 @@ void FacebookImagesDatabase::removeAlbum(const QString &fbAlbumId)
     }
 
     // Clean images
-    if (!query.prepare("SELECT thumbnailFile, imageFile FROM images WHERE fbAlbumId = :fbAlbumId")) {
+    if (!query.prepare("SELECT thumbnailFile, imageFile, thumbnailUrl, imageUrl FROM images WHERE fbAlbumId = :fbAlbumId")) {
         qWarning() << Q_FUNC_INFO << "Failed to prepare cached images selection query:"
                    << query.lastError().text();
     } else {
@@ -909,7 +1352,7 @@ void FacebookImagesDatabase::removeAlbum(const QString &fbAlbumId)
             qWarning() << Q_FUNC_INFO << "Failed to exec cached images selection query:"
                        << query.lastError().text();
         } else {
-            d->clearCachedImages(query);
+            d->clearCachedImages(query, cachedFiles);
         }
     }
 
@@ -921,16 +1364,22 @@ void FacebookImagesDatabase::removeAlbum(const QString &fbAlbumId)
         return;
     }
 
+    QStringList unreferencedFiles;
+    d->collectUnreferencedFiles(cachedFiles, unreferencedFiles);
+
     if (!dbCommitTransaction()) {
         qWarning() << Q_FUNC_INFO << "Failed to commit transaction";
         dbRollbackTransaction();
         return;
     }
+
+    d->removeFiles(unreferencedFiles);
 }
 
 void FacebookImagesDatabase::removeAlbums(const QStringList &fbAlbumIds)
 {
     Q_D(FacebookImagesDatabase);
+    QStringList cachedFiles;
     if (!dbBeginTransaction()) {
         return;
     }
@@ -953,7 +1402,7 @@ void FacebookImagesDatabase::removeAlbums(const QStringList &fbAlbumIds)
 
     // Clean images
     foreach (const QString &fbAlbumId, fbAlbumIds) {
-        if (!query.prepare("SELECT thumbnailFile, imageFile FROM images WHERE fbAlbumId = :fbAlbumId")) {
+        if (!query.prepare("SELECT thumbnailFile, imageFile, thumbnailUrl, imageUrl FROM images WHERE fbAlbumId = :fbAlbumId")) {
             qWarning() << Q_FUNC_INFO << "Failed to prepare cached images selection query:"
                        << query.lastError().text();
         } else {
@@ -962,7 +1411,7 @@ void FacebookImagesDatabase::removeAlbums(const QStringList &fbAlbumIds)
                 qWarning() << Q_FUNC_INFO << "Failed to exec cached images selection query:"
                            << query.lastError().text();
             } else {
-                d->clearCachedImages(query);
+                d->clearCachedImages(query, cachedFiles);
             }
         }
     }
@@ -973,23 +1422,39 @@ void FacebookImagesDatabase::removeAlbums(const QStringList &fbAlbumIds)
         return;
     }
 
+    QStringList unreferencedFiles;
+    d->collectUnreferencedFiles(cachedFiles, unreferencedFiles);
+
     if (!dbCommitTransaction()) {
         qWarning() << Q_FUNC_INFO << "Failed to commit transaction";
         dbRollbackTransaction();
         return;
     }
+
+    d->removeFiles(unreferencedFiles);
 }
 
-QList<FacebookAlbum::ConstPtr> FacebookImagesDatabase::albums(const QString &fbUserId)
+// Albums of an user, or of all users, with a name matching a search if it is not empty
+QList<FacebookAlbum::ConstPtr> FacebookImagesDatabase::albums(const QString &fbUserId,
+                                                              const QString &search)
 {
     Q_D(const FacebookImagesDatabase);
     QList<FacebookAlbum::ConstPtr> data;
 
+    QStringList conditions;
+    QVariantMap values;
+    if (!fbUserId.isEmpty()) {
+        conditions.append(QLatin1String("albums.fbUserId = :fbUserId"));
+    }
+    nameSearchClauses(QLatin1String("albums"), QLatin1String("albums.fbAlbumId"), search,
+                      &conditions, &values);
+
     QString queryString = QLatin1String("SELECT fbAlbumId, fbUserId, createdTime, updatedTime, "\
                                         "albumName, imageCount "\
                                         "FROM albums%1 ORDER BY updatedTime DESC");
-    if (!fbUserId.isEmpty()) {
-        queryString = queryString.arg(QLatin1String(" WHERE fbUserId = :fbUserId"));
+    if (!conditions.isEmpty()) {
+        queryString = queryString.arg(QLatin1String(" WHERE ")
+                                      + conditions.join(QLatin1String(" AND ")));
     } else {
         queryString = queryString.arg(QString());
     }
@@ -999,6 +1464,7 @@ QList<FacebookAlbum::ConstPtr> FacebookImagesDatabase::albums(const QString &fbU
     if (!fbUserId.isEmpty()) {
         query.bindValue(":fbUserId", fbUserId);
     }
+    AbstractSocialCacheDatabasePrivate::bindQueryValues(query, values);
 
     if (!query.exec()) {
         qWarning() << Q_FUNC_INFO << "Failed to query all albums:" << query.lastError().text();
@@ -1097,15 +1563,26 @@ FacebookImage::ConstPtr FacebookImagesDatabase::image(const QString &fbImageId)
                                  query.value(10).toString(), query.value(11).toString());
 }
 
+// Images with the given identifiers
+//
+// Images are returned in no particular order, and the
+// images that do not exist are not returned.
+QList<FacebookImage::ConstPtr> FacebookImagesDatabase::images(const QStringList &fbImageIds)
+{
+    Q_D(FacebookImagesDatabase);
+    return d->queryImagesById(fbImageIds);
+}
+
 void FacebookImagesDatabase::removeImage(const QString &fbImageId)
 {
     Q_D(FacebookImagesDatabase);
+    QStringList cachedFiles;
     if (!dbBeginTransaction()) {
         return;
     }
     // Clean images
     QSqlQuery query (d->db);
-    if (!query.prepare("SELECT thumbnailFile, imageFile FROM images WHERE fbImageId = :fbImageId")) {
+    if (!query.prepare("SELECT thumbnailFile, imageFile, thumbnailUrl, imageUrl FROM images WHERE fbImageId = :fbImageId")) {
         qWarning() << Q_FUNC_INFO << "Failed to prepare cached images selection query:"
                    << query.lastError().text();
     } else {
@@ -1114,7 +1591,7 @@ void FacebookImagesDatabase::removeImage(const QString &fbImageId)
             qWarning() << Q_FUNC_INFO << "Failed to exec cached images selection query:"
                        << query.lastError().text();
         } else {
-            d->clearCachedImages(query);
+            d->clearCachedImages(query, cachedFiles);
         }
     }
 
@@ -1126,16 +1603,22 @@ void FacebookImagesDatabase::removeImage(const QString &fbImageId)
         return;
     }
 
+    QStringList unreferencedFiles;
+    d->collectUnreferencedFiles(cachedFiles, unreferencedFiles);
+
     if (!dbCommitTransaction()) {
         qWarning() << Q_FUNC_INFO << "Failed to commit transaction";
         dbRollbackTransaction();
         return;
     }
+
+    d->removeFiles(unreferencedFiles);
 }
 
 void FacebookImagesDatabase::removeImages(const QStringList &fbImageIds)
 {
     Q_D(FacebookImagesDatabase);
+    QStringList cachedFiles;
     if (!dbBeginTransaction()) {
         return;
     }
@@ -1143,7 +1626,7 @@ void FacebookImagesDatabase::removeImages(const QStringList &fbImageIds)
     // Clean images
     QSqlQuery query (d->db);
     foreach (const QString &fbImageId, fbImageIds) {
-        if (!query.prepare("SELECT thumbnailFile, imageFile FROM images WHERE fbImageId = :fbImageId")) {
+        if (!query.prepare("SELECT thumbnailFile, imageFile, thumbnailUrl, imageUrl FROM images WHERE fbImageId = :fbImageId")) {
             qWarning() << Q_FUNC_INFO << "Failed to prepare cached images selection query:"
                        << query.lastError().text();
         } else {
@@ -1152,7 +1635,7 @@ void FacebookImagesDatabase::removeImages(const QStringList &fbImageIds)
                 qWarning() << Q_FUNC_INFO << "Failed to exec cached images selection query:"
                            << query.lastError().text();
             } else {
-                d->clearCachedImages(query);
+                d->clearCachedImages(query, cachedFiles);
             }
         }
     }
@@ -1171,23 +1654,54 @@ void FacebookImagesDatabase::removeImages(const QStringList &fbImageIds)
         return;
     }
 
+    QStringList unreferencedFiles;
+    d->collectUnreferencedFiles(cachedFiles, unreferencedFiles);
+
     if (!dbCommitTransaction()) {
         qWarning() << Q_FUNC_INFO << "Failed to commit transaction";
         dbRollbackTransaction();
         return;
     }
+
+    d->removeFiles(unreferencedFiles);
+}
+
+// Images of an user, or of all users
+//
+// If changedSince is not negative, only the images that
+// changed after this sequence number are returned. Images
+// can be sorted and filtered by accountId, userId, albumId,
+// createdTime, updatedTime, name, width and height.
+QList<FacebookImage::ConstPtr> FacebookImagesDatabase::userImages(const QString &fbUserId,
+                                                                  qint64 changedSince,
+                                                                  const SocialCacheQuery &query)
+{
+    Q_D(FacebookImagesDatabase);
+    return d->queryImages(fbUserId, QString(), changedSince, query);
+}
+
+QList<FacebookImage::ConstPtr> FacebookImagesDatabase::albumImages(const QString &fbAlbumId,
+                                                                   qint64 changedSince,
+                                                                   const SocialCacheQuery &query)
+{
+    Q_D(FacebookImagesDatabase);
+    return d->queryImages(QString(), fbAlbumId, changedSince, query);
 }
 
-QList<FacebookImage::ConstPtr> FacebookImagesDatabase::userImages(const QString &fbUserId)
+// Identifiers of the images returned by userImages, in the same order
+QStringList FacebookImagesDatabase::userImageIds(const QString &fbUserId, bool *ok,
+                                                 const SocialCacheQuery &query)
 {
     Q_D(FacebookImagesDatabase);
-    return d->queryImages(fbUserId, QString());
+    return d->queryImageIds(fbUserId, QString(), ok, query);
 }
 
-QList<FacebookImage::ConstPtr> FacebookImagesDatabase::albumImages(const QString &fbAlbumId)
+// Identifiers of the images returned by albumImages, in the same order
+QStringList FacebookImagesDatabase::albumImageIds(const QString &fbAlbumId, bool *ok,
+                                                  const SocialCacheQuery &query)
 {
     Q_D(FacebookImagesDatabase);
-    return d->queryImages(QString(), fbAlbumId);
+    return d->queryImageIds(QString(), fbAlbumId, ok, query);
 }
 
 
@@ -1212,8 +1726,13 @@ void FacebookImagesDatabase::updateImageThumbnail(const QString &fbImageId,
     Q_D(FacebookImagesDatabase);
     if (!d->queuedUpdatedImages.contains(fbImageId)) {
         QMap<QString, QVariant> data;
+        FacebookImage::ConstPtr cachedImage = image(fbImageId);
+        if (!cachedImage) {
+            return;
+        }
+
         data.insert(QLatin1String(THUMBNAIL_FILE_KEY), thumbnailFile);
-        data.insert(QLatin1String(IMAGE_FILE_KEY), image(fbImageId)->imageFile());
+        data.insert(QLatin1String(IMAGE_FILE_KEY), cachedImage->imageFile());
         d->queuedUpdatedImages.insert(fbImageId, data);
     } else {
         d->queuedUpdatedImages[fbImageId].insert(QLatin1String(THUMBNAIL_FILE_KEY), thumbnailFile);
@@ -1225,7 +1744,12 @@ void FacebookImagesDatabase::updateImageFile(const QString &fbImageId, const QSt
     Q_D(FacebookImagesDatabase);
     if (!d->queuedUpdatedImages.contains(fbImageId)) {
         QMap<QString, QVariant> data;
-        data.insert(QLatin1String(THUMBNAIL_FILE_KEY), image(fbImageId)->thumbnailFile());
+        FacebookImage::ConstPtr cachedImage = image(fbImageId);
+        if (!cachedImage) {
+            return;
+        }
+
+        data.insert(QLatin1String(THUMBNAIL_FILE_KEY), cachedImage->thumbnailFile());
         data.insert(QLatin1String(IMAGE_FILE_KEY), imageFile);
         d->queuedUpdatedImages.insert(fbImageId, data);
     } else {
@@ -1233,38 +1757,403 @@ void FacebookImagesDatabase::updateImageFile(const QString &fbImageId, const QSt
     }
 }
 
-// Beware, if you write update, you have to have queued
-// data that contains exactly the same keys
-bool FacebookImagesDatabase::write()
+// Returns the validators (ETag, Last-Modified and size) that were
+// sent by the server along with url, and the file it was saved to.
+// Validators that are not yet written are also taken in account.
+bool FacebookImagesDatabase::imageValidators(const QString &url, QString *file, QString *etag,
+                                             QString *lastModified, qint64 *size) const
 {
-    Q_D(FacebookImagesDatabase);
-    if (!dbBeginTransaction()) {
-        return false;
-    }
-
-    qWarning() << "Queued users being saved:" << d->queuedUsers.count();
-    qWarning() << "Queued albums being saved:" << d->queuedAlbums.count();
-    qWarning() << "Queued images being saved:" << d->queuedImages.count();
-    qWarning() << "Queued users being updated:" << d->queuedUpdatedUsers.count();
-    qWarning() << "Queued images being updated:" << d->queuedUpdatedImages.count();
+    Q_D(const FacebookImagesDatabase);
+    QString validatorFile;
+    QString validatorEtag;
+    QString validatorLastModified;
+    qint64 validatorSize = -1;
+
+    if (d->queuedValidators.contains(url)) {
+        const QMap<QString, QVariant> &validator = d->queuedValidators[url];
+        validatorFile = validator.value(QLatin1String(VALIDATOR_FILE_KEY)).toString();
+        validatorEtag = validator.value(QLatin1String(VALIDATOR_ETAG_KEY)).toString();
+        validatorLastModified = validator.value(QLatin1String(VALIDATOR_LAST_MODIFIED_KEY)).toString();
+        validatorSize = validator.value(QLatin1String(VALIDATOR_SIZE_KEY)).toLongLong();
+    } else {
+        QSqlQuery query(d->db);
+        query.prepare("SELECT file, etag, lastModified, size "\
+                      "FROM validators WHERE url = :url");
+        query.bindValue(":url", url);
+        if (!query.exec()) {
+            qWarning() << Q_FUNC_INFO << "Error reading from validators table:" << query.lastError();
+            return false;
+        }
 
-    QMap<QString, QVariantList> entries;
-    QStringList keys;
+        if (!query.next()) {
+            return false;
+        }
 
-    // Start by writing new users
-    d->createUsersEntries(d->queuedUsers, keys, entries);
-    if (!dbWrite(QLatin1String("users"), keys, entries, InsertOrReplace)) {
-        dbRollbackTransaction();
-        return false;
+        validatorFile = query.value(0).toString();
+        validatorEtag = query.value(1).toString();
+        validatorLastModified = query.value(2).toString();
+        validatorSize = query.value(3).toLongLong();
     }
 
-    // Write new albums
-    d->createAlbumsEntries(d->queuedAlbums, keys, entries);
-    if (!dbWrite(QLatin1String("albums"), keys, entries, InsertOrReplace)) {
-        dbRollbackTransaction();
-        return false;
+    if (file) {
+        *file = validatorFile;
     }
-
+    if (etag) {
+        *etag = validatorEtag;
+    }
+    if (lastModified) {
+        *lastModified = validatorLastModified;
+    }
+    if (size) {
+        *size = validatorSize;
+    }
+
+    return true;
+}
+
+void FacebookImagesDatabase::updateImageValidators(const QString &url, const QString &file,
+                                                   const QString &etag,
+                                                   const QString &lastModified, qint64 size)
+{
+    Q_D(FacebookImagesDatabase);
+    QMap<QString, QVariant> validator;
+    validator.insert(QLatin1String(VALIDATOR_FILE_KEY), file);
+    validator.insert(QLatin1String(VALIDATOR_ETAG_KEY), etag);
+    validator.insert(QLatin1String(VALIDATOR_LAST_MODIFIED_KEY), lastModified);
+    validator.insert(QLatin1String(VALIDATOR_SIZE_KEY), size);
+    d->queuedValidators.insert(url, validator);
+}
+
+void FacebookImagesDatabase::removeImageValidators(const QString &url)
+{
+    Q_D(FacebookImagesDatabase);
+    d->queuedValidators.remove(url);
+    if (!d->queuedRemovedValidators.contains(url)) {
+        d->queuedRemovedValidators.append(url);
+    }
+}
+
+// Record that images were displayed at accessTime, used
+// to evict the least recently used images first
+void FacebookImagesDatabase::touchImages(const QStringList &fbImageIds,
+                                         const QDateTime &accessTime)
+{
+    Q_D(FacebookImagesDatabase);
+    foreach (const QString &fbImageId, fbImageIds) {
+        d->queuedAccessTimes.insert(fbImageId, accessTime.toTime_t());
+    }
+}
+
+// Returns the identifiers of the images that have a cached image
+// file, the least recently accessed first. Images that were never
+// accessed are returned first, the oldest first. Images whose file
+// is queued to be removed are not returned.
+QStringList FacebookImagesDatabase::leastRecentlyUsedImageIds(int count, bool *ok) const
+{
+    Q_D(const FacebookImagesDatabase);
+    if (ok) {
+        *ok = false;
+    }
+
+    QSet<QString> removedFiles;
+    for (QMap<QString, QMap<QString, QVariant> >::const_iterator i
+            = d->queuedUpdatedImages.begin(); i != d->queuedUpdatedImages.end(); ++i) {
+        if (i.value().value(QLatin1String(IMAGE_FILE_KEY)).toString().isEmpty()) {
+            removedFiles.insert(i.key());
+        }
+    }
+
+    QStringList ids;
+    QSqlQuery query(d->db);
+    query.prepare("SELECT images.fbImageId FROM images "\
+                  "LEFT JOIN imageAccess ON imageAccess.fbImageId = images.fbImageId "\
+                  "WHERE images.imageFile IS NOT NULL AND images.imageFile != '' "\
+                  "ORDER BY IFNULL(imageAccess.accessTime, 0) ASC, images.updatedTime ASC "\
+                  "LIMIT :count");
+    query.bindValue(":count", count + removedFiles.count());
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Unable to fetch least recently used images"
+                   << query.lastError().text();
+        return ids;
+    }
+
+    while (query.next() && ids.count() < count) {
+        QString fbImageId = query.value(0).toString();
+        if (!removedFiles.contains(fbImageId)) {
+            ids.append(fbImageId);
+        }
+    }
+
+    if (ok) {
+        *ok = true;
+    }
+
+    return ids;
+}
+
+// Returns the cached image files of the images, each file once
+QStringList FacebookImagesDatabase::cachedImageFiles(bool *ok) const
+{
+    Q_D(const FacebookImagesDatabase);
+    if (ok) {
+        *ok = false;
+    }
+
+    QStringList files;
+    QSqlQuery query(d->db);
+    query.prepare("SELECT DISTINCT imageFile FROM images "\
+                  "WHERE imageFile IS NOT NULL AND imageFile != ''");
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Unable to fetch cached image files"
+                   << query.lastError().text();
+        return files;
+    }
+
+    while (query.next()) {
+        files.append(query.value(0).toString());
+    }
+
+    if (ok) {
+        *ok = true;
+    }
+
+    return files;
+}
+
+// Returns the slot of the thumbnail atlas containing the
+// thumbnail of an image, or -1 if it is not in the atlas
+//
+// The generation of a slot changes every time it is allocated,
+// so that the content of a slot is identified by both.
+int FacebookImagesDatabase::atlasSlot(const QString &fbImageId, int *generation) const
+{
+    Q_D(const FacebookImagesDatabase);
+    if (d->queuedAtlasSlots.contains(fbImageId)) {
+        if (generation) {
+            *generation = d->queuedAtlasGenerations.value(fbImageId);
+        }
+        return d->queuedAtlasSlots.value(fbImageId);
+    }
+
+    QSqlQuery query(d->db);
+    query.prepare("SELECT slot, generation FROM atlasSlots WHERE fbImageId = :fbImageId");
+    query.bindValue(":fbImageId", fbImageId);
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Error reading from atlasSlots table:" << query.lastError();
+        return -1;
+    }
+
+    if (!query.next()) {
+        return -1;
+    }
+
+    if (generation) {
+        *generation = query.value(1).toInt();
+    }
+    return query.value(0).toInt();
+}
+
+QHash<QString, int> FacebookImagesDatabase::atlasSlots(QHash<QString, int> *generations) const
+{
+    Q_D(const FacebookImagesDatabase);
+    QHash<QString, int> slots;
+
+    QSqlQuery query(d->db);
+    query.prepare("SELECT fbImageId, slot, generation FROM atlasSlots");
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Error reading from atlasSlots table:" << query.lastError();
+        return slots;
+    }
+
+    while (query.next()) {
+        slots.insert(query.value(0).toString(), query.value(1).toInt());
+        if (generations) {
+            generations->insert(query.value(0).toString(), query.value(2).toInt());
+        }
+    }
+
+    return slots;
+}
+
+// Allocate a slot of the thumbnail atlas for an image
+//
+// Slots of images that were removed are reused first, with the
+// next generation. Since slots are unique, writing the new slot
+// removes the old entry.
+int FacebookImagesDatabase::allocateAtlasSlot(const QString &fbImageId)
+{
+    Q_D(FacebookImagesDatabase);
+    int slot = atlasSlot(fbImageId);
+    if (slot >= 0) {
+        return slot;
+    }
+
+    QList<int> queuedSlots = d->queuedAtlasSlots.values();
+    int generation = 0;
+
+    QSqlQuery query(d->db);
+    query.prepare("SELECT slot, generation FROM atlasSlots "\
+                  "WHERE fbImageId NOT IN (SELECT fbImageId FROM images) "\
+                  "ORDER BY slot");
+    if (query.exec()) {
+        while (query.next()) {
+            int freeSlot = query.value(0).toInt();
+            if (!queuedSlots.contains(freeSlot)) {
+                slot = freeSlot;
+                generation = query.value(1).toInt() + 1;
+                break;
+            }
+        }
+    } else {
+        qWarning() << Q_FUNC_INFO << "Error reading from atlasSlots table:" << query.lastError();
+    }
+
+    if (slot < 0) {
+        query.prepare("SELECT MAX(slot) FROM atlasSlots");
+        if (!query.exec()) {
+            qWarning() << Q_FUNC_INFO << "Error reading from atlasSlots table:" << query.lastError();
+            return -1;
+        }
+
+        slot = 0;
+        if (query.next() && !query.value(0).isNull()) {
+            slot = query.value(0).toInt() + 1;
+        }
+
+        foreach (int queuedSlot, queuedSlots) {
+            slot = qMax(slot, queuedSlot + 1);
+        }
+    }
+
+    d->queuedAtlasSlots.insert(fbImageId, slot);
+    d->queuedAtlasGenerations.insert(fbImageId, generation);
+    return slot;
+}
+
+// Returns the identifiers of the images that have a cached
+// thumbnail that is not in the thumbnail atlas yet
+QStringList FacebookImagesDatabase::unpackedThumbnailImageIds(int count, bool *ok) const
+{
+    Q_D(const FacebookImagesDatabase);
+    if (ok) {
+        *ok = false;
+    }
+
+    QStringList ids;
+    QSqlQuery query(d->db);
+    query.prepare("SELECT images.fbImageId FROM images "\
+                  "LEFT JOIN atlasSlots ON atlasSlots.fbImageId = images.fbImageId "\
+                  "WHERE atlasSlots.slot IS NULL "\
+                  "AND images.thumbnailFile IS NOT NULL AND images.thumbnailFile != '' "\
+                  "ORDER BY images.updatedTime DESC "\
+                  "LIMIT :count");
+    query.bindValue(":count", count);
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Unable to fetch unpacked thumbnails"
+                   << query.lastError().text();
+        return ids;
+    }
+
+    while (query.next()) {
+        QString fbImageId = query.value(0).toString();
+        if (!d->queuedAtlasSlots.contains(fbImageId)) {
+            ids.append(fbImageId);
+        }
+    }
+
+    if (ok) {
+        *ok = true;
+    }
+
+    return ids;
+}
+
+// Update the paths of cached files that were moved
+//
+// files maps the previous paths to the new ones.
+bool FacebookImagesDatabase::relocateFiles(const QMap<QString, QString> &files)
+{
+    Q_D(FacebookImagesDatabase);
+    if (files.isEmpty()) {
+        return true;
+    }
+
+    if (!dbBeginTransaction()) {
+        return false;
+    }
+
+    QStringList statements;
+    statements << QLatin1String("UPDATE images SET thumbnailFile = :newFile WHERE thumbnailFile = :file")
+               << QLatin1String("UPDATE images SET imageFile = :newFile WHERE imageFile = :file")
+               << QLatin1String("UPDATE validators SET file = :newFile WHERE file = :file");
+
+    foreach (const QString &statement, statements) {
+        QSqlQuery query (d->db);
+        if (!query.prepare(statement)) {
+            qWarning() << Q_FUNC_INFO << "Failed to prepare relocation query:"
+                       << query.lastError().text();
+            dbRollbackTransaction();
+            return false;
+        }
+
+        for (QMap<QString, QString>::const_iterator i = files.constBegin();
+             i != files.constEnd(); ++i) {
+            query.bindValue(":file", i.key());
+            query.bindValue(":newFile", i.value());
+            if (!query.exec()) {
+                qWarning() << Q_FUNC_INFO << "Failed to exec relocation query:"
+                           << query.lastError().text();
+                dbRollbackTransaction();
+                return false;
+            }
+        }
+    }
+
+    if (!dbCommitTransaction()) {
+        qWarning() << Q_FUNC_INFO << "Failed to commit transaction";
+        dbRollbackTransaction();
+        return false;
+    }
+
+    return true;
+}
+
+// Beware, if you write update, you have to have queued
+// data that contains exactly the same keys
+bool FacebookImagesDatabase::write()
+{
+    Q_D(FacebookImagesDatabase);
+    if (!dbBeginTransaction()) {
+        return false;
+    }
+
+    qWarning() << "Queued users being saved:" << d->queuedUsers.count();
+    qWarning() << "Queued albums being saved:" << d->queuedAlbums.count();
+    qWarning() << "Queued images being saved:" << d->queuedImages.count();
+    qWarning() << "Queued users being updated:" << d->queuedUpdatedUsers.count();
+    qWarning() << "Queued images being updated:" << d->queuedUpdatedImages.count();
+
+    QMap<QString, QVariantList> entries;
+    QStringList keys;
+
+    // Files that are replaced are removed if nothing references them anymore
+    QStringList replacedFiles;
+    d->collectReplacedFiles(replacedFiles);
+
+    // Start by writing new users
+    d->createUsersEntries(d->queuedUsers, keys, entries);
+    if (!dbWrite(QLatin1String("users"), keys, entries, InsertOrReplace)) {
+        dbRollbackTransaction();
+        return false;
+    }
+
+    // Write new albums
+    d->createAlbumsEntries(d->queuedAlbums, keys, entries);
+    if (!dbWrite(QLatin1String("albums"), keys, entries, InsertOrReplace)) {
+        dbRollbackTransaction();
+        return false;
+    }
+
     // Write new images
     d->createImagesEntries(d->queuedImages, keys, entries);
     if (!dbWrite(QLatin1String("images"), keys, entries, InsertOrReplace)) {
@@ -1272,6 +2161,26 @@ bool FacebookImagesDatabase::write()
         return false;
     }
 
+    // Index the names of new users, albums and images
+    QMap<QString, QString> userNames;
+    foreach (const FacebookUser::ConstPtr &user, d->queuedUsers) {
+        userNames.insert(user->fbUserId(), user->userName());
+    }
+    QMap<QString, QString> albumNames;
+    foreach (const FacebookAlbum::ConstPtr &album, d->queuedAlbums) {
+        albumNames.insert(album->fbAlbumId(), album->albumName());
+    }
+    QMap<QString, QString> imageNames;
+    foreach (const FacebookImage::ConstPtr &image, d->queuedImages) {
+        imageNames.insert(image->fbImageId(), image->imageName());
+    }
+    if (!d->indexNames(QLatin1String("users"), userNames)
+        || !d->indexNames(QLatin1String("albums"), albumNames)
+        || !d->indexNames(QLatin1String("images"), imageNames)) {
+        dbRollbackTransaction();
+        return false;
+    }
+
     // Write updated users
     d->createUpdatedEntries(d->queuedUpdatedUsers, QLatin1String("fbUserId"), entries);
     if (!dbWrite(QLatin1String("users"), QStringList(), entries, Update,
@@ -1288,18 +2197,81 @@ bool FacebookImagesDatabase::write()
         return false;
     }
 
+    // Write validators
+    d->createValidatorsEntries(d->queuedValidators, keys, entries);
+    if (!dbWrite(QLatin1String("validators"), keys, entries, InsertOrReplace)) {
+        dbRollbackTransaction();
+        return false;
+    }
+
+    // Remove validators
+    keys.clear();
+    keys.append(QLatin1String("url"));
+    entries.clear();
+    foreach (const QString &url, d->queuedRemovedValidators) {
+        entries[QLatin1String("url")].append(url);
+    }
+    if (!dbWrite(QLatin1String("validators"), keys, entries, Delete)) {
+        dbRollbackTransaction();
+        return false;
+    }
+
+    // Write access times
+    keys.clear();
+    keys << QLatin1String("fbImageId") << QLatin1String("accessTime");
+    entries.clear();
+    for (QMap<QString, uint>::const_iterator i = d->queuedAccessTimes.begin();
+         i != d->queuedAccessTimes.end(); i++) {
+        entries[QLatin1String("fbImageId")].append(i.key());
+        entries[QLatin1String("accessTime")].append(i.value());
+    }
+    if (!dbWrite(QLatin1String("imageAccess"), keys, entries, InsertOrReplace)) {
+        dbRollbackTransaction();
+        return false;
+    }
+
+    // Write atlas slots
+    keys.clear();
+    keys << QLatin1String("fbImageId") << QLatin1String("slot") << QLatin1String("generation");
+    entries.clear();
+    for (QMap<QString, int>::const_iterator i = d->queuedAtlasSlots.begin();
+         i != d->queuedAtlasSlots.end(); i++) {
+        entries[QLatin1String("fbImageId")].append(i.key());
+        entries[QLatin1String("slot")].append(i.value());
+        entries[QLatin1String("generation")].append(d->queuedAtlasGenerations.value(i.key()));
+    }
+    if (!dbWrite(QLatin1String("atlasSlots"), keys, entries, InsertOrReplace)) {
+        dbRollbackTransaction();
+        return false;
+    }
+
+    QStringList unreferencedFiles;
+    d->collectUnreferencedFiles(replacedFiles, unreferencedFiles);
+
+    if (!dbPruneChangeLog()) {
+        dbRollbackTransaction();
+        return false;
+    }
+
     if (!dbCommitTransaction()) {
         qWarning() << Q_FUNC_INFO << "Failed to commit transaction";
         dbRollbackTransaction();
         return false;
     }
 
+    d->removeFiles(unreferencedFiles);
+
     d->queuedUsers.clear();
     d->queuedAlbums.clear();
     d->queuedImages.clear();
 
     d->queuedUpdatedUsers.clear();
     d->queuedUpdatedImages.clear();
+    d->queuedValidators.clear();
+    d->queuedRemovedValidators.clear();
+    d->queuedAccessTimes.clear();
+    d->queuedAtlasSlots.clear();
+    d->queuedAtlasGenerations.clear();
 
     return true;
 }
@@ -1314,6 +2286,9 @@ bool FacebookImagesDatabase::dbCreateTables()
     // albums = fbAlbumId, fbUserId, createdTime, updatedTime, albumName, imageCount, coverImageId,
     //          thumbnailFile
     // users = fbUserId, updatedTime, userName, thumbnailUrl, imageUrl, thumbnailFile, imageFile
+    // validators = url, file, etag, lastModified, size
+    // imageAccess = fbImageId, accessTime
+    // atlasSlots = fbImageId, slot, generation
     QSqlQuery query(d->db);
     query.prepare( "CREATE TABLE IF NOT EXISTS images ("
                    "fbImageId TEXT UNIQUE PRIMARY KEY,"
@@ -1362,6 +2337,107 @@ bool FacebookImagesDatabase::dbCreateTables()
         return false;
     }
 
+    query.prepare( "CREATE TABLE IF NOT EXISTS validators ("
+                   "url TEXT UNIQUE PRIMARY KEY,"
+                   "file TEXT,"
+                   "etag TEXT,"
+                   "lastModified TEXT,"
+                   "size INTEGER)");
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Unable to create validators table:" << query.lastError().text();
+        return false;
+    }
+
+    query.prepare( "CREATE TABLE IF NOT EXISTS imageAccess ("
+                   "fbImageId TEXT UNIQUE PRIMARY KEY,"
+                   "accessTime INTEGER)");
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Unable to create imageAccess table:" << query.lastError().text();
+        return false;
+    }
+
+    query.prepare( "CREATE TABLE IF NOT EXISTS atlasSlots ("
+                   "fbImageId TEXT UNIQUE PRIMARY KEY,"
+                   "slot INTEGER UNIQUE,"
+                   "generation INTEGER)");
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Unable to create atlasSlots table:" << query.lastError().text();
+        return false;
+    }
+
+    // Indexes used to count the references to a cached file
+    query.prepare("CREATE INDEX IF NOT EXISTS images_thumbnailFile ON images(thumbnailFile)");
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Unable to create images thumbnailFile index:"
+                   << query.lastError().text();
+        return false;
+    }
+
+    query.prepare("CREATE INDEX IF NOT EXISTS images_imageFile ON images(imageFile)");
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Unable to create images imageFile index:"
+                   << query.lastError().text();
+        return false;
+    }
+
+    query.prepare("CREATE INDEX IF NOT EXISTS validators_file ON validators(file)");
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Unable to create validators file index:"
+                   << query.lastError().text();
+        return false;
+    }
+
+    // Words of the names of users, albums and images, that are
+    // removed with them. Rows replaced by write() are indexed again.
+    query.prepare( "CREATE TABLE IF NOT EXISTS nameTokens ("
+                   "kind TEXT,"
+                   "identifier TEXT,"
+                   "token TEXT)");
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Unable to create nameTokens table:" << query.lastError().text();
+        return false;
+    }
+
+    query.prepare("CREATE INDEX IF NOT EXISTS nameTokens_token ON nameTokens(kind, token)");
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Unable to create nameTokens token index:"
+                   << query.lastError().text();
+        return false;
+    }
+
+    query.prepare("CREATE INDEX IF NOT EXISTS nameTokens_identifier "\
+                  "ON nameTokens(kind, identifier)");
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Unable to create nameTokens identifier index:"
+                   << query.lastError().text();
+        return false;
+    }
+
+    for (int i = 0; i < NAME_TABLE_COUNT; ++i) {
+        query.prepare(QString(QLatin1String(
+                "CREATE TRIGGER IF NOT EXISTS %1_delete_nameTokens AFTER DELETE ON %1 "
+                "BEGIN DELETE FROM nameTokens WHERE kind = '%1' AND identifier = OLD.%2; END"))
+                .arg(QLatin1String(NAME_TABLES[i]), QLatin1String(NAME_KEYS[i])));
+        if (!query.exec()) {
+            qWarning() << Q_FUNC_INFO << "Unable to create nameTokens trigger on" << NAME_TABLES[i]
+                       << query.lastError().text();
+            return false;
+        }
+    }
+
+    // Changes are logged for incremental refreshes. Atlas slots
+    // are part of the images displayed by the models.
+    if (!dbCreateChangeLog(QLatin1String("users"), QLatin1String("fbUserId"),
+                           QLatin1String("users"))
+        || !dbCreateChangeLog(QLatin1String("albums"), QLatin1String("fbAlbumId"),
+                              QLatin1String("albums"))
+        || !dbCreateChangeLog(QLatin1String("images"), QLatin1String("fbImageId"),
+                              QLatin1String("images"))
+        || !dbCreateChangeLog(QLatin1String("atlasSlots"), QLatin1String("fbImageId"),
+                              QLatin1String("images"))) {
+        return false;
+    }
+
     if (!dbCreatePragmaVersion(VERSION)) {
         return false;
     }
@@ -1398,5 +2474,35 @@ bool FacebookImagesDatabase::dbDropTables()
         return false;
     }
 
+    query.prepare("DROP TABLE IF EXISTS validators");
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Failed to delete validators table:" << query.lastError().text();
+        return false;
+    }
+
+    query.prepare("DROP TABLE IF EXISTS imageAccess");
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Failed to delete imageAccess table:" << query.lastError().text();
+        return false;
+    }
+
+    query.prepare("DROP TABLE IF EXISTS atlasSlots");
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Failed to delete atlasSlots table:" << query.lastError().text();
+        return false;
+    }
+
+    query.prepare("DROP TABLE IF EXISTS nameTokens");
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Failed to delete nameTokens table:" << query.lastError().text();
+        return false;
+    }
+
+    query.prepare("DROP TABLE IF EXISTS changes");
+    if (!query.exec()) {
+        qWarning() << Q_FUNC_INFO << "Failed to delete changes table:" << query.lastError().text();
+        return false;
+    }
+
     return true;
 }
@@ -22,6 +22,8 @@
 
 #include "abstractsocialcachedatabase_p.h"
 #include <QtCore/QDateTime>
+#include <QtCore/QHash>
+#include <QtCore/QMap>
 #include <QtCore/QStringList>
 
 class FacebookUserPrivate;
@@ -145,7 +147,7 @@ public:
     void addUser(const QString &fbUserId, const QDateTime &updatedTime,
                  const QString &userName);
     void removeUser(const QString &fbUserId);
-    QList<FacebookUser::ConstPtr> users() const;
+    QList<FacebookUser::ConstPtr> users(const QString &search = QString()) const;
 
     // Album cache manipulation
     QStringList allAlbumIds(bool *ok = 0) const;
@@ -154,12 +156,14 @@ public:
                   const QDateTime &updatedTime, const QString &albumName, int imageCount);
     void removeAlbum(const QString &fbAlbumId);
     void removeAlbums(const QStringList &fbAlbumIds);
-    QList<FacebookAlbum::ConstPtr> albums(const QString &fbUserId = QString());
+    QList<FacebookAlbum::ConstPtr> albums(const QString &fbUserId = QString(),
+                                          const QString &search = QString());
 
     // Images cache manipulation
     QStringList allImageIds(bool *ok = 0) const;
     QStringList imageIds(const QString &fbAlbumId, bool *ok = 0) const;
     FacebookImage::ConstPtr image(const QString &fbImageId) const;
+    QList<FacebookImage::ConstPtr> images(const QStringList &fbImageIds);
     void addImage(const QString & fbImageId, const QString & fbAlbumId,
                   const QString & fbUserId, const QDateTime & createdTime,
                   const QDateTime & updatedTime, const QString & imageName,
@@ -169,8 +173,36 @@ public:
     void updateImageFile(const QString &fbImageId, const QString &imageFile);
     void removeImage(const QString &fbImageId);
     void removeImages(const QStringList &fbImageIds);
-    QList<FacebookImage::ConstPtr> userImages(const QString &fbUserId = QString());
-    QList<FacebookImage::ConstPtr> albumImages(const QString &fbAlbumId);
+    QList<FacebookImage::ConstPtr> userImages(const QString &fbUserId = QString(),
+                                              qint64 changedSince = -1,
+                                              const SocialCacheQuery &query = SocialCacheQuery());
+    QList<FacebookImage::ConstPtr> albumImages(const QString &fbAlbumId, qint64 changedSince = -1,
+                                               const SocialCacheQuery &query = SocialCacheQuery());
+    QStringList userImageIds(const QString &fbUserId = QString(), bool *ok = 0,
+                             const SocialCacheQuery &query = SocialCacheQuery());
+    QStringList albumImageIds(const QString &fbAlbumId, bool *ok = 0,
+                              const SocialCacheQuery &query = SocialCacheQuery());
+
+    // Cache validators manipulation
+    bool imageValidators(const QString &url, QString *file, QString *etag,
+                         QString *lastModified, qint64 *size) const;
+    void updateImageValidators(const QString &url, const QString &file, const QString &etag,
+                               const QString &lastModified, qint64 size);
+    void removeImageValidators(const QString &url);
+
+    // Cached files manipulation
+    bool relocateFiles(const QMap<QString, QString> &files);
+
+    // Access times manipulation
+    void touchImages(const QStringList &fbImageIds, const QDateTime &accessTime);
+    QStringList leastRecentlyUsedImageIds(int count, bool *ok = 0) const;
+    QStringList cachedImageFiles(bool *ok = 0) const;
+
+    // Thumbnail atlas manipulation
+    int atlasSlot(const QString &fbImageId, int *generation = 0) const;
+    QHash<QString, int> atlasSlots(QHash<QString, int> *generations = 0) const;
+    int allocateAtlasSlot(const QString &fbImageId);
+    QStringList unpackedThumbnailImageIds(int count, bool *ok = 0) const;
 
     bool write();
 
@@ -0,0 +1,288 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ * Contact: Lucien Xu <lucien.xu@jollamobile.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "imageatlas.h"
+
+#include <QtCore/QAtomicInteger>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QStandardPaths>
+#include <QtGui/QImageReader>
+
+#include <QtDebug>
+
+#include <atomic>
+
+// ImageAtlas
+//
+// An image atlas stores pre-decoded images of a fixed size in
+// memory-mapped files, so that they can be displayed without
+// opening a file or decoding an image.
+//
+// Images are stored in slots. Each atlas file contains SLOTS_PER_FILE
+// slots, and a slot is made of a header, containing the width and height
+// of the image, followed by the pixels, in ARGB32 premultiplied format,
+// with a stride of slotSize.width() pixels. An empty slot has a null size.
+// The upper bits of the word holding the width count the writes of the
+// slot.
+//
+// Files are mapped once, and are shared between the atlases of a process
+// or of different processes, so a writer and readers can use the same
+// files at the same time. The writer clears the width before writing the
+// pixels, and stores it with release semantics once they are written.
+// Readers load it with acquire semantics, and check that it did not
+// change once the pixels are copied, so that an image that is written
+// meanwhile is not returned.
+
+static const int SLOTS_PER_FILE = 64;
+static const int HEADER_SIZE = 2 * sizeof(quint32);
+static const quint32 SIZE_MASK = 0xffff;
+static const int WRITE_COUNT_SHIFT = 16;
+
+typedef QAtomicInteger<quint32> AtlasHeader;
+
+class ImageAtlasPrivate
+{
+public:
+    explicit ImageAtlasPrivate(const QString &path, const QSize &slotSize);
+    ~ImageAtlasPrivate();
+
+    qint64 slotBytes() const;
+    uchar * slotData(int slot, bool create);
+
+    QString path;
+    QSize slotSize;
+    QMutex mutex;
+    QHash<int, QFile *> files;
+    QHash<int, uchar *> maps;
+};
+
+ImageAtlasPrivate::ImageAtlasPrivate(const QString &path, const QSize &slotSize)
+    : path(path), slotSize(slotSize)
+{
+}
+
+ImageAtlasPrivate::~ImageAtlasPrivate()
+{
+    for (QHash<int, QFile *>::const_iterator i = files.constBegin(); i != files.constEnd(); ++i) {
+        QFile *file = i.value();
+        if (maps.contains(i.key())) {
+            file->unmap(maps.value(i.key()));
+        }
+        delete file;
+    }
+}
+
+qint64 ImageAtlasPrivate::slotBytes() const
+{
+    return HEADER_SIZE + qint64(slotSize.width()) * slotSize.height() * 4;
+}
+
+// Returns the data of a slot, mapping the atlas file containing it if needed.
+// If create is true, the atlas file is created if it do not exist.
+uchar * ImageAtlasPrivate::slotData(int slot, bool create)
+{
+    if (slot < 0 || slotSize.isEmpty()) {
+        return 0;
+    }
+
+    QMutexLocker locker (&mutex);
+    Q_UNUSED(locker)
+
+    int index = slot / SLOTS_PER_FILE;
+    qint64 offset = (slot % SLOTS_PER_FILE) * slotBytes();
+
+    if (uchar *data = maps.value(index)) {
+        return data + offset;
+    }
+
+    const qint64 fileSize = SLOTS_PER_FILE * slotBytes();
+    QString fileName = QString(QLatin1String("%1/atlas-%2x%3-%4.bin")).arg(path)
+                       .arg(slotSize.width()).arg(slotSize.height()).arg(index);
+
+    QFile *file = new QFile(fileName);
+    if (!file->exists()) {
+        if (!create) {
+            delete file;
+            return 0;
+        }
+
+        QDir dir (path);
+        if (!dir.exists()) {
+            dir.mkpath(".");
+        }
+    }
+
+    if (!file->open(create ? QIODevice::ReadWrite : QIODevice::ReadOnly)) {
+        qWarning() << Q_FUNC_INFO << "Failed to open atlas" << fileName << file->errorString();
+        delete file;
+        return 0;
+    }
+
+    if (file->size() != fileSize) {
+        // A new file, or a file that is still being created by a writer
+        if (!create || !file->resize(fileSize)) {
+            delete file;
+            return 0;
+        }
+    }
+
+    uchar *data = file->map(0, fileSize);
+    if (!data) {
+        qWarning() << Q_FUNC_INFO << "Failed to map atlas" << fileName << file->errorString();
+        delete file;
+        return 0;
+    }
+
+    files.insert(index, file);
+    maps.insert(index, data);
+    return data + offset;
+}
+
+ImageAtlas::ImageAtlas(const QString &path, const QSize &slotSize)
+    : d_ptr(new ImageAtlasPrivate(path, slotSize))
+{
+}
+
+ImageAtlas::~ImageAtlas()
+{
+}
+
+QString ImageAtlas::makeAtlasPath(SocialSyncInterface::SocialNetwork socialNetwork,
+                                  SocialSyncInterface::DataType dataType)
+{
+    return QString("%1/%2/%3/atlas").arg(PRIVILEGED_DATA_DIR,
+                                         SocialSyncInterface::dataType(dataType),
+                                         SocialSyncInterface::socialNetwork(socialNetwork));
+}
+
+QString ImageAtlas::path() const
+{
+    Q_D(const ImageAtlas);
+    return d->path;
+}
+
+QSize ImageAtlas::slotSize() const
+{
+    Q_D(const ImageAtlas);
+    return d->slotSize;
+}
+
+// Write an image in a slot
+//
+// The image is scaled to cover the slot, and cropped
+// to its center. Smaller images are not scaled up.
+bool ImageAtlas::write(int slot, const QImage &image)
+{
+    Q_D(ImageAtlas);
+    if (image.isNull()) {
+        return false;
+    }
+
+    uchar *data = d->slotData(slot, true);
+    if (!data) {
+        return false;
+    }
+
+    QImage scaled = image;
+    if (image.width() > d->slotSize.width() || image.height() > d->slotSize.height()) {
+        scaled = image.scaled(d->slotSize, Qt::KeepAspectRatioByExpanding,
+                              Qt::SmoothTransformation);
+    }
+
+    QSize size = scaled.size().boundedTo(d->slotSize);
+    QRect rect (QPoint((scaled.width() - size.width()) / 2,
+                       (scaled.height() - size.height()) / 2), size);
+    QImage converted = scaled.copy(rect).convertToFormat(QImage::Format_ARGB32_Premultiplied);
+
+    // The width is cleared before the pixels are written
+    AtlasHeader *header = reinterpret_cast<AtlasHeader *>(data);
+    quint32 writeCount = (header[0].loadAcquire() >> WRITE_COUNT_SHIFT) + 1;
+    header[0].fetchAndStoreOrdered(writeCount << WRITE_COUNT_SHIFT);
+    header[1].storeRelease(converted.height());
+
+    uchar *pixels = data + HEADER_SIZE;
+    const int stride = d->slotSize.width() * 4;
+    for (int y = 0; y < converted.height(); ++y) {
+        memcpy(pixels + y * stride, converted.constScanLine(y), converted.width() * 4);
+    }
+
+    header[0].storeRelease((writeCount << WRITE_COUNT_SHIFT) | quint32(converted.width()));
+    return true;
+}
+
+// Decode an image file to be written in a slot
+//
+// The image is decoded directly at the size of the slot.
+QImage ImageAtlas::decode(const QString &file) const
+{
+    Q_D(const ImageAtlas);
+    QImageReader reader (file);
+    QSize size = reader.size();
+    if (size.isValid()) {
+        QSize scaledSize = size;
+        scaledSize.scale(d->slotSize, Qt::KeepAspectRatioByExpanding);
+        if (scaledSize.width() < size.width()) {
+            reader.setScaledSize(scaledSize);
+        }
+    }
+
+    QImage image = reader.read();
+    if (image.isNull()) {
+        qWarning() << Q_FUNC_INFO << "Failed to read" << file << reader.errorString();
+    }
+
+    return image;
+}
+
+// Read the image stored in a slot
+//
+// A null image is returned for empty slots.
+QImage ImageAtlas::read(int slot) const
+{
+    ImageAtlasPrivate *d = const_cast<ImageAtlasPrivate *>(d_func());
+    uchar *data = d->slotData(slot, false);
+    if (!data) {
+        return QImage();
+    }
+
+    const AtlasHeader *header = reinterpret_cast<const AtlasHeader *>(data);
+    const quint32 widthWord = header[0].loadAcquire();
+    int width = widthWord & SIZE_MASK;
+    int height = header[1].loadAcquire();
+    if (width <= 0 || height <= 0
+        || width > d->slotSize.width() || height > d->slotSize.height()) {
+        return QImage();
+    }
+
+    // The slot might be written again later, so return a copy
+    QImage image = QImage(data + HEADER_SIZE, width, height, d->slotSize.width() * 4,
+                          QImage::Format_ARGB32_Premultiplied).copy();
+
+    // Drop the copy if the slot was written while it was copied
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (header[0].loadAcquire() != widthWord) {
+        return QImage();
+    }
+
+    return image;
+}
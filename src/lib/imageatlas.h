@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ * Contact: Lucien Xu <lucien.xu@jollamobile.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef IMAGEATLAS_H
+#define IMAGEATLAS_H
+
+#include "socialsyncinterface.h"
+
+#include <QtCore/QScopedPointer>
+#include <QtCore/QSize>
+#include <QtGui/QImage>
+
+class ImageAtlasPrivate;
+class ImageAtlas
+{
+public:
+    explicit ImageAtlas(const QString &path, const QSize &slotSize);
+    virtual ~ImageAtlas();
+
+    static QString makeAtlasPath(SocialSyncInterface::SocialNetwork socialNetwork,
+                                 SocialSyncInterface::DataType dataType);
+
+    QString path() const;
+    QSize slotSize() const;
+
+    QImage decode(const QString &file) const;
+    bool write(int slot, const QImage &image);
+    QImage read(int slot) const;
+
+protected:
+    QScopedPointer<ImageAtlasPrivate> d_ptr;
+
+private:
+    Q_DECLARE_PRIVATE(ImageAtlas)
+};
+
+#endif // IMAGEATLAS_H
@@ -20,8 +20,11 @@ HEADERS = \
     abstractsocialcachedatabase.h \
     abstractsocialcachedatabase_p.h \
     abstractsocialpostcachedatabase.h \
+    abstractsocialpostcachedatabase_p.h \
+    socialcachedatabasewatcher.h \
     socialnetworksyncdatabase.h \
     facebookimagesdatabase.h \
+    imageatlas.h \
     facebookcalendardatabase.h \
     facebookcontactsdatabase.h \
     facebookpostsdatabase.h \
@@ -33,8 +36,10 @@ SOURCES = \
     abstractimagedownloader.cpp \
     abstractsocialcachedatabase.cpp \
     abstractsocialpostcachedatabase.cpp \
+    socialcachedatabasewatcher.cpp \
     socialnetworksyncdatabase.cpp \
     facebookimagesdatabase.cpp \
+    imageatlas.cpp \
     facebookcalendardatabase.cpp \
     facebookcontactsdatabase.cpp \
     facebookpostsdatabase.cpp \
@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ * Contact: Lucien Xu <lucien.xu@jollamobile.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "socialcachedatabasewatcher.h"
+#include "abstractsocialcachedatabase.h"
+
+#include <QtCore/QFileInfo>
+#include <QtCore/QFileSystemWatcher>
+#include <QtCore/QTimer>
+
+#include <QtDebug>
+
+// SocialCacheDatabaseWatcher
+//
+// Notifies the changes committed to a database, by this process or
+// by another one, like the sync daemon. The database should have a
+// change log, that is used to tell which tables changed.
+//
+// The database file is watched, so that nothing is done until it is
+// written. A burst of writes only leads to one check, after
+// CHECK_DELAY. The database is also checked every POLL_INTERVAL, as
+// the watch can be lost, for example when the file is replaced. If
+// the file cannot be watched, the database is polled more often.
+//
+// A check compares the data version of the database, that changes
+// when other connections commit, and the sequence of its change log,
+// that also changes when the connection of the database commits.
+
+static const int CHECK_DELAY = 100;
+static const int POLL_INTERVAL = 30000;
+static const int FALLBACK_POLL_INTERVAL = 2000;
+
+class SocialCacheDatabaseWatcherPrivate
+{
+public:
+    explicit SocialCacheDatabaseWatcherPrivate(AbstractSocialCacheDatabase *database);
+
+    AbstractSocialCacheDatabase *database;
+    QFileSystemWatcher *watcher;
+    QTimer *checkTimer;
+    QTimer *pollTimer;
+    int dataVersion;
+    qint64 sequence;
+};
+
+SocialCacheDatabaseWatcherPrivate::SocialCacheDatabaseWatcherPrivate(
+        AbstractSocialCacheDatabase *database)
+    : database(database), watcher(0), checkTimer(0), pollTimer(0)
+    , dataVersion(-1), sequence(-1)
+{
+}
+
+SocialCacheDatabaseWatcher::SocialCacheDatabaseWatcher(AbstractSocialCacheDatabase *database,
+                                                       QObject *parent)
+    : QObject(parent), d_ptr(new SocialCacheDatabaseWatcherPrivate(database))
+{
+    Q_D(SocialCacheDatabaseWatcher);
+    d->watcher = new QFileSystemWatcher(this);
+    connect(d->watcher, &QFileSystemWatcher::fileChanged,
+            this, &SocialCacheDatabaseWatcher::watchFiles);
+    connect(d->watcher, &QFileSystemWatcher::directoryChanged,
+            this, &SocialCacheDatabaseWatcher::watchFiles);
+
+    d->checkTimer = new QTimer(this);
+    d->checkTimer->setSingleShot(true);
+    d->checkTimer->setInterval(CHECK_DELAY);
+    connect(d->checkTimer, &QTimer::timeout, this, &SocialCacheDatabaseWatcher::check);
+
+    d->pollTimer = new QTimer(this);
+    connect(d->pollTimer, &QTimer::timeout, this, &SocialCacheDatabaseWatcher::check);
+
+    // Only the changes that happen from now on are notified
+    d->dataVersion = database->dataVersion();
+    d->sequence = database->changeSequence();
+
+    if (!database->databaseFile().isEmpty()) {
+        d->watcher->addPath(QFileInfo(database->databaseFile()).absolutePath());
+    }
+    watchFiles();
+}
+
+SocialCacheDatabaseWatcher::~SocialCacheDatabaseWatcher()
+{
+}
+
+// Check if the database changed since the last check
+void SocialCacheDatabaseWatcher::check()
+{
+    Q_D(SocialCacheDatabaseWatcher);
+    d->checkTimer->stop();
+
+    bool ok = false;
+    int dataVersion = d->database->dataVersion(&ok);
+    if (!ok) {
+        return;
+    }
+
+    qint64 sequence = d->database->changeSequence(&ok);
+    if (!ok) {
+        return;
+    }
+
+    if (dataVersion == d->dataVersion && sequence == d->sequence) {
+        return;
+    }
+
+    QStringList tables;
+    if (sequence != d->sequence) {
+        // The sequence starts again when the change log is created again
+        tables = d->database->changedTables(sequence > d->sequence ? d->sequence : 0);
+    }
+
+    d->dataVersion = dataVersion;
+    d->sequence = sequence;
+
+    // changed is emitted last, so that the changes of
+    // several tables can be handled at once
+    foreach (const QString &table, tables) {
+        emit tableChanged(table);
+    }
+    emit changed();
+}
+
+void SocialCacheDatabaseWatcher::scheduleCheck()
+{
+    Q_D(SocialCacheDatabaseWatcher);
+    if (!d->checkTimer->isActive()) {
+        d->checkTimer->start();
+    }
+}
+
+// Watch the database file, and its write-ahead log if any
+//
+// Files are watched again when they are created or replaced,
+// which is notified as a change of the directory.
+void SocialCacheDatabaseWatcher::watchFiles()
+{
+    Q_D(SocialCacheDatabaseWatcher);
+    const QString databaseFile = d->database->databaseFile();
+    if (databaseFile.isEmpty()) {
+        d->pollTimer->start(FALLBACK_POLL_INTERVAL);
+        return;
+    }
+
+    QStringList files;
+    files << databaseFile << databaseFile + QLatin1String("-wal");
+
+    const QStringList watched = d->watcher->files();
+    foreach (const QString &file, files) {
+        if (!watched.contains(file) && QFileInfo::exists(file)) {
+            d->watcher->addPath(file);
+        }
+    }
+
+    int interval = d->watcher->files().contains(databaseFile) ? POLL_INTERVAL
+                                                                : FALLBACK_POLL_INTERVAL;
+    if (!d->pollTimer->isActive() || d->pollTimer->interval() != interval) {
+        d->pollTimer->start(interval);
+    }
+
+    scheduleCheck();
+}
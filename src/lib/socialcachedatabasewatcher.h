@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ * Contact: Lucien Xu <lucien.xu@jollamobile.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef SOCIALCACHEDATABASEWATCHER_H
+#define SOCIALCACHEDATABASEWATCHER_H
+
+#include <QtCore/QObject>
+#include <QtCore/QScopedPointer>
+
+class AbstractSocialCacheDatabase;
+class SocialCacheDatabaseWatcherPrivate;
+class SocialCacheDatabaseWatcher: public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit SocialCacheDatabaseWatcher(AbstractSocialCacheDatabase *database,
+                                        QObject *parent = 0);
+    virtual ~SocialCacheDatabaseWatcher();
+
+public Q_SLOTS:
+    void check();
+
+Q_SIGNALS:
+    void changed();
+    void tableChanged(const QString &table);
+
+private Q_SLOTS:
+    void scheduleCheck();
+    void watchFiles();
+
+protected:
+    QScopedPointer<SocialCacheDatabaseWatcherPrivate> d_ptr;
+
+private:
+    Q_DECLARE_PRIVATE(SocialCacheDatabaseWatcher)
+};
+
+#endif // SOCIALCACHEDATABASEWATCHER_H
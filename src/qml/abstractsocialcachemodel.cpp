@@ -21,9 +21,41 @@
 #include "abstractsocialcachemodel_p.h"
 
 #include <synchronizelists_p.h>
+#include "socialcachedatabasewatcher.h"
+#include "socialcacheworkerpool_p.h"
 
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDataStream>
 #include <QtCore/QDebug>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
 #include <QtCore/QMutexLocker>
+#include <QtCore/QSaveFile>
+#include <QtCore/QSet>
+#include <QtCore/QStandardPaths>
+
+#include <algorithm>
+
+// Changes with more than RESET_THRESHOLD insertions, removals
+// and moves are reported as a reset, that is cheaper for views.
+static const int RESET_THRESHOLD = 100;
+
+// Fields changed by downloads are reported at most UPDATE_DELAY
+// milliseconds after their change, that is about one frame.
+static const int UPDATE_DELAY = 16;
+
+// In lazy mode, rows are fetched in pages of PAGE_SIZE rows,
+// and only the MAXIMUM_PAGES most recently used pages are kept.
+static const int PAGE_SIZE = 50;
+static const int MAXIMUM_PAGES = 20;
+
+// Snapshots of the rows are saved SNAPSHOT_DELAY milliseconds after
+// they changed, so that they can be shown on the next start before
+// the database is read.
+static const int SNAPSHOT_DELAY = 2000;
+static const quint32 SNAPSHOT_MAGIC = 0x534e4150; // "SNAP"
+static const quint32 SNAPSHOT_VERSION = 1;
 
 template <> bool compareIdentity<SocialCacheModelRow>(
         const SocialCacheModelRow &item, const SocialCacheModelRow &reference)
@@ -31,21 +63,164 @@ template <> bool compareIdentity<SocialCacheModelRow>(
     return item.value(0) == reference.value(0);
 }
 
+// Stored rows are compared with the rows reported by the worker
+bool compareIdentity(const SocialCacheModelStoredRow &item, const SocialCacheModelRow &reference)
+{
+    return item.value(0) == reference.value(0);
+}
+
+template <> quint64 identityHash<SocialCacheModelRow>(const SocialCacheModelRow &item)
+{
+    return fnv1aHash(item.value(0).toString());
+}
+
+template <> quint64 identityHash<SocialCacheModelStoredRow>(const SocialCacheModelStoredRow &item)
+{
+    return fnv1aHash(item.value(0).toString());
+}
+
+// Collects the changes between the rows of the model and new rows in a delta
+class SocialCacheModelDataAgent
+{
+public:
+    void insertRange(int index, int count, const SocialCacheModelData &source, int sourceIndex)
+    {
+        SocialCacheModelChange change;
+        change.type = SocialCacheModelChange::Insert;
+        change.index = index;
+        change.count = count;
+        change.rows = source.mid(sourceIndex, count);
+        delta.append(change);
+    }
+
+    void removeRange(int index, int count)
+    {
+        SocialCacheModelChange change;
+        change.type = SocialCacheModelChange::Remove;
+        change.index = index;
+        change.count = count;
+        delta.append(change);
+    }
+
+    void moveRange(int index, int count, int destination)
+    {
+        SocialCacheModelChange change;
+        change.type = SocialCacheModelChange::Move;
+        change.index = index;
+        change.count = count;
+        change.destination = destination;
+        delta.append(change);
+    }
+
+    void updateRange(int index, int count, const SocialCacheModelData &source, int sourceIndex)
+    {
+        SocialCacheModelChange change;
+        change.type = SocialCacheModelChange::Update;
+        change.index = index;
+        change.count = count;
+        change.rows = source.mid(sourceIndex, count);
+        delta.append(change);
+    }
+
+    SocialCacheModelDelta delta;
+};
+
 template <>
-int updateRange<AbstractSocialCacheModelPrivate, SocialCacheModelData>(
-        AbstractSocialCacheModelPrivate *d,
+int updateRange<SocialCacheModelDataAgent, SocialCacheModelData>(
+        SocialCacheModelDataAgent *agent,
         int index,
         int count,
         const SocialCacheModelData &source,
         int sourceIndex)
 {
-    d->updateRange(index, count, source, sourceIndex);
+    agent->updateRange(index, count, source, sourceIndex);
+
+    return count;
+}
+
+// Collects the changes between two lists of identifiers in a delta
+//
+// Inserted rows, and rows that are changed, are taken from rows.
+class SocialCacheDeltaAgent
+{
+public:
+    explicit SocialCacheDeltaAgent(const QHash<QString, SocialCacheModelRow> &rows)
+        : rows(rows)
+    {
+    }
+
+    void insertRange(int index, int count, const QStringList &source, int sourceIndex)
+    {
+        SocialCacheModelChange change;
+        change.type = SocialCacheModelChange::Insert;
+        change.index = index;
+        change.count = count;
+        for (int i = 0; i < count; ++i) {
+            change.rows.append(rows.value(source.at(sourceIndex + i)));
+        }
+        delta.append(change);
+    }
+
+    void removeRange(int index, int count)
+    {
+        SocialCacheModelChange change;
+        change.type = SocialCacheModelChange::Remove;
+        change.index = index;
+        change.count = count;
+        delta.append(change);
+    }
+
+    void moveRange(int index, int count, int destination)
+    {
+        SocialCacheModelChange change;
+        change.type = SocialCacheModelChange::Move;
+        change.index = index;
+        change.count = count;
+        change.destination = destination;
+        delta.append(change);
+    }
+
+    // Only rows that changed are updated
+    void updateRange(int index, int count, const QStringList &source, int sourceIndex)
+    {
+        SocialCacheModelChange change;
+        change.type = SocialCacheModelChange::Update;
+        for (int i = 0; i <= count; ++i) {
+            QHash<QString, SocialCacheModelRow>::const_iterator row = i < count
+                    ? rows.find(source.at(sourceIndex + i)) : rows.constEnd();
+            if (row != rows.constEnd()) {
+                if (change.rows.isEmpty()) {
+                    change.index = index + i;
+                }
+                change.rows.append(row.value());
+            } else if (!change.rows.isEmpty()) {
+                change.count = change.rows.count();
+                delta.append(change);
+                change.rows.clear();
+            }
+        }
+    }
+
+    const QHash<QString, SocialCacheModelRow> &rows;
+    SocialCacheModelDelta delta;
+};
+
+template <>
+int updateRange<SocialCacheDeltaAgent, QStringList>(
+        SocialCacheDeltaAgent *agent,
+        int index,
+        int count,
+        const QStringList &source,
+        int sourceIndex)
+{
+    agent->updateRange(index, count, source, sourceIndex);
 
     return count;
 }
 
 AbstractWorkerObject::AbstractWorkerObject():
-    m_loading(false)
+    m_watcher(0), m_watchedTablesChanged(false), m_loading(false), m_lazy(false)
+  , m_visible(true), m_refreshPending(false), m_emitted(false)
 {
 }
 
@@ -60,6 +235,13 @@ bool AbstractWorkerObject::isLoading() const
 
 void AbstractWorkerObject::triggerRefresh()
 {
+    // Worker objects share their threads, so visible
+    // models are refreshed before the other ones
+    if (!m_visible) {
+        m_refreshPending = true;
+        return;
+    }
+
     if (!isLoading()) {
         refresh();
     }
@@ -68,6 +250,55 @@ void AbstractWorkerObject::triggerRefresh()
 void AbstractWorkerObject::setNodeIdentifier(const QString &nodeIdentifierToSet)
 {
     nodeIdentifier = nodeIdentifierToSet;
+    resetEmittedData();
+}
+
+// The next refresh reports all the rows again, with
+// only their identifier in lazy mode
+void AbstractWorkerObject::setLazy(bool lazy)
+{
+    if (m_lazy != lazy) {
+        m_lazy = lazy;
+        resetEmittedData();
+    }
+}
+
+const SocialCacheQuery &AbstractWorkerObject::query() const
+{
+    return m_query;
+}
+
+bool AbstractWorkerObject::isLazy() const
+{
+    return m_lazy;
+}
+
+void AbstractWorkerObject::setVisible(bool visible)
+{
+    m_visible = visible;
+    if (m_visible && m_refreshPending) {
+        m_refreshPending = false;
+        triggerRefresh();
+    }
+}
+
+// The next refresh reports all the rows again, in the new order
+void AbstractWorkerObject::setQuery(const QString &sortField, int sortOrder,
+                                   const QVariantMap &filters, const QString &search)
+{
+    m_query.sortField = sortField;
+    m_query.sortOrder = static_cast<Qt::SortOrder>(sortOrder);
+    m_query.filters = filters;
+    m_query.search = search;
+    resetEmittedData();
+}
+
+void AbstractWorkerObject::fetchRows(int index, const QStringList &identifiers)
+{
+    Q_UNUSED(identifiers)
+
+    // Pages are always answered, so that they are not pending forever
+    emit rowsFetched(index, SocialCacheModelData());
 }
 
 void AbstractWorkerObject::setLoading(bool loading)
@@ -77,9 +308,105 @@ void AbstractWorkerObject::setLoading(bool loading)
     m_loading = loading;
 }
 
+void AbstractWorkerObject::emitData(const SocialCacheModelData &data)
+{
+    m_identifiers.clear();
+    m_identifiers.reserve(data.count());
+    foreach (const SocialCacheModelRow &row, data) {
+        m_identifiers.append(row.value(0).toString());
+    }
+    m_emitted = true;
+
+    emit dataUpdated(data);
+}
+
+// Report the changes since the data was last reported
+//
+// identifiers lists the identifiers of all the rows, in order, and
+// changedRows contains the rows that are new or that changed. Other
+// rows are not modified. Returns false if a new row is missing, in
+// which case the data should be reported again with emitData.
+bool AbstractWorkerObject::emitDelta(const QStringList &identifiers,
+                                     const SocialCacheModelData &changedRows)
+{
+    if (!m_emitted) {
+        return false;
+    }
+
+    QHash<QString, SocialCacheModelRow> rows;
+    rows.reserve(changedRows.count());
+    foreach (const SocialCacheModelRow &row, changedRows) {
+        rows.insert(row.value(0).toString(), row);
+    }
+
+    QSet<QString> known = m_identifiers.toSet();
+    foreach (const QString &identifier, identifiers) {
+        if (!known.contains(identifier) && !rows.contains(identifier)) {
+            return false;
+        }
+    }
+
+    SocialCacheDeltaAgent agent (rows);
+    synchronizeList(&agent, m_identifiers, identifiers);
+    m_identifiers = identifiers;
+
+    if (!agent.delta.isEmpty()) {
+        emit deltaUpdated(agent.delta);
+    }
+    return true;
+}
+
+bool AbstractWorkerObject::hasEmittedData() const
+{
+    return m_emitted;
+}
+
+// The next refresh should report all the data,
+// for example when the data set changes
+void AbstractWorkerObject::resetEmittedData()
+{
+    m_emitted = false;
+    m_identifiers.clear();
+}
+
+// Changes committed to the database, for example by the sync
+// daemon, are reported by the watcher, so that the model is
+// refreshed without polling.
+void AbstractWorkerObject::watchDatabase(AbstractSocialCacheDatabase *database,
+                                         const QStringList &tables)
+{
+    m_watchedTables = tables;
+    if (!m_watcher) {
+        m_watcher = new SocialCacheDatabaseWatcher(database, this);
+        connect(m_watcher, &SocialCacheDatabaseWatcher::tableChanged,
+                this, &AbstractWorkerObject::databaseTableChanged);
+        connect(m_watcher, &SocialCacheDatabaseWatcher::changed,
+                this, &AbstractWorkerObject::databaseChanged);
+    }
+}
+
+void AbstractWorkerObject::databaseTableChanged(const QString &table)
+{
+    if (m_watchedTables.contains(table)) {
+        m_watchedTablesChanged = true;
+    }
+}
+
+// Refresh once when several watched tables changed
+void AbstractWorkerObject::databaseChanged()
+{
+    if (m_watchedTablesChanged) {
+        m_watchedTablesChanged = false;
+        triggerRefresh();
+    }
+}
+
 void AbstractWorkerObject::quitGracefully()
 {
     m_quitMutex.lock();
+    // The database is about to be closed
+    delete m_watcher;
+    m_watcher = 0;
     finalCleanup();
     m_quitWC.wakeAll();
     m_quitMutex.unlock();
@@ -87,36 +414,52 @@ void AbstractWorkerObject::quitGracefully()
 
 AbstractSocialCacheModelPrivate::AbstractSocialCacheModelPrivate(AbstractSocialCacheModel *q,
                                                                  QObject *parent)
-    :  QObject(parent), m_workerObject(0), q_ptr(q)
+    :  QObject(parent), m_workerObject(0), q_ptr(q), m_lazy(false), m_visible(true)
+    , m_refreshed(false), m_resetting(false), m_changedFirst(-1), m_changedLast(-1), m_updateDelay(UPDATE_DELAY)
+    , m_indexedRows(0), m_snapshotEnabled(false), m_workerPool(0)
 {
+    m_snapshotTimer.setSingleShot(true);
+    connect(&m_snapshotTimer, &QTimer::timeout,
+            this, &AbstractSocialCacheModelPrivate::saveSnapshot);
+    m_changedFieldsTimer.setSingleShot(true);
+    connect(&m_changedFieldsTimer, &QTimer::timeout,
+            this, &AbstractSocialCacheModelPrivate::flushChangedFields);
 }
 
 AbstractSocialCacheModelPrivate::~AbstractSocialCacheModelPrivate()
 {
-    if (m_workerThread.isRunning()) {
-        // tell worker object to quit gracefully.
+    if (m_snapshotTimer.isActive()) {
+        saveSnapshot();
+    }
+
+    if (m_workerObject) {
+        // tell worker object to quit gracefully, this closes the database.
         m_workerObject->m_quitMutex.lock();
         QMetaObject::invokeMethod(m_workerObject, "quitGracefully", Qt::QueuedConnection);
         m_workerObject->m_quitWC.wait(&m_workerObject->m_quitMutex);
         m_workerObject->m_quitMutex.unlock();
 
-        // now terminate the thread
-        m_workerThread.quit();
-        m_workerThread.wait();
+        // The thread is shared with other worker objects,
+        // so the worker object is deleted in its thread
+        m_workerPool->removeWorker(m_workerObject);
+        m_workerObject->deleteLater();
+        SocialCacheWorkerPool::release();
     }
-
-    // and delete the worker object - this will ensure the database gets closed.
-    delete m_workerObject;
 }
 
 void AbstractSocialCacheModelPrivate::clearData()
 {
     Q_Q(AbstractSocialCacheModel);
+    m_changedFields.clear();
+    m_changedFieldsTimer.stop();
+    m_identifierRows.clear();
+    m_indexedRows = 0;
     if (m_data.count() > 0) {
         q->beginRemoveRows(QModelIndex(), 0, m_data.count() - 1);
         m_data.clear();
         q->endRemoveRows();
     }
+    m_pages.clear();
 }
 
 void AbstractSocialCacheModelPrivate::updateData(const SocialCacheModelData &data)
@@ -125,59 +468,540 @@ void AbstractSocialCacheModelPrivate::updateData(const SocialCacheModelData &dat
     q->updateData(data);
 }
 
+void AbstractSocialCacheModelPrivate::updateDelta(const SocialCacheModelDelta &delta)
+{
+    Q_Q(AbstractSocialCacheModel);
+    q->updateDelta(delta);
+}
+
 void AbstractSocialCacheModelPrivate::updateRow(int row, const SocialCacheModelRow &data)
 {
     Q_Q(AbstractSocialCacheModel);
     q->updateRow(row, data);
 }
 
+// Materialize the rows fetched in lazy mode
+//
+// Rows are matched with their identifier, since they might have
+// moved since they were requested. Rows that could not be fetched
+// only contain their identifier, and are not materialized.
+void AbstractSocialCacheModelPrivate::updateRows(int index, const SocialCacheModelData &rows)
+{
+    m_pendingPages.remove(index / PAGE_SIZE);
+
+    for (int i = 0; i < rows.count(); ++i) {
+        const SocialCacheModelRow &rowData = rows.at(i);
+        if (rowData.count() <= 1) {
+            continue;
+        }
+
+        int row = index + i;
+        const QVariant identifier = rowData.value(0);
+        if (row >= m_data.count() || m_data.at(row).value(0) != identifier) {
+            row = identifierRow(identifier.toString());
+            if (row < 0) {
+                continue;
+            }
+        }
+
+        m_data[row] = storeRow(rowData);
+        fetchRow(row);
+        markChanged(row, row);
+    }
+
+    flushChanges();
+}
+
 void AbstractSocialCacheModelPrivate::initWorkerObject(AbstractWorkerObject *workerObjectToSet)
 {
     if (workerObjectToSet) {
-        m_workerThread.start(QThread::IdlePriority);
+        m_workerPool = SocialCacheWorkerPool::acquire();
         m_workerObject = workerObjectToSet;
-        m_workerObject->moveToThread(&m_workerThread);
+        m_workerPool->addWorker(m_workerObject);
         connect(this, &AbstractSocialCacheModelPrivate::nodeIdentifierChanged,
                 m_workerObject, &AbstractWorkerObject::setNodeIdentifier);
         connect(this, &AbstractSocialCacheModelPrivate::refreshRequested,
                 m_workerObject, &AbstractWorkerObject::triggerRefresh);
         connect(m_workerObject, &AbstractWorkerObject::dataUpdated,
                 this, &AbstractSocialCacheModelPrivate::updateData);
+        connect(m_workerObject, &AbstractWorkerObject::deltaUpdated,
+                this, &AbstractSocialCacheModelPrivate::updateDelta);
         connect(m_workerObject, &AbstractWorkerObject::rowUpdated,
                 this, &AbstractSocialCacheModelPrivate::updateRow);
+        connect(this, &AbstractSocialCacheModelPrivate::lazyChanged,
+                m_workerObject, &AbstractWorkerObject::setLazy);
+        connect(this, &AbstractSocialCacheModelPrivate::visibleChanged,
+                m_workerObject, &AbstractWorkerObject::setVisible);
+        connect(this, &AbstractSocialCacheModelPrivate::queryChanged,
+                m_workerObject, &AbstractWorkerObject::setQuery);
+        connect(this, &AbstractSocialCacheModelPrivate::rowsRequested,
+                m_workerObject, &AbstractWorkerObject::fetchRows);
+        connect(m_workerObject, &AbstractWorkerObject::rowsFetched,
+                this, &AbstractSocialCacheModelPrivate::updateRows);
+    }
+
+}
+
+void AbstractSocialCacheModelPrivate::fieldAccessed(int row, int role) const
+{
+    Q_UNUSED(row)
+    Q_UNUSED(role)
+}
+
+bool AbstractSocialCacheModelPrivate::isLazySupported() const
+{
+    return false;
+}
+
+bool AbstractSocialCacheModelPrivate::isLazyActive() const
+{
+    return m_lazy && isLazySupported();
+}
+
+// In lazy mode, rows that only contain their identifier are not materialized
+bool AbstractSocialCacheModelPrivate::isMaterialized(int row) const
+{
+    return !isLazyActive() || m_data.at(row).count() > 1;
+}
+
+// Called when a row is read in lazy mode
+//
+// The page of the row is fetched if needed. The next page, or the
+// previous one, depending on the half of the page the row is in, is
+// read ahead, so that rows are usually there before they are read.
+void AbstractSocialCacheModelPrivate::fetchRow(int row)
+{
+    const int page = row / PAGE_SIZE;
+    if (isMaterialized(row)) {
+        int index = m_pages.lastIndexOf(page);
+        if (index < 0) {
+            m_pages.append(page);
+            evictPages();
+        } else if (index != m_pages.count() - 1) {
+            m_pages.move(index, m_pages.count() - 1);
+        }
+        return;
+    }
+
+    requestPage(page);
+    if (row % PAGE_SIZE >= PAGE_SIZE / 2) {
+        requestPage(page + 1);
+    } else if (page > 0) {
+        requestPage(page - 1);
+    }
+}
+
+// Request the rows of a page that are not materialized
+bool AbstractSocialCacheModelPrivate::requestPage(int page)
+{
+    if (page < 0 || page * PAGE_SIZE >= m_data.count() || m_pendingPages.contains(page)) {
+        return false;
+    }
+
+    // Rows in between missing rows are fetched again, to request a single range
+    int first = -1;
+    int last = -1;
+    const int end = qMin((page + 1) * PAGE_SIZE, m_data.count());
+    for (int row = page * PAGE_SIZE; row < end; ++row) {
+        if (!isMaterialized(row)) {
+            if (first < 0) {
+                first = row;
+            }
+            last = row;
+        }
+    }
+
+    if (first < 0) {
+        return false;
     }
 
+    QStringList identifiers;
+    identifiers.reserve(last - first + 1);
+    for (int row = first; row <= last; ++row) {
+        identifiers.append(m_data.at(row).value(0).toString());
+    }
+
+    m_pendingPages.insert(page);
+    emit rowsRequested(first, identifiers);
+    return true;
+}
+
+// First page after the most recently used one that is
+// neither materialized nor requested, or -1
+int AbstractSocialCacheModelPrivate::nextPage() const
+{
+    const int pageCount = (m_data.count() + PAGE_SIZE - 1) / PAGE_SIZE;
+    for (int page = m_pages.isEmpty() ? 0 : m_pages.last() + 1; page < pageCount; ++page) {
+        if (!m_pendingPages.contains(page) && !m_pages.contains(page)) {
+            return page;
+        }
+    }
+    return -1;
+}
+
+// Track the pages again after rows were inserted, removed or moved
+//
+// The order in which the pages were used is lost, but the
+// number of materialized rows stays bounded.
+void AbstractSocialCacheModelPrivate::resetPages()
+{
+    m_pages.clear();
+    if (!isLazyActive()) {
+        return;
+    }
+
+    for (int row = 0; row < m_data.count(); ++row) {
+        if (isMaterialized(row)) {
+            const int page = row / PAGE_SIZE;
+            if (m_pages.isEmpty() || m_pages.last() != page) {
+                m_pages.append(page);
+            }
+        }
+    }
+
+    evictPages();
+}
+
+// Only keep the identifier of the rows of the least recently used pages
+void AbstractSocialCacheModelPrivate::evictPages()
+{
+    while (m_pages.count() > MAXIMUM_PAGES) {
+        const int page = m_pages.takeFirst();
+        const int last = qMin((page + 1) * PAGE_SIZE, m_data.count());
+        for (int row = page * PAGE_SIZE; row < last; ++row) {
+            if (isMaterialized(row)) {
+                // Resizing a vector does not release its memory
+                m_data[row] = SocialCacheModelStoredRow(1, m_data.at(row).value(0));
+            }
+        }
+    }
 }
 
+// Rows are inserted, removed and moved in place. Insertions at
+// the beginning or at the end of the list are amortized.
 void AbstractSocialCacheModelPrivate::insertRange(
         int index, int count, const SocialCacheModelData &source, int sourceIndex)
 {
     Q_Q(AbstractSocialCacheModel);
 
-    q->beginInsertRows(QModelIndex(), index, index + count - 1);
-    m_data = m_data.mid(0, index) + source.mid(sourceIndex, count) + m_data.mid(index);
-    q->endInsertRows();
+    flushChanges();
+    if (!m_resetting) {
+        q->beginInsertRows(QModelIndex(), index, index + count - 1);
+    }
+
+    const int oldCount = m_data.count();
+    m_indexedRows = qMin(m_indexedRows, index);
+    m_data.reserve(oldCount + count);
+    if (index == 0) {
+        for (int i = count - 1; i >= 0; --i) {
+            m_data.prepend(storeRow(source.at(sourceIndex + i)));
+        }
+    } else {
+        for (int i = 0; i < count; ++i) {
+            m_data.append(storeRow(source.at(sourceIndex + i)));
+        }
+        if (index < oldCount) {
+            std::rotate(m_data.begin() + index, m_data.begin() + oldCount, m_data.end());
+        }
+    }
+
+    if (!m_resetting) {
+        q->endInsertRows();
+    }
 }
 
 void AbstractSocialCacheModelPrivate::removeRange(int index, int count)
 {
     Q_Q(AbstractSocialCacheModel);
 
-    q->beginRemoveRows(QModelIndex(), index, index + count - 1);
-    m_data = m_data.mid(0, index) + m_data.mid(index + count);
-    q->endRemoveRows();
+    flushChanges();
+    if (!m_resetting) {
+        q->beginRemoveRows(QModelIndex(), index, index + count - 1);
+    }
+
+    if (!m_identifierRows.isEmpty()) {
+        for (int i = index; i < index + count; ++i) {
+            m_identifierRows.remove(m_data.at(i).value(0).toString());
+        }
+    }
+    m_indexedRows = qMin(m_indexedRows, index);
+    m_data.erase(m_data.begin() + index, m_data.begin() + index + count);
+
+    if (!m_resetting) {
+        q->endRemoveRows();
+    }
+}
+
+void AbstractSocialCacheModelPrivate::moveRange(int index, int count, int destination)
+{
+    Q_Q(AbstractSocialCacheModel);
+
+    flushChanges();
+    if (!m_resetting) {
+        q->beginMoveRows(QModelIndex(), index, index + count - 1, QModelIndex(), destination);
+    }
+
+    m_indexedRows = qMin(m_indexedRows, qMin(index, destination));
+    if (destination > index) {
+        std::rotate(m_data.begin() + index, m_data.begin() + index + count,
+                    m_data.begin() + destination);
+    } else {
+        std::rotate(m_data.begin() + destination, m_data.begin() + index,
+                    m_data.begin() + index + count);
+    }
+
+    if (!m_resetting) {
+        q->endMoveRows();
+    }
 }
 
 void AbstractSocialCacheModelPrivate::updateRange(
         int index, int count, const SocialCacheModelData &source, int sourceIndex)
+{
+    for  (int i = 0; i < count; ++i) {
+        m_data[index + i] = storeRow(source.at(sourceIndex + i));
+    }
+
+    markChanged(index, index + count - 1);
+}
+
+// Changed rows are reported together when they are contiguous,
+// and before rows are inserted, removed or moved
+void AbstractSocialCacheModelPrivate::markChanged(int first, int last)
+{
+    if (m_resetting) {
+        return;
+    }
+
+    if (m_changedFirst >= 0 && first <= m_changedLast + 1 && last >= m_changedFirst - 1) {
+        m_changedFirst = qMin(m_changedFirst, first);
+        m_changedLast = qMax(m_changedLast, last);
+        return;
+    }
+
+    flushChanges();
+    m_changedFirst = first;
+    m_changedLast = last;
+}
+
+void AbstractSocialCacheModelPrivate::flushChanges()
 {
     Q_Q(AbstractSocialCacheModel);
+    flushChangedFields();
+    if (m_changedFirst < 0) {
+        return;
+    }
 
-    for  (int i = 0; i < count; ++i) {
-        m_data[index + i] = source[sourceIndex + i];
+    const int first = m_changedFirst;
+    const int last = m_changedLast;
+    m_changedFirst = -1;
+    m_changedLast = -1;
+    emit q->dataChanged(q->index(first), q->index(last));
+}
+
+void AbstractSocialCacheModelPrivate::markFieldChanged(int row, int role)
+{
+    if (m_resetting) {
+        return;
+    }
+
+    QVector<int> &roles = m_changedFields[row];
+    if (!roles.contains(role)) {
+        roles.append(role);
+    }
+
+    if (m_updateDelay <= 0) {
+        flushChangedFields();
+    } else if (!m_changedFieldsTimer.isActive()) {
+        m_changedFieldsTimer.start(m_updateDelay);
+    }
+}
+
+// Changed fields are reported as ranges of contiguous rows,
+// with the roles that changed, so that views only update the
+// bindings that use them.
+void AbstractSocialCacheModelPrivate::flushChangedFields()
+{
+    Q_Q(AbstractSocialCacheModel);
+    m_changedFieldsTimer.stop();
+    if (m_changedFields.isEmpty()) {
+        return;
+    }
+
+    QMap<int, QVector<int> > changedFields;
+    changedFields.swap(m_changedFields);
+
+    int first = -1;
+    int last = -1;
+    QVector<int> roles;
+    QMap<int, QVector<int> >::const_iterator i;
+    for (i = changedFields.constBegin(); i != changedFields.constEnd(); ++i) {
+        if (first >= 0 && i.key() == last + 1) {
+            last = i.key();
+            foreach (int role, i.value()) {
+                if (!roles.contains(role)) {
+                    roles.append(role);
+                }
+            }
+            continue;
+        }
+
+        if (first >= 0) {
+            emit q->dataChanged(q->index(first), q->index(last), roles);
+        }
+        first = i.key();
+        last = i.key();
+        roles = i.value();
+    }
+
+    emit q->dataChanged(q->index(first), q->index(last), roles);
+    scheduleSnapshot();
+}
+
+SocialCacheModelStoredRow AbstractSocialCacheModelPrivate::storeRow(const SocialCacheModelRow &row)
+{
+    SocialCacheModelStoredRow storedRow;
+    if (row.isEmpty() || row.lastKey() < 0) {
+        return storedRow;
+    }
+
+    storedRow.resize(row.lastKey() + 1);
+    for (SocialCacheModelRow::const_iterator i = row.constBegin(); i != row.constEnd(); ++i) {
+        // Negative roles are not stored
+        if (i.key() >= 0) {
+            storedRow[i.key()] = i.value();
+        }
+    }
+    return storedRow;
+}
+
+void AbstractSocialCacheModelPrivate::setField(int row, int role, const QVariant &value)
+{
+    if (role < 0) {
+        return;
+    }
+
+    SocialCacheModelStoredRow &storedRow = m_data[row];
+    if (role >= storedRow.count()) {
+        storedRow.resize(role + 1);
+    }
+    storedRow[role] = value;
+}
+
+// The rows of the identifiers are indexed in a hash, that is only
+// updated from the first row that changed when it is used. Rows
+// inserted, removed or moved only invalidate the rows after them.
+int AbstractSocialCacheModelPrivate::identifierRow(const QString &identifier)
+{
+    for (; m_indexedRows < m_data.count(); ++m_indexedRows) {
+        m_identifierRows.insert(m_data.at(m_indexedRows).value(0).toString(), m_indexedRows);
+    }
+
+    int row = m_identifierRows.value(identifier, -1);
+    if (row < 0 || row >= m_data.count() || m_data.at(row).value(0).toString() != identifier) {
+        return -1;
+    }
+    return row;
+}
+
+// Models of the same node that are sorted or filtered
+// differently do not share their snapshot
+QString AbstractSocialCacheModelPrivate::snapshotKey() const
+{
+    Q_Q(const AbstractSocialCacheModel);
+    QByteArray query;
+    QDataStream stream (&query, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << m_query.sortField << qint32(m_query.sortOrder) << m_query.filters;
+
+    QByteArray hash = QCryptographicHash::hash(query, QCryptographicHash::Md5);
+    return QString(QLatin1String("%1/%2/%3")).arg(QLatin1String(q->metaObject()->className()),
+                                                  nodeIdentifier, QLatin1String(hash.toHex()));
+}
+
+static QString snapshotPath(const QString &key)
+{
+    QByteArray hash = QCryptographicHash::hash(key.toUtf8(), QCryptographicHash::Md5);
+    return QString(QLatin1String("%1Snapshots/%2")).arg(PRIVILEGED_DATA_DIR,
+                                                       QLatin1String(hash.toHex()));
+}
+
+// The snapshot is memory-mapped, since it is read
+// before anything else is shown by the model.
+bool AbstractSocialCacheModelPrivate::loadSnapshot()
+{
+    Q_Q(AbstractSocialCacheModel);
+    const QString key = snapshotKey();
+    QFile file (snapshotPath(key));
+    if (!file.open(QIODevice::ReadOnly) || file.size() == 0) {
+        return false;
+    }
+
+    uchar *data = file.map(0, file.size());
+    if (!data) {
+        return false;
+    }
+
+    QByteArray bytes = QByteArray::fromRawData(reinterpret_cast<const char *>(data), file.size());
+    QDataStream stream (bytes);
+    stream.setVersion(QDataStream::Qt_5_0);
+
+    quint32 magic = 0;
+    quint32 version = 0;
+    QString storedKey;
+    QList<SocialCacheModelStoredRow> rows;
+    stream >> magic >> version;
+    if (magic == SNAPSHOT_MAGIC && version == SNAPSHOT_VERSION) {
+        stream >> storedKey >> rows;
+    }
+    file.unmap(data);
+
+    if (stream.status() != QDataStream::Ok || storedKey != key || rows.isEmpty()) {
+        return false;
+    }
+
+    q->beginInsertRows(QModelIndex(), 0, rows.count() - 1);
+    m_data = rows;
+    m_indexedRows = 0;
+    q->endInsertRows();
+    emit q->countChanged();
+    return true;
+}
+
+// The key is read when the snapshot is scheduled, since
+// the model might be destroyed when the snapshot is saved.
+void AbstractSocialCacheModelPrivate::scheduleSnapshot()
+{
+    // Search results are not kept
+    if (!m_snapshotEnabled || isLazyActive() || !m_query.search.isEmpty()) {
+        return;
+    }
+
+    m_snapshotKey = snapshotKey();
+    if (!m_snapshotTimer.isActive()) {
+        m_snapshotTimer.start(SNAPSHOT_DELAY);
+    }
+}
+
+void AbstractSocialCacheModelPrivate::saveSnapshot()
+{
+    m_snapshotTimer.stop();
+
+    const QString path = snapshotPath(m_snapshotKey);
+    QDir().mkpath(QFileInfo(path).absolutePath());
+
+    QSaveFile file (path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << Q_FUNC_INFO << "Failed to open snapshot" << path << file.errorString();
+        return;
     }
 
-    emit q->dataChanged(q->createIndex(index, 0), q->createIndex(index + count - 1, 0));
+    QDataStream stream (&file);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << SNAPSHOT_MAGIC << SNAPSHOT_VERSION << m_snapshotKey << m_data;
+    if (!file.commit()) {
+        qWarning() << Q_FUNC_INFO << "Failed to write snapshot" << path << file.errorString();
+    }
 }
 
 AbstractSocialCacheModel::AbstractSocialCacheModel(AbstractSocialCacheModelPrivate &dd,
@@ -210,9 +1034,35 @@ QVariant AbstractSocialCacheModel::getField(int row, int role) const
         return QVariant();
     }
 
+    d->fieldAccessed(row, role);
+    if (d->isLazyActive()) {
+        const_cast<AbstractSocialCacheModelPrivate *>(d)->fetchRow(row);
+    }
     return d->m_data.at(row).value(role);
 }
 
+// In lazy mode, fetching more materializes the page following
+// the most recently used one, for views that read rows in order
+bool AbstractSocialCacheModel::canFetchMore(const QModelIndex &parent) const
+{
+    Q_D(const AbstractSocialCacheModel);
+    if (parent.isValid() || !d->isLazyActive()) {
+        return false;
+    }
+
+    return d->nextPage() >= 0;
+}
+
+void AbstractSocialCacheModel::fetchMore(const QModelIndex &parent)
+{
+    Q_D(AbstractSocialCacheModel);
+    if (parent.isValid() || !d->isLazyActive()) {
+        return;
+    }
+
+    d->requestPage(d->nextPage());
+}
+
 QString AbstractSocialCacheModel::nodeIdentifier() const
 {
     Q_D(const AbstractSocialCacheModel);
@@ -234,31 +1084,293 @@ int AbstractSocialCacheModel::count() const
     return rowCount();
 }
 
+bool AbstractSocialCacheModel::isLazy() const
+{
+    Q_D(const AbstractSocialCacheModel);
+    return d->m_lazy;
+}
+
+// In lazy mode, the model only holds the identifiers of the rows, and
+// fetches the other fields by pages, when they are read. It is only
+// supported by some models, like the images of FacebookImageCacheModel.
+void AbstractSocialCacheModel::setLazy(bool lazy)
+{
+    Q_D(AbstractSocialCacheModel);
+    if (d->m_lazy != lazy) {
+        d->m_lazy = lazy;
+        d->m_snapshotTimer.stop();
+        d->m_pendingPages.clear();
+        d->resetPages();
+        emit lazyChanged();
+        emit d->lazyChanged(lazy);
+
+        // Rows should be reported again
+        if (!d->m_data.isEmpty()) {
+            refresh();
+        }
+    }
+}
+
+bool AbstractSocialCacheModel::isVisible() const
+{
+    Q_D(const AbstractSocialCacheModel);
+    return d->m_visible;
+}
+
+// Models that are not visible are refreshed when they are
+// visible again, so that visible models are refreshed first.
+void AbstractSocialCacheModel::setVisible(bool visible)
+{
+    Q_D(AbstractSocialCacheModel);
+    if (d->m_visible != visible) {
+        d->m_visible = visible;
+        emit visibleChanged();
+        emit d->visibleChanged(visible);
+    }
+}
+
+QString AbstractSocialCacheModel::sortField() const
+{
+    Q_D(const AbstractSocialCacheModel);
+    return d->m_query.sortField;
+}
+
+// Rows are sorted and filtered by the queries of the database. The
+// fields that can be used depend on the model, and an empty sort
+// field selects the default order of the model.
+void AbstractSocialCacheModel::setSortField(const QString &sortField)
+{
+    Q_D(AbstractSocialCacheModel);
+    if (d->m_query.sortField != sortField) {
+        d->m_query.sortField = sortField;
+        emit sortFieldChanged();
+        updateQuery();
+    }
+}
+
+Qt::SortOrder AbstractSocialCacheModel::sortOrder() const
+{
+    Q_D(const AbstractSocialCacheModel);
+    return d->m_query.sortOrder;
+}
+
+void AbstractSocialCacheModel::setSortOrder(Qt::SortOrder sortOrder)
+{
+    Q_D(AbstractSocialCacheModel);
+    if (d->m_query.sortOrder != sortOrder) {
+        d->m_query.sortOrder = sortOrder;
+        emit sortOrderChanged();
+        updateQuery();
+    }
+}
+
+QVariantMap AbstractSocialCacheModel::filters() const
+{
+    Q_D(const AbstractSocialCacheModel);
+    return d->m_query.filters;
+}
+
+// Filters map fields to a value, a list of values, or
+// a range given as a map with "from" and "to" values.
+void AbstractSocialCacheModel::setFilters(const QVariantMap &filters)
+{
+    Q_D(AbstractSocialCacheModel);
+    if (d->m_query.filters != filters) {
+        d->m_query.filters = filters;
+        emit filtersChanged();
+        updateQuery();
+    }
+}
+
+QString AbstractSocialCacheModel::searchText() const
+{
+    Q_D(const AbstractSocialCacheModel);
+    return d->m_query.search;
+}
+
+// Models with a search index only show the rows matching
+// the words of the search text, ranked by relevance.
+void AbstractSocialCacheModel::setSearchText(const QString &searchText)
+{
+    Q_D(AbstractSocialCacheModel);
+    if (d->m_query.search != searchText) {
+        d->m_query.search = searchText;
+        emit searchTextChanged();
+        updateQuery();
+    }
+}
+
+void AbstractSocialCacheModel::updateQuery()
+{
+    Q_D(AbstractSocialCacheModel);
+    emit d->queryChanged(d->m_query.sortField, d->m_query.sortOrder, d->m_query.filters,
+                         d->m_query.search);
+
+    // Rows should be read again, even if no row matched the previous query
+    if (d->m_refreshed) {
+        refresh();
+    }
+}
+
+bool AbstractSocialCacheModel::isSnapshotEnabled() const
+{
+    Q_D(const AbstractSocialCacheModel);
+    return d->m_snapshotEnabled;
+}
+
+// If enabled, the rows are saved in a snapshot, that is
+// shown when the model is refreshed for the first time.
+void AbstractSocialCacheModel::setSnapshotEnabled(bool snapshotEnabled)
+{
+    Q_D(AbstractSocialCacheModel);
+    if (d->m_snapshotEnabled != snapshotEnabled) {
+        d->m_snapshotEnabled = snapshotEnabled;
+        if (!snapshotEnabled) {
+            d->m_snapshotTimer.stop();
+        }
+        emit snapshotEnabledChanged();
+    }
+}
+
+int AbstractSocialCacheModel::updateDelay() const
+{
+    Q_D(const AbstractSocialCacheModel);
+    return d->m_updateDelay;
+}
+
+// Fields changed by downloads and by updateRow are reported
+// together, at most updateDelay milliseconds after their change.
+// With a delay of 0, they are reported immediately.
+void AbstractSocialCacheModel::setUpdateDelay(int updateDelay)
+{
+    Q_D(AbstractSocialCacheModel);
+    if (d->m_updateDelay != updateDelay) {
+        d->m_updateDelay = updateDelay;
+        if (updateDelay <= 0) {
+            d->flushChangedFields();
+        }
+        emit updateDelayChanged();
+    }
+}
+
+// The changes between the rows of the model and the new
+// rows are applied like the changes of an incremental refresh
 void AbstractSocialCacheModel::updateData(const SocialCacheModelData &data)
 {
     Q_D(AbstractSocialCacheModel);
 
+    SocialCacheModelDataAgent agent;
+    synchronizeList(&agent, d->m_data, data);
+    updateDelta(agent.delta);
+}
+
+// Check that a change can be applied to a model with rowCount rows
+//
+// Moves have the same constraints as QAbstractItemModel::beginMoveRows,
+// and inserted or updated rows must all be provided.
+static bool isValidChange(const SocialCacheModelChange &change, int rowCount)
+{
+    int last = change.type == SocialCacheModelChange::Insert
+            ? change.index : change.index + change.count;
+    if (change.count <= 0 || change.index < 0 || last > rowCount) {
+        return false;
+    }
+
+    switch (change.type) {
+    case SocialCacheModelChange::Insert:
+    case SocialCacheModelChange::Update:
+        return change.rows.count() >= change.count;
+    case SocialCacheModelChange::Move:
+        return change.destination >= 0 && change.destination <= rowCount
+                && (change.destination < change.index
+                    || change.destination > change.index + change.count);
+    default:
+        return true;
+    }
+}
+
+// Apply the changes reported by an incremental refresh
+void AbstractSocialCacheModel::updateDelta(const SocialCacheModelDelta &delta)
+{
+    Q_D(AbstractSocialCacheModel);
+
     const int count = d->m_data.count();
+    int structureChanges = 0;
+    foreach (const SocialCacheModelChange &change, delta) {
+        if (change.type != SocialCacheModelChange::Update) {
+            ++structureChanges;
+        }
+    }
 
-    synchronizeList(d, d->m_data, data);
+    const bool reset = structureChanges > RESET_THRESHOLD;
+    if (reset) {
+        d->flushChanges();
+        beginResetModel();
+        d->m_resetting = true;
+    }
+
+    foreach (const SocialCacheModelChange &change, delta) {
+        if (!isValidChange(change, d->m_data.count())) {
+            qWarning() << Q_FUNC_INFO << "Invalid change" << change.type << change.index
+                       << change.count;
+            continue;
+        }
+
+        switch (change.type) {
+        case SocialCacheModelChange::Insert:
+            d->insertRange(change.index, change.count, change.rows, 0);
+            break;
+        case SocialCacheModelChange::Remove:
+            d->removeRange(change.index, change.count);
+            break;
+        case SocialCacheModelChange::Move:
+            d->moveRange(change.index, change.count, change.destination);
+            break;
+        case SocialCacheModelChange::Update:
+            d->updateRange(change.index, change.count, change.rows, 0);
+            break;
+        }
+    }
+
+    d->flushChanges();
+    if (reset) {
+        d->m_resetting = false;
+        endResetModel();
+    }
+
+    if (structureChanges > 0) {
+        d->resetPages();
+    }
 
     if (d->m_data.count() != count) {
         emit countChanged();
     }
+    d->scheduleSnapshot();
     emit modelUpdated();
 }
 
 void AbstractSocialCacheModel::updateRow(int row, const SocialCacheModelRow &data)
 {
     Q_D(AbstractSocialCacheModel);
-    foreach (int key, data.keys()) {
-        d->m_data[row].insert(key, data.value(key));
+    if (row < 0 || row >= d->m_data.count()) {
+        return;
+    }
+
+    for (SocialCacheModelRow::const_iterator i = data.constBegin(); i != data.constEnd(); ++i) {
+        d->setField(row, i.key(), i.value());
+        d->markFieldChanged(row, i.key());
     }
-    emit dataChanged(index(row), index(row));
 }
 
+// The rows saved in the snapshot are shown until the
+// database is read, and are then updated like other rows.
 void AbstractSocialCacheModel::refresh()
 {
     Q_D(AbstractSocialCacheModel);
+    if (d->m_snapshotEnabled && d->m_data.isEmpty() && !d->isLazyActive()
+        && d->m_query.search.isEmpty()) {
+        d->loadSnapshot();
+    }
+    d->m_refreshed = true;
     emit d->refreshRequested();
 }
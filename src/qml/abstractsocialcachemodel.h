@@ -21,10 +21,35 @@
 #define ABSTRACTSOCIALCACHEMODEL_H
 
 #include <QtCore/QAbstractListModel>
+#include <QtCore/QVariantMap>
 
 typedef QMap<int, QVariant> SocialCacheModelRow;
 typedef QList<SocialCacheModelRow> SocialCacheModelData;
 
+// A change to apply to the rows of a model
+//
+// Rows are inserted before index, or are removed, moved before
+// destination or updated starting from index. Inserted and
+// updated rows are provided in rows.
+struct SocialCacheModelChange
+{
+    enum Type {
+        Insert,
+        Remove,
+        Move,
+        Update
+    };
+
+    SocialCacheModelChange() : type(Update), index(0), count(0), destination(0) {}
+
+    Type type;
+    int index;
+    int count;
+    int destination;
+    SocialCacheModelData rows;
+};
+typedef QList<SocialCacheModelChange> SocialCacheModelDelta;
+
 class AbstractSocialCacheModelPrivate;
 class AbstractSocialCacheModel : public QAbstractListModel
 {
@@ -32,6 +57,15 @@ class AbstractSocialCacheModel : public QAbstractListModel
     Q_PROPERTY(QString nodeIdentifier READ nodeIdentifier WRITE setNodeIdentifier
                NOTIFY nodeIdentifierChanged)
     Q_PROPERTY(int count READ count NOTIFY countChanged)
+    Q_PROPERTY(bool lazy READ isLazy WRITE setLazy NOTIFY lazyChanged)
+    Q_PROPERTY(bool visible READ isVisible WRITE setVisible NOTIFY visibleChanged)
+    Q_PROPERTY(QString sortField READ sortField WRITE setSortField NOTIFY sortFieldChanged)
+    Q_PROPERTY(Qt::SortOrder sortOrder READ sortOrder WRITE setSortOrder NOTIFY sortOrderChanged)
+    Q_PROPERTY(QVariantMap filters READ filters WRITE setFilters NOTIFY filtersChanged)
+    Q_PROPERTY(QString searchText READ searchText WRITE setSearchText NOTIFY searchTextChanged)
+    Q_PROPERTY(bool snapshotEnabled READ isSnapshotEnabled WRITE setSnapshotEnabled
+               NOTIFY snapshotEnabledChanged)
+    Q_PROPERTY(int updateDelay READ updateDelay WRITE setUpdateDelay NOTIFY updateDelayChanged)
 
 public:
     virtual ~AbstractSocialCacheModel();
@@ -39,14 +73,33 @@ public:
     int rowCount(const QModelIndex &parent = QModelIndex()) const;
     QVariant data(const QModelIndex &index, int role) const;
     Q_INVOKABLE QVariant getField(int row, int role) const;
+    bool canFetchMore(const QModelIndex &parent) const;
+    void fetchMore(const QModelIndex &parent);
 
     // properties
     QString nodeIdentifier() const;
     void setNodeIdentifier(const QString &nodeIdentifier);
     int count() const;
+    bool isLazy() const;
+    void setLazy(bool lazy);
+    bool isVisible() const;
+    void setVisible(bool visible);
+    QString sortField() const;
+    void setSortField(const QString &sortField);
+    Qt::SortOrder sortOrder() const;
+    void setSortOrder(Qt::SortOrder sortOrder);
+    QVariantMap filters() const;
+    void setFilters(const QVariantMap &filters);
+    QString searchText() const;
+    void setSearchText(const QString &searchText);
+    bool isSnapshotEnabled() const;
+    void setSnapshotEnabled(bool snapshotEnabled);
+    int updateDelay() const;
+    void setUpdateDelay(int updateDelay);
 
     // Methods used to update the model in the C++ side
     void updateData(const SocialCacheModelData &data);
+    void updateDelta(const SocialCacheModelDelta &delta);
     void updateRow(int row, const SocialCacheModelRow &data);
 
 public Q_SLOTS:
@@ -55,6 +108,14 @@ public Q_SLOTS:
 Q_SIGNALS:
     void nodeIdentifierChanged();
     void countChanged();
+    void lazyChanged();
+    void visibleChanged();
+    void sortFieldChanged();
+    void sortOrderChanged();
+    void filtersChanged();
+    void searchTextChanged();
+    void snapshotEnabledChanged();
+    void updateDelayChanged();
     void modelUpdated();
 
 protected:
@@ -62,10 +123,12 @@ protected:
     QScopedPointer<AbstractSocialCacheModelPrivate> d_ptr;
 
 private:
+    void updateQuery();
     Q_DECLARE_PRIVATE(AbstractSocialCacheModel)
 };
 
 Q_DECLARE_METATYPE(SocialCacheModelRow)
 Q_DECLARE_METATYPE(SocialCacheModelData)
+Q_DECLARE_METATYPE(SocialCacheModelDelta)
 
 #endif // ABSTRACTSOCIALCACHEMODEL_H
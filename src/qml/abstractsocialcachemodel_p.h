@@ -21,11 +21,26 @@
 #define ABSTRACTSOCIALCACHEMODEL_P_H
 
 #include "abstractsocialcachemodel.h"
+#include "abstractsocialcachedatabase.h"
 
 #include <QtCore/QThread>
+#include <QtCore/QHash>
+#include <QtCore/QMap>
 #include <QtCore/QMutex>
+#include <QtCore/QSet>
+#include <QtCore/QStringList>
+#include <QtCore/QTimer>
+#include <QtCore/QVector>
 #include <QtCore/QWaitCondition>
 
+// Rows are stored by the model as vectors of fields indexed by role,
+// since the roles of the models are small consecutive integers.
+// A row is a single allocation, and a field is read in constant time.
+typedef QVector<QVariant> SocialCacheModelStoredRow;
+
+class AbstractSocialCacheDatabase;
+class SocialCacheDatabaseWatcher;
+class SocialCacheWorkerPool;
 class AbstractSocialCacheModel;
 class AbstractSocialCacheModelPrivate;
 class AbstractWorkerObject: public QObject
@@ -42,16 +57,42 @@ public Q_SLOTS:
     // or trigger task for the object
     void triggerRefresh();
     void setNodeIdentifier(const QString &nodeIdentifierToSet);
+    void setLazy(bool lazy);
+    // Refreshes of models that are not visible are
+    // delayed until they are visible again
+    void setVisible(bool visible);
+    void setQuery(const QString &sortField, int sortOrder, const QVariantMap &filters,
+                  const QString &search);
+    // Reimplement to support the lazy mode, by reporting
+    // the rows with the given identifiers with rowsFetched
+    virtual void fetchRows(int index, const QStringList &identifiers);
 
 Q_SIGNALS:
     // Signals are used to signal the model
     // that new data arrived
     void dataUpdated(const SocialCacheModelData &data);
+    void deltaUpdated(const SocialCacheModelDelta &delta);
     void rowUpdated(int row, const SocialCacheModelRow &data);
+    void rowsFetched(int index, const SocialCacheModelData &rows);
 
 protected:
     QString nodeIdentifier; // Matches the node identifier in ASCMP
     void setLoading(bool loading);
+    // In lazy mode, reported rows only need to contain their
+    // identifier, and other fields are fetched with fetchRows.
+    bool isLazy() const;
+    // Sorting and filtering of the rows, that should be
+    // applied by the queries of the database.
+    const SocialCacheQuery &query() const;
+    // Report the data to the model. Once data is reported,
+    // only the changes need to be reported with emitDelta.
+    void emitData(const SocialCacheModelData &data);
+    bool emitDelta(const QStringList &identifiers, const SocialCacheModelData &changedRows);
+    bool hasEmittedData() const;
+    void resetEmittedData();
+    // Refresh when one of the tables of the database changes.
+    // The database should be initialized.
+    void watchDatabase(AbstractSocialCacheDatabase *database, const QStringList &tables);
     // Reimplement to perform model refreshing operation
     virtual void refresh() = 0;
 
@@ -62,9 +103,22 @@ public:
     QMutex m_quitMutex;
     QWaitCondition m_quitWC;
 
+private Q_SLOTS:
+    void databaseTableChanged(const QString &table);
+    void databaseChanged();
+
 private:
+    SocialCacheDatabaseWatcher *m_watcher;
+    QStringList m_watchedTables;
+    bool m_watchedTablesChanged;
     bool m_loading;
+    bool m_lazy;
+    bool m_visible;
+    bool m_refreshPending;
+    SocialCacheQuery m_query;
     QMutex m_mutex;
+    bool m_emitted;
+    QStringList m_identifiers;
 };
 
 class AbstractSocialCacheModelPrivate: public QObject
@@ -78,15 +132,48 @@ public:
     void insertRange(int index, int count, const SocialCacheModelData &source, int sourceIndex);
     void updateRange(int index, int count, const SocialCacheModelData &source, int sourceIndex);
     void removeRange(int index, int count);
+    void moveRange(int index, int count, int destination);
+
+    void markChanged(int first, int last);
+    void flushChanges();
+    // Fields changed outside of refreshes are reported
+    // together, at most updateDelay milliseconds later.
+    void markFieldChanged(int row, int role);
+
+    static SocialCacheModelStoredRow storeRow(const SocialCacheModelRow &row);
+    void setField(int row, int role, const QVariant &value);
+    // Returns the row with an identifier, or -1
+    int identifierRow(const QString &identifier);
+
+    // Snapshots
+    bool loadSnapshot();
+    void scheduleSnapshot();
+
+    // Lazy mode
+    bool isMaterialized(int row) const;
+    void fetchRow(int row);
+    bool requestPage(int page);
+    int nextPage() const;
+    void resetPages();
+    void evictPages();
 
 public Q_SLOTS:
     void clearData();
     void updateData(const SocialCacheModelData &data);
+    void updateDelta(const SocialCacheModelDelta &delta);
     void updateRow(int row, const SocialCacheModelRow &data);
+    void updateRows(int index, const SocialCacheModelData &rows);
+    void flushChangedFields();
+    void saveSnapshot();
 
 Q_SIGNALS:
     void nodeIdentifierChanged(const QString &nodeIdentifier);
     void refreshRequested();
+    void lazyChanged(bool lazy);
+    void visibleChanged(bool visible);
+    void queryChanged(const QString &sortField, int sortOrder, const QVariantMap &filters,
+                      const QString &search);
+    void rowsRequested(int index, const QStringList &identifiers);
 
 protected:
     explicit AbstractSocialCacheModelPrivate(AbstractSocialCacheModel *q,
@@ -96,11 +183,37 @@ protected:
     // as it is unsafe to call it in private class
     // constructors.
     virtual void initWorkerObject(AbstractWorkerObject *workerObjectToSet);
-    QList<QMap<int, QVariant> > m_data;
+    // Called when a field is served by the model
+    // implement if needed, for example to track accesses.
+    virtual void fieldAccessed(int row, int role) const;
+    // Reimplement if the worker object supports the lazy mode
+    virtual bool isLazySupported() const;
+    // Identifies the snapshot of the rows, reimplement if the rows
+    // depend on other properties than the node identifier.
+    virtual QString snapshotKey() const;
+    bool isLazyActive() const;
+    QList<SocialCacheModelStoredRow> m_data;
     AbstractWorkerObject *m_workerObject;
     AbstractSocialCacheModel * const q_ptr;
+    bool m_lazy;
+    bool m_visible;
+    bool m_refreshed; // Rows were requested, and are read again when the query changes
+    bool m_resetting; // Rows are changed without signals during a reset
+    int m_changedFirst;
+    int m_changedLast;
+    QList<int> m_pages; // Materialized pages, the least recently used first
+    QSet<int> m_pendingPages;
+    QMap<int, QVector<int> > m_changedFields; // Changed roles, by row
+    QTimer m_changedFieldsTimer;
+    int m_updateDelay;
+    QHash<QString, int> m_identifierRows;
+    int m_indexedRows; // Rows before it are in m_identifierRows
+    SocialCacheQuery m_query;
+    bool m_snapshotEnabled;
+    QString m_snapshotKey; // Key of the rows to save
+    QTimer m_snapshotTimer;
 private:
-    QThread m_workerThread;
+    SocialCacheWorkerPool *m_workerPool;
     Q_DECLARE_PUBLIC(AbstractSocialCacheModel)
 };
 
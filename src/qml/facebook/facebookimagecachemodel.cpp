@@ -24,8 +24,11 @@
 #include "facebookimagedownloader_p.h"
 #include "facebookimagedownloaderconstants_p.h"
 
+#include <QtCore/QPointer>
 #include <QtCore/QThread>
 #include <QtCore/QStandardPaths>
+#include <QtCore/QSet>
+#include <QtCore/QTimer>
 
 #include <QtDebug>
 
@@ -40,7 +43,9 @@ static const char *PHOTO_USER_PREFIX = "user-";
 static const char *PHOTO_ALBUM_PREFIX = "album-";
 
 static const char *URL_KEY = "url";
-static const char *ROW_KEY = "row";
+
+// Accesses to images are reported to the downloader in batches
+static const int ACCESS_FLUSH_INTERVAL = 5000;
 
 #define SOCIALCACHE_FACEBOOK_IMAGE_DIR   PRIVILEGED_DATA_DIR + QLatin1String("/Images/")
 
@@ -55,12 +60,14 @@ public:
 
     void refresh();
     void finalCleanup();
+    QString requester() const;
 
 public Q_SLOTS:
     void setType(int typeToSet);
     void queueImages();
-    void queueImageThumbnail(int row, const FacebookImage::ConstPtr &image);
-    void queueImageFull(int row, const FacebookImage::ConstPtr &image);
+    void queueImageThumbnail(const FacebookImage::ConstPtr &image);
+    void queueImageFull(const FacebookImage::ConstPtr &image);
+    void fetchRows(int index, const QStringList &identifiers);
 
 Q_SIGNALS:
     void requestQueue(const QString &url, const QVariantMap &metadata);
@@ -69,12 +76,17 @@ protected:
     FacebookImageCacheModel::ModelDataType type;
 
 private:
-    void queue(int row,
-               FacebookImageDownloaderWorkerObject::ImageType imageType, const QString &identifier,
-               const QString &url);
+    void refreshImages();
+    SocialCacheModelRow imageRow(const FacebookImage::ConstPtr &image, int atlasSlot,
+                                 int atlasGeneration);
+    SocialCacheModelRow identityRow(const QString &fbImageId) const;
+    void queue(FacebookImageDownloaderWorkerObject::ImageType imageType, const QString &identifier,
+               const QString &url, const QString &thumbnailUrl = QString());
 
     bool m_enabled;
-    QList<QPair<FacebookImage::ConstPtr, int> > m_fullImages;
+    const QString m_requester;
+    QList<FacebookImage::ConstPtr> m_fullImages;
+    qint64 m_watermark;
 };
 
 class FacebookImageCacheModelPrivate: public AbstractSocialCacheModelPrivate
@@ -83,12 +95,15 @@ class FacebookImageCacheModelPrivate: public AbstractSocialCacheModelPrivate
 
 public:
     explicit FacebookImageCacheModelPrivate(FacebookImageCacheModel *q);
+    ~FacebookImageCacheModelPrivate();
     FacebookImageCacheModel::ModelDataType type;
-    FacebookImageDownloader *downloader;
+    QPointer<FacebookImageDownloader> downloader;
 
 public Q_SLOTS:
     void queue(const QString &url, const QVariantMap &metadata);
-    void slotDataUpdated(const QString &url, const QString &path);
+    void slotDataUpdated(const QString &url, const QString &path, const QVariantMap &metadata);
+    void flushAccessedImages();
+    void cancelDownloads();
 
 Q_SIGNALS:
     void typeChanged(int type);
@@ -96,9 +111,15 @@ Q_SIGNALS:
 
 protected:
     void initWorkerObject(AbstractWorkerObject *workerObject);
+    void fieldAccessed(int row, int role) const;
+    bool isLazySupported() const;
+    QString snapshotKey() const;
 
 private:
+    QString m_requester;
     QHash<QString, QVariantMap> m_queuedImages;
+    mutable QSet<QString> m_accessedImages;
+    QTimer *m_accessTimer;
     Q_DECLARE_PUBLIC(FacebookImageCacheModel)
 };
 
@@ -106,6 +127,8 @@ FacebookImageWorkerObject::FacebookImageWorkerObject()
     : AbstractWorkerObject(), FacebookImagesDatabase()
     , type(FacebookImageCacheModel::None)
     , m_enabled(false)
+    , m_requester(QString::number(reinterpret_cast<quintptr>(this), 16))
+    , m_watermark(-1)
 {
 }
 
@@ -118,6 +141,12 @@ void FacebookImageWorkerObject::finalCleanup()
     closeDatabase();
 }
 
+// Identifies the images queued by this worker, so that they can be cancelled
+QString FacebookImageWorkerObject::requester() const
+{
+    return m_requester;
+}
+
 void FacebookImageWorkerObject::refresh()
 {
     // We initialize the database when refresh is called
@@ -125,12 +154,24 @@ void FacebookImageWorkerObject::refresh()
     if (!m_enabled) {
         initDatabase();
         m_enabled = true;
+
+        // The counts of users and albums depend on their images
+        if (isValid()) {
+            watchDatabase(this, QStringList() << QLatin1String("users")
+                                              << QLatin1String("albums")
+                                              << QLatin1String("images"));
+        }
+    }
+
+    if (type == FacebookImageCacheModel::Images) {
+        refreshImages();
+        return;
     }
 
     SocialCacheModelData data;
     switch (type) {
         case FacebookImageCacheModel::Users: {
-            QList<FacebookUser::ConstPtr> usersData = users();
+            QList<FacebookUser::ConstPtr> usersData = users(query().search);
             for (int i = 0; i < usersData.count(); i++) {
                 const FacebookUser::ConstPtr & userData = usersData.at(i);
                 QMap<int, QVariant> userMap;
@@ -140,7 +181,8 @@ void FacebookImageWorkerObject::refresh()
                 data.append(userMap);
             }
 
-            if (data.count() > 1) {
+            // Searches only report matching users
+            if (data.count() > 1 && query().search.isEmpty()) {
                 QMap<int, QVariant> userMap;
                 int count = 0;
                 foreach (const FacebookUser::ConstPtr &userData, usersData) {
@@ -158,7 +200,7 @@ void FacebookImageWorkerObject::refresh()
         }
         break;
         case FacebookImageCacheModel::Albums: {
-            QList<FacebookAlbum::ConstPtr> albumsData = albums(nodeIdentifier);
+            QList<FacebookAlbum::ConstPtr> albumsData = albums(nodeIdentifier, query().search);
             foreach (const FacebookAlbum::ConstPtr & albumData, albumsData) {
                 QMap<int, QVariant> albumMap;
                 albumMap.insert(FacebookImageCacheModel::FacebookId, albumData->fbAlbumId());
@@ -168,7 +210,7 @@ void FacebookImageWorkerObject::refresh()
                 data.append(albumMap);
             }
 
-            if (data.count() > 1) {
+            if (data.count() > 1 && query().search.isEmpty()) {
                 QMap<int, QVariant> albumMap;
                 int count = 0;
                 foreach (const FacebookAlbum::ConstPtr &albumData, albumsData) {
@@ -186,89 +228,337 @@ void FacebookImageWorkerObject::refresh()
             }
         }
         break;
-        case FacebookImageCacheModel::Images: {
-            QList<FacebookImage::ConstPtr> imagesData;
-            QString userPrefix = QLatin1String(PHOTO_USER_PREFIX);
-            QString albumPrefix = QLatin1String(PHOTO_ALBUM_PREFIX);
-            if (nodeIdentifier.startsWith(userPrefix)) {
-                QString userIdentifier = nodeIdentifier.mid(userPrefix.size());
-                imagesData = userImages(userIdentifier);
-            } else if (nodeIdentifier.startsWith(albumPrefix)) {
-                QString albumIdentifier = nodeIdentifier.mid(albumPrefix.size());
-                imagesData = albumImages(albumIdentifier);
-            } else {
-                imagesData = userImages();
+        default: return; break;
+    }
+
+    emitData(data);
+}
+
+// Images are refreshed incrementally
+//
+// Once the images are reported, only the images that changed since
+// the last refresh are read, using the change log of the database.
+// The identifiers of the images are read to find the images that
+// were added, removed or moved. All the images are read again if
+// changes are missing from the change log.
+void FacebookImageWorkerObject::refreshImages()
+{
+    QString userIdentifier;
+    QString albumIdentifier;
+    QString userPrefix = QLatin1String(PHOTO_USER_PREFIX);
+    QString albumPrefix = QLatin1String(PHOTO_ALBUM_PREFIX);
+    if (nodeIdentifier.startsWith(userPrefix)) {
+        userIdentifier = nodeIdentifier.mid(userPrefix.size());
+    } else if (nodeIdentifier.startsWith(albumPrefix)) {
+        albumIdentifier = nodeIdentifier.mid(albumPrefix.size());
+    }
+
+    // Changes that happen while reading are read again next time
+    bool ok = false;
+    qint64 watermark = changeSequence(&ok);
+    if (!ok) {
+        watermark = -1;
+    }
+
+    if (hasEmittedData() && watermark >= 0 && m_watermark >= 0 && watermark >= m_watermark
+        && isChangeLogComplete(m_watermark)) {
+        QStringList identifiers = albumIdentifier.isEmpty()
+                ? userImageIds(userIdentifier, &ok, query())
+                : albumImageIds(albumIdentifier, &ok, query());
+        if (ok) {
+            QList<FacebookImage::ConstPtr> imagesData = albumIdentifier.isEmpty()
+                    ? userImages(userIdentifier, m_watermark, query())
+                    : albumImages(albumIdentifier, m_watermark, query());
+
+            QSet<QString> rows;
+            rows.reserve(identifiers.count());
+            foreach (const QString &identifier, identifiers) {
+                rows.insert(identifier);
+            }
+
+            QSet<QString> changed;
+            foreach (const FacebookImage::ConstPtr &imageData, imagesData) {
+                changed.insert(imageData->fbImageId());
             }
 
-            for (int i = 0; i < imagesData.count(); i ++) {
-                const FacebookImage::ConstPtr & imageData = imagesData.at(i);
-                QMap<int, QVariant> imageMap;
-                imageMap.insert(FacebookImageCacheModel::FacebookId, imageData->fbImageId());
-                if (imageData->thumbnailFile().isEmpty()) {
-                    queueImageThumbnail(i, imageData);
+            // Full images of the rows that are still there are kept
+            QList<FacebookImage::ConstPtr> fullImages;
+            foreach (const FacebookImage::ConstPtr &imageData, m_fullImages) {
+                if (rows.contains(imageData->fbImageId())
+                    && !changed.contains(imageData->fbImageId())) {
+                    fullImages.append(imageData);
                 }
-                imageMap.insert(FacebookImageCacheModel::Thumbnail, imageData->thumbnailFile());
-                if (imageData->imageFile().isEmpty()) {
-                    m_fullImages.append(qMakePair<FacebookImage::ConstPtr, int>(imageData, i));
+            }
+            m_fullImages = fullImages;
+
+            SocialCacheModelData data;
+            foreach (const FacebookImage::ConstPtr &imageData, imagesData) {
+                if (!rows.contains(imageData->fbImageId())) {
+                    continue;
                 }
-                imageMap.insert(FacebookImageCacheModel::Image, imageData->imageFile());
-                imageMap.insert(FacebookImageCacheModel::Title, imageData->imageName());
-                imageMap.insert(FacebookImageCacheModel::DateTaken, imageData->createdTime());
-                imageMap.insert(FacebookImageCacheModel::Width, imageData->width());
-                imageMap.insert(FacebookImageCacheModel::Height, imageData->height());
-                imageMap.insert(FacebookImageCacheModel::MimeType, QLatin1String("JPG"));
-                imageMap.insert(FacebookImageCacheModel::AccountId, imageData->account());
-                imageMap.insert(FacebookImageCacheModel::UserId, imageData->fbUserId());
-                data.append(imageMap);
+
+                // In lazy mode, changed rows are fetched again when they are read
+                if (isLazy()) {
+                    data.append(identityRow(imageData->fbImageId()));
+                } else {
+                    int generation = 0;
+                    int slot = atlasSlot(imageData->fbImageId(), &generation);
+                    data.append(imageRow(imageData, slot, generation));
+                }
+            }
+
+            if (emitDelta(identifiers, data)) {
+                m_watermark = watermark;
+                return;
             }
         }
-        break;
-        default: return; break;
     }
 
-    emit dataUpdated(data);
+    // Full images of the previous data set should not be loaded anymore
+    m_fullImages.clear();
+
+    // In lazy mode, only the identifiers are reported, and
+    // the other fields are read when rows are fetched
+    if (isLazy()) {
+        QStringList identifiers = albumIdentifier.isEmpty()
+                ? userImageIds(userIdentifier, &ok, query())
+                : albumImageIds(albumIdentifier, &ok, query());
+        if (ok) {
+            SocialCacheModelData data;
+            foreach (const QString &identifier, identifiers) {
+                data.append(identityRow(identifier));
+            }
+
+            m_watermark = watermark;
+            emitData(data);
+        }
+        return;
+    }
+
+    QList<FacebookImage::ConstPtr> imagesData = albumIdentifier.isEmpty()
+            ? userImages(userIdentifier, -1, query())
+            : albumImages(albumIdentifier, -1, query());
+
+    // Thumbnails that are packed in the atlas are served by the image provider
+    QHash<QString, int> atlasGenerations;
+    QHash<QString, int> atlasSlots = this->atlasSlots(&atlasGenerations);
+
+    SocialCacheModelData data;
+    for (int i = 0; i < imagesData.count(); i ++) {
+        const FacebookImage::ConstPtr & imageData = imagesData.at(i);
+        data.append(imageRow(imageData, atlasSlots.value(imageData->fbImageId(), -1),
+                             atlasGenerations.value(imageData->fbImageId())));
+    }
+
+    m_watermark = watermark;
+    emitData(data);
+}
+
+// Create the row describing an image, and queue the missing files
+//
+// The generation of the atlas slot is part of the url of the atlas
+// thumbnail, so that a rewritten slot is not served from the pixmap cache.
+SocialCacheModelRow FacebookImageWorkerObject::imageRow(const FacebookImage::ConstPtr &imageData,
+                                                        int atlasSlot, int atlasGeneration)
+{
+    QMap<int, QVariant> imageMap;
+    imageMap.insert(FacebookImageCacheModel::FacebookId, imageData->fbImageId());
+    if (imageData->thumbnailFile().isEmpty()) {
+        queueImageThumbnail(imageData);
+    }
+    imageMap.insert(FacebookImageCacheModel::Thumbnail, imageData->thumbnailFile());
+    if (imageData->imageFile().isEmpty()) {
+        m_fullImages.append(imageData);
+    }
+    imageMap.insert(FacebookImageCacheModel::Image, imageData->imageFile());
+    imageMap.insert(FacebookImageCacheModel::Title, imageData->imageName());
+    imageMap.insert(FacebookImageCacheModel::DateTaken, imageData->createdTime());
+    imageMap.insert(FacebookImageCacheModel::Width, imageData->width());
+    imageMap.insert(FacebookImageCacheModel::Height, imageData->height());
+    imageMap.insert(FacebookImageCacheModel::MimeType, QLatin1String("JPG"));
+    imageMap.insert(FacebookImageCacheModel::AccountId, imageData->account());
+    imageMap.insert(FacebookImageCacheModel::UserId, imageData->fbUserId());
+    if (atlasSlot >= 0) {
+        imageMap.insert(FacebookImageCacheModel::AtlasThumbnail,
+                        QString(QLatin1String("image://%1/%2/%3/%4")).arg(
+                            QLatin1String(ATLAS_PROVIDER_ID),
+                            QString::number(atlasSlot), imageData->fbImageId(),
+                            QString::number(atlasGeneration)));
+    } else {
+        imageMap.insert(FacebookImageCacheModel::AtlasThumbnail, QString());
+    }
+    return imageMap;
+}
+
+// A row that only contains the identifier of an image
+SocialCacheModelRow FacebookImageWorkerObject::identityRow(const QString &fbImageId) const
+{
+    SocialCacheModelRow row;
+    row.insert(FacebookImageCacheModel::FacebookId, fbImageId);
+    return row;
+}
+
+// Report the rows of the images requested by the model in lazy mode
+//
+// Rows of images that do not exist anymore only contain their
+// identifier, and are removed by the next refresh.
+void FacebookImageWorkerObject::fetchRows(int index, const QStringList &identifiers)
+{
+    if (type != FacebookImageCacheModel::Images || !isValid()) {
+        emit rowsFetched(index, SocialCacheModelData());
+        return;
+    }
+
+    QHash<QString, FacebookImage::ConstPtr> imagesData;
+    foreach (const FacebookImage::ConstPtr &imageData, images(identifiers)) {
+        imagesData.insert(imageData->fbImageId(), imageData);
+    }
+
+    // Rows fetched again are added again to the full images to load
+    for (int i = m_fullImages.count() - 1; i >= 0; --i) {
+        if (imagesData.contains(m_fullImages.at(i)->fbImageId())) {
+            m_fullImages.removeAt(i);
+        }
+    }
+
+    SocialCacheModelData data;
+    for (int i = 0; i < identifiers.count(); ++i) {
+        FacebookImage::ConstPtr imageData = imagesData.value(identifiers.at(i));
+        if (imageData) {
+            int generation = 0;
+            int slot = atlasSlot(identifiers.at(i), &generation);
+            data.append(imageRow(imageData, slot, generation));
+        } else {
+            data.append(identityRow(identifiers.at(i)));
+        }
+    }
+
+    emit rowsFetched(index, data);
 }
 
 void FacebookImageWorkerObject::setType(int typeToSet)
 {
     type = static_cast<FacebookImageCacheModel::ModelDataType>(typeToSet);
+    m_fullImages.clear();
+    resetEmittedData();
 }
 
 void FacebookImageWorkerObject::queueImages()
 {
-    for (QList<QPair<FacebookImage::ConstPtr, int> >::const_iterator i = m_fullImages.begin();
-         i != m_fullImages.end(); i++) {
-        queueImageFull((*i).second, (*i).first);
+    foreach (const FacebookImage::ConstPtr &imageData, m_fullImages) {
+        queueImageFull(imageData);
     }
 }
 
-void FacebookImageWorkerObject::queueImageThumbnail(int row, const FacebookImage::ConstPtr &image)
+void FacebookImageWorkerObject::queueImageThumbnail(const FacebookImage::ConstPtr &image)
 {
-    queue(row, FacebookImageDownloaderWorkerObject::ThumbnailImage, image->fbImageId(),
+    queue(FacebookImageDownloaderWorkerObject::ThumbnailImage, image->fbImageId(),
           image->thumbnailUrl());
 }
 
-void FacebookImageWorkerObject::queueImageFull(int row, const FacebookImage::ConstPtr &image)
+void FacebookImageWorkerObject::queueImageFull(const FacebookImage::ConstPtr &image)
 {
-    queue(row, FacebookImageDownloaderWorkerObject::FullImage, image->fbImageId(),
-          image->imageUrl());
+    // The thumbnail can be produced from the full image
+    queue(FacebookImageDownloaderWorkerObject::FullImage, image->fbImageId(),
+          image->imageUrl(), image->thumbnailUrl());
 }
 
-void FacebookImageWorkerObject::queue(int row,
-                                      FacebookImageDownloaderWorkerObject::ImageType imageType,
-                                      const QString &identifier, const QString &url)
+// Images are identified by their identifier, since their
+// rows might change before the download is completed.
+void FacebookImageWorkerObject::queue(FacebookImageDownloaderWorkerObject::ImageType imageType,
+                                      const QString &identifier, const QString &url,
+                                      const QString &thumbnailUrl)
 {
     QVariantMap metadata;
     metadata.insert(QLatin1String(TYPE_KEY), imageType);
     metadata.insert(QLatin1String(IDENTIFIER_KEY), identifier);
     metadata.insert(QLatin1String(URL_KEY), url);
-    metadata.insert(QLatin1String(ROW_KEY), row);
+    metadata.insert(QLatin1String(REQUESTER_KEY), m_requester);
+    if (!thumbnailUrl.isEmpty()) {
+        metadata.insert(QLatin1String(THUMBNAIL_URL_KEY), thumbnailUrl);
+    }
     emit requestQueue(url, metadata);
 }
 
 FacebookImageCacheModelPrivate::FacebookImageCacheModelPrivate(FacebookImageCacheModel *q)
-    : AbstractSocialCacheModelPrivate(q), downloader(0)
+    : AbstractSocialCacheModelPrivate(q), downloader(0), m_accessTimer(new QTimer(this))
+{
+    m_accessTimer->setSingleShot(true);
+    m_accessTimer->setInterval(ACCESS_FLUSH_INTERVAL);
+    connect(m_accessTimer, &QTimer::timeout,
+            this, &FacebookImageCacheModelPrivate::flushAccessedImages);
+
+    // Images queued for the previous data set are not needed anymore
+    connect(this, &FacebookImageCacheModelPrivate::nodeIdentifierChanged,
+            this, &FacebookImageCacheModelPrivate::cancelDownloads);
+    connect(this, &FacebookImageCacheModelPrivate::typeChanged,
+            this, &FacebookImageCacheModelPrivate::cancelDownloads);
+}
+
+FacebookImageCacheModelPrivate::~FacebookImageCacheModelPrivate()
 {
+    flushAccessedImages();
+    cancelDownloads();
+}
+
+// Track the images that are displayed, so that the downloader
+// can evict the least recently used ones
+void FacebookImageCacheModelPrivate::fieldAccessed(int row, int role) const
+{
+    if (type != FacebookImageCacheModel::Images || !downloader) {
+        return;
+    }
+
+    if (role != FacebookImageCacheModel::Thumbnail && role != FacebookImageCacheModel::Image) {
+        return;
+    }
+
+    const SocialCacheModelStoredRow &rowData = m_data.at(row);
+    if (rowData.value(role).toString().isEmpty()) {
+        return;
+    }
+
+    m_accessedImages.insert(rowData.value(FacebookImageCacheModel::FacebookId).toString());
+    if (!m_accessTimer->isActive()) {
+        m_accessTimer->start();
+    }
+}
+
+// Only images can be fetched lazily
+bool FacebookImageCacheModelPrivate::isLazySupported() const
+{
+    return type == FacebookImageCacheModel::Images;
+}
+
+QString FacebookImageCacheModelPrivate::snapshotKey() const
+{
+    return QString(QLatin1String("%1/%2")).arg(AbstractSocialCacheModelPrivate::snapshotKey())
+                                          .arg(type);
+}
+
+void FacebookImageCacheModelPrivate::flushAccessedImages()
+{
+    if (m_accessedImages.isEmpty() || !downloader) {
+        return;
+    }
+
+    QStringList identifiers = m_accessedImages.toList();
+    m_accessedImages.clear();
+    QMetaObject::invokeMethod(downloader->workerObject(), "touchImages", Qt::QueuedConnection,
+                              Q_ARG(QStringList, identifiers));
+}
+
+// Cancel the downloads requested by this model
+void FacebookImageCacheModelPrivate::cancelDownloads()
+{
+    m_queuedImages.clear();
+
+    if (!downloader || m_requester.isEmpty()) {
+        return;
+    }
+
+    QMetaObject::invokeMethod(downloader->workerObject(), "cancelRequester",
+                              Qt::QueuedConnection, Q_ARG(QString, m_requester));
 }
 
 void FacebookImageCacheModelPrivate::queue(const QString &url, const QVariantMap &metadata)
@@ -276,28 +566,37 @@ void FacebookImageCacheModelPrivate::queue(const QString &url, const QVariantMap
     m_queuedImages.insert(url, metadata);
 }
 
-void FacebookImageCacheModelPrivate::slotDataUpdated(const QString &url, const QString &path)
+// The downloader is shared, only handle the images requested by this model
+void FacebookImageCacheModelPrivate::slotDataUpdated(const QString &url, const QString &path,
+                                                     const QVariantMap &metadata)
 {
-    Q_Q(FacebookImageCacheModel);
+    QStringList requesters = metadata.value(QLatin1String(REQUESTERS_KEY)).toStringList();
+    if (!requesters.isEmpty() && !requesters.contains(m_requester)) {
+        return;
+    }
+
     if (m_queuedImages.contains(url)) {
         QVariantMap imageData = m_queuedImages.value(url);
-        int row = imageData.value(ROW_KEY).toInt();
-        if (row < 0 || row >= m_data.count()) {
-            qWarning() << Q_FUNC_INFO << "Incorrect number of rows" << imageData.count();
+
+        // The row of the image is found from its identifier, since
+        // rows might have changed since the image was queued
+        QString identifier = imageData.value(IDENTIFIER_KEY).toString();
+        int row = identifierRow(identifier);
+        if (row < 0) {
             return;
         }
 
         int type = imageData.value(TYPE_KEY).toInt();
         switch (type) {
         case FacebookImageDownloaderWorkerObject::ThumbnailImage:
-            m_data[row].insert(FacebookImageCacheModel::Thumbnail, path);
+            setField(row, FacebookImageCacheModel::Thumbnail, path);
+            markFieldChanged(row, FacebookImageCacheModel::Thumbnail);
             break;
         case FacebookImageDownloaderWorkerObject::FullImage:
-            m_data[row].insert(FacebookImageCacheModel::Image, path);
+            setField(row, FacebookImageCacheModel::Image, path);
+            markFieldChanged(row, FacebookImageCacheModel::Image);
             break;
         }
-
-        emit q->dataChanged(q->index(row), q->index(row));
     }
 }
 
@@ -309,6 +608,7 @@ void FacebookImageCacheModelPrivate::initWorkerObject(AbstractWorkerObject *work
         return;
     }
 
+    m_requester = facebookImageWorkerObject->requester();
     connect(facebookImageWorkerObject, &FacebookImageWorkerObject::requestQueue,
             this, &FacebookImageCacheModelPrivate::queue);
     connect(this, &FacebookImageCacheModelPrivate::queueImages,
@@ -340,6 +640,7 @@ QHash<int, QByteArray> FacebookImageCacheModel::roleNames() const
     roleNames.insert(MimeType, "mimeType");
     roleNames.insert(AccountId, "accountId");
     roleNames.insert(UserId, "userId");
+    roleNames.insert(AtlasThumbnail, "atlasThumbnail");
     return roleNames;
 }
 
@@ -370,6 +671,9 @@ void FacebookImageCacheModel::setDownloader(FacebookImageDownloader *downloader)
     Q_D(FacebookImageCacheModel);
     if (d->downloader != downloader) {
         if (d->downloader) {
+            d->flushAccessedImages();
+            d->cancelDownloads();
+
             // Disconnect worker object
             d->m_workerObject->disconnect(d->downloader->workerObject());
             d->downloader->workerObject()->disconnect(d);
@@ -47,7 +47,8 @@ public:
         Count,
         MimeType,
         AccountId,
-        UserId
+        UserId,
+        AtlasThumbnail
     };
 
     enum ModelDataType {
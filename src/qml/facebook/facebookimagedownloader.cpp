@@ -22,13 +22,48 @@
 #include "facebookimagedownloaderconstants_p.h"
 
 #include <QtCore/QStandardPaths>
+#include <QtCore/QDirIterator>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QSet>
 #include <QtGui/QGuiApplication>
 
 #include <QtDebug>
 
+// Number of images evicted at once, and delay between two
+// evictions, so that eviction runs incrementally.
+static const int EVICTION_BATCH = 20;
+static const int EVICTION_INTERVAL = 500;
+
+// Percentage of the maximum cache size that eviction goes down to,
+// so that it does not start again with every downloaded image
+static const int EVICTION_LOW_WATER = 90;
+
+// Size covered by the thumbnails that are derived from full images
+static const int DEFAULT_THUMBNAIL_SIZE = 256;
+
+// Describes the layout of the directories in which images are stored
+static const char *LAYOUT_FILE = ".layout";
+
+// Number of existing thumbnails packed at once in the atlas
+static const int PACK_BATCH = 20;
+static const int PACK_INTERVAL = 200;
+
 FacebookImageDownloaderWorkerObject::FacebookImageDownloaderWorkerObject()
-    : AbstractImageDownloader(), m_initialized(false), m_killed(false)
+    : AbstractImageDownloader(), m_initialized(false), m_maximumCacheSize(0)
+    , m_cacheSize(-1), m_evictionTimer(this)
+    , m_thumbnailSize(DEFAULT_THUMBNAIL_SIZE, DEFAULT_THUMBNAIL_SIZE), m_packTimer(this)
+    , m_migratedShardLevels(-1), m_migratedShardWidth(-1), m_killed(false)
 {
+    m_evictionTimer.setSingleShot(true);
+    m_evictionTimer.setInterval(EVICTION_INTERVAL);
+    connect(&m_evictionTimer, &QTimer::timeout,
+            this, &FacebookImageDownloaderWorkerObject::evictImages);
+    m_packTimer.setSingleShot(true);
+    m_packTimer.setInterval(PACK_INTERVAL);
+    connect(&m_packTimer, &QTimer::timeout,
+            this, &FacebookImageDownloaderWorkerObject::packThumbnails);
 }
 
 QString FacebookImageDownloaderWorkerObject::outputFile(const QString &url,
@@ -52,7 +87,61 @@ QString FacebookImageDownloaderWorkerObject::outputFile(const QString &url,
 
     identifier.append(typeString);
 
-    return makeOutputFile(SocialSyncInterface::Facebook, SocialSyncInterface::Images, identifier);
+    return makeOutputFile(SocialSyncInterface::Facebook, SocialSyncInterface::Images, identifier,
+                          shardLevels(), shardWidth());
+}
+
+QString FacebookImageDownloaderWorkerObject::contentFile(const QByteArray &contentHash,
+                                                         const QString &url,
+                                                         const QVariantMap &data) const
+{
+    Q_UNUSED(url)
+    Q_UNUSED(data)
+    if (m_killed) {
+        return QString(); // we are in the process of being terminated.
+    }
+
+    return makeContentFile(SocialSyncInterface::Facebook, SocialSyncInterface::Images,
+                           contentHash, shardLevels(), shardWidth());
+}
+
+// When a full image is downloaded, its thumbnail is produced
+// from it, rather than being downloaded, if it is not cached yet.
+QList<ImageDerivation> FacebookImageDownloaderWorkerObject::derivations(const QString &url,
+                                                                        const QVariantMap &data,
+                                                                        const QString &file)
+{
+    Q_UNUSED(url)
+    Q_UNUSED(file)
+    QList<ImageDerivation> derivations;
+    if (m_killed || !m_thumbnailSize.isValid()) {
+        return derivations;
+    }
+
+    if (data.value(QLatin1String(TYPE_KEY)).toInt() != FullImage) {
+        return derivations;
+    }
+
+    QString identifier = data.value(QLatin1String(IDENTIFIER_KEY)).toString();
+    QString thumbnailUrl = data.value(QLatin1String(THUMBNAIL_URL_KEY)).toString();
+    if (identifier.isEmpty() || thumbnailUrl.isEmpty()) {
+        return derivations;
+    }
+
+    FacebookImage::ConstPtr image = m_db.image(identifier);
+    if (image && !image->thumbnailFile().isEmpty() && QFile::exists(image->thumbnailFile())) {
+        return derivations;
+    }
+
+    ImageDerivation thumbnail;
+    thumbnail.url = thumbnailUrl;
+    thumbnail.metadata = data;
+    thumbnail.metadata.insert(QLatin1String(TYPE_KEY), ThumbnailImage);
+    thumbnail.metadata.remove(QLatin1String(THUMBNAIL_URL_KEY));
+    thumbnail.file = outputFile(thumbnailUrl, thumbnail.metadata);
+    thumbnail.size = m_thumbnailSize;
+    derivations.append(thumbnail);
+    return derivations;
 }
 
 bool FacebookImageDownloaderWorkerObject::dbInit()
@@ -66,7 +155,123 @@ bool FacebookImageDownloaderWorkerObject::dbInit()
         m_initialized = true;
     }
 
-    return m_db.isValid();
+    if (!m_db.isValid()) {
+        return false;
+    }
+
+    if (m_migratedShardLevels != shardLevels() || m_migratedShardWidth != shardWidth()) {
+        migrateFiles();
+    }
+
+    return true;
+}
+
+// Move the images that are stored with a previous layout of directories
+//
+// The layout is recorded in LAYOUT_FILE. Images found in the cache are
+// moved to the place they have with the current layout, and the database
+// is updated. Files cached before the layout was recorded use a single
+// level of 16 directories. The new layout is only recorded once the
+// database is updated, so that a failed migration is done again.
+void FacebookImageDownloaderWorkerObject::migrateFiles()
+{
+    const int levels = shardLevels();
+    const int width = shardWidth();
+    m_migratedShardLevels = levels;
+    m_migratedShardWidth = width;
+
+    QString root = QString("%1/%2/%3").arg(PRIVILEGED_DATA_DIR,
+                                           SocialSyncInterface::dataType(SocialSyncInterface::Images),
+                                           SocialSyncInterface::socialNetwork(SocialSyncInterface::Facebook));
+    QFile layoutFile (QString("%1/%2").arg(root, QLatin1String(LAYOUT_FILE)));
+
+    int previousLevels = 1;
+    int previousWidth = 1;
+    if (layoutFile.open(QIODevice::ReadOnly)) {
+        QList<QByteArray> layout = layoutFile.readAll().trimmed().split(' ');
+        if (layout.count() == 2) {
+            previousLevels = layout.at(0).toInt();
+            previousWidth = layout.at(1).toInt();
+        }
+        layoutFile.close();
+    }
+
+    if (previousLevels == levels && previousWidth == width) {
+        return;
+    }
+
+    // Paths stored in the database reference queued updates
+    m_db.write();
+
+    QStringList files;
+    QDirIterator iterator (root, QStringList() << QLatin1String("*.jpg"), QDir::Files,
+                           QDirIterator::Subdirectories);
+    while (iterator.hasNext()) {
+        files.append(iterator.next());
+    }
+
+    QMap<QString, QString> movedFiles;
+    QSet<QString> previousDirectories;
+    foreach (const QString &file, files) {
+        QFileInfo fileInfo (file);
+        QString name = fileInfo.completeBaseName();
+        bool blob = file.contains(QLatin1String("/blobs/"));
+
+        QString previousFile;
+        QString newFile;
+        if (blob) {
+            previousFile = makeContentFile(SocialSyncInterface::Facebook,
+                                           SocialSyncInterface::Images, name.toLatin1(),
+                                           previousLevels, previousWidth);
+            newFile = makeContentFile(SocialSyncInterface::Facebook, SocialSyncInterface::Images,
+                                      name.toLatin1(), levels, width);
+        } else {
+            previousFile = makeOutputFile(SocialSyncInterface::Facebook,
+                                          SocialSyncInterface::Images, name,
+                                          previousLevels, previousWidth);
+            newFile = makeOutputFile(SocialSyncInterface::Facebook, SocialSyncInterface::Images,
+                                     name, levels, width);
+        }
+
+        if (QDir::cleanPath(file) == QDir::cleanPath(newFile)) {
+            // The file might have been moved by a migration that
+            // failed to update the database
+            if (previousFile != newFile) {
+                movedFiles.insert(previousFile, newFile);
+            }
+            continue;
+        }
+
+        QDir newDir = QFileInfo(newFile).dir();
+        if (!newDir.exists()) {
+            newDir.mkpath(QLatin1String("."));
+        }
+
+        if (QFile::exists(newFile)) {
+            QFile::remove(file);
+        } else if (!QFile::rename(file, newFile)) {
+            qWarning() << Q_FUNC_INFO << "Failed to move" << file << "to" << newFile;
+            continue;
+        }
+
+        movedFiles.insert(file, newFile);
+        previousDirectories.insert(fileInfo.absolutePath());
+    }
+
+    // Remove the directories that are now empty
+    foreach (const QString &directory, previousDirectories) {
+        QDir().rmdir(directory);
+    }
+
+    if (!m_db.relocateFiles(movedFiles)) {
+        qWarning() << Q_FUNC_INFO << "Failed to update the paths of moved images";
+        return;
+    }
+
+    if (layoutFile.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        layoutFile.write(QByteArray::number(levels) + ' ' + QByteArray::number(width));
+        layoutFile.close();
+    }
 }
 
 bool FacebookImageDownloaderWorkerObject::dbClose()
@@ -96,13 +301,56 @@ void FacebookImageDownloaderWorkerObject::dbQueueImage(const QString &url, const
     switch (type) {
     case ThumbnailImage:
         m_db.updateImageThumbnail(identifier, file);
+        if (m_atlas) {
+            packThumbnail(identifier, file);
+        }
         break;
     case FullImage:
+        if (m_cacheSize >= 0) {
+            // A revalidated image is not counted again
+            FacebookImage::ConstPtr image = m_db.image(identifier);
+            if (!image || image->imageFile() != file) {
+                m_cacheSize += QFileInfo(file).size();
+            }
+        }
         m_db.updateImageFile(identifier, file);
+        scheduleEviction();
         break;
     }
 }
 
+bool FacebookImageDownloaderWorkerObject::dbValidators(const QString &url, const QVariantMap &data,
+                                                       ImageValidators *validators)
+{
+    Q_UNUSED(data)
+    if (m_killed) {
+        return false; // we are in the process of being terminated.
+    }
+
+    QString etag;
+    QString lastModified;
+    if (!m_db.imageValidators(url, &validators->file, &etag, &lastModified, &validators->size)) {
+        return false;
+    }
+
+    validators->etag = etag.toLatin1();
+    validators->lastModified = lastModified.toLatin1();
+    return true;
+}
+
+void FacebookImageDownloaderWorkerObject::dbQueueValidators(const QString &url,
+                                                            const QVariantMap &data,
+                                                            const ImageValidators &validators)
+{
+    Q_UNUSED(data)
+    if (m_killed) {
+        return; // we are in the process of being terminated.
+    }
+
+    m_db.updateImageValidators(url, validators.file, QString::fromLatin1(validators.etag),
+                               QString::fromLatin1(validators.lastModified), validators.size);
+}
+
 void FacebookImageDownloaderWorkerObject::dbWrite()
 {
     if (m_killed) {
@@ -112,14 +360,181 @@ void FacebookImageDownloaderWorkerObject::dbWrite()
     m_db.write();
 }
 
+// Set the size in MB that the cached images can use, 0 meaning no limit.
+//
+// When the cache is bigger, the least recently displayed full images
+// are evicted, a few at a time, until the cache is back under
+// EVICTION_LOW_WATER percent of the maximum. Only the file is removed,
+// the images are kept in the database and can be downloaded again.
+//
+// Only full images are evicted, so thumbnails are not counted.
+void FacebookImageDownloaderWorkerObject::setMaximumCacheSize(int maximumCacheSize)
+{
+    m_maximumCacheSize = qint64(qMax(maximumCacheSize, 0)) * 1024 * 1024;
+    if (m_maximumCacheSize == 0 || !dbInit()) {
+        m_cacheSize = -1;
+        m_evictionTimer.stop();
+        return;
+    }
+
+    if (m_cacheSize < 0) {
+        m_cacheSize = computeCacheSize();
+    }
+    scheduleEviction();
+}
+
+// Record that images were displayed, used to find the least
+// recently used images
+void FacebookImageDownloaderWorkerObject::touchImages(const QStringList &identifiers)
+{
+    if (identifiers.isEmpty() || !dbInit()) {
+        return;
+    }
+
+    m_db.touchImages(identifiers, QDateTime::currentDateTime());
+    scheduleDbWrite();
+}
+
+// Set the size covered by thumbnails derived from full images,
+// an invalid size disabling derivation.
+void FacebookImageDownloaderWorkerObject::setThumbnailSize(const QSize &thumbnailSize)
+{
+    m_thumbnailSize = thumbnailSize;
+}
+
+// Store decoded thumbnails in an atlas, that is served by
+// the image provider, to avoid decoding them when displayed.
+//
+// Thumbnails that are already cached are packed incrementally.
+void FacebookImageDownloaderWorkerObject::setThumbnailAtlas(bool thumbnailAtlas)
+{
+    if (!thumbnailAtlas) {
+        m_atlas.reset();
+        m_packTimer.stop();
+        return;
+    }
+
+    if (!m_atlas) {
+        m_atlas.reset(new ImageAtlas(ImageAtlas::makeAtlasPath(SocialSyncInterface::Facebook,
+                                                               SocialSyncInterface::Images),
+                                     QSize(ATLAS_SLOT_SIZE, ATLAS_SLOT_SIZE)));
+        m_packTimer.start();
+    }
+}
+
+bool FacebookImageDownloaderWorkerObject::packThumbnail(const QString &identifier,
+                                                        const QString &file)
+{
+    QImage image = m_atlas->decode(file);
+    if (image.isNull()) {
+        return false;
+    }
+
+    int slot = m_db.allocateAtlasSlot(identifier);
+    if (slot < 0) {
+        return false;
+    }
+
+    return m_atlas->write(slot, image);
+}
+
+void FacebookImageDownloaderWorkerObject::packThumbnails()
+{
+    if (m_killed || !m_atlas || !dbInit()) {
+        return;
+    }
+
+    QStringList identifiers = m_db.unpackedThumbnailImageIds(PACK_BATCH);
+    if (identifiers.isEmpty()) {
+        return;
+    }
+
+    bool packed = false;
+    foreach (const QString &identifier, identifiers) {
+        FacebookImage::ConstPtr image = m_db.image(identifier);
+        if (image && packThumbnail(identifier, image->thumbnailFile())) {
+            packed = true;
+        }
+    }
+
+    m_db.write();
+
+    // Stop when nothing could be packed, not to retry broken thumbnails forever
+    if (packed) {
+        m_packTimer.start();
+    }
+}
+
+void FacebookImageDownloaderWorkerObject::scheduleEviction()
+{
+    if (m_maximumCacheSize > 0 && m_cacheSize > m_maximumCacheSize
+        && !m_evictionTimer.isActive()) {
+        m_evictionTimer.start();
+    }
+}
+
+// Size of the cached full images
+//
+// It is only measured when the maximum size is set, and is then
+// updated as images are downloaded and evicted.
+qint64 FacebookImageDownloaderWorkerObject::computeCacheSize() const
+{
+    qint64 size = 0;
+    foreach (const QString &file, m_db.cachedImageFiles()) {
+        size += QFileInfo(file).size();
+    }
+    return size;
+}
+
+void FacebookImageDownloaderWorkerObject::evictImages()
+{
+    if (m_killed || m_maximumCacheSize == 0 || m_cacheSize < 0 || !dbInit()) {
+        return;
+    }
+
+    if (m_cacheSize <= m_maximumCacheSize * EVICTION_LOW_WATER / 100) {
+        return;
+    }
+
+    QStringList identifiers = m_db.leastRecentlyUsedImageIds(EVICTION_BATCH);
+    if (identifiers.isEmpty()) {
+        // There is nothing left to evict
+        m_cacheSize = 0;
+        return;
+    }
+
+    foreach (const QString &identifier, identifiers) {
+        FacebookImage::ConstPtr image = m_db.image(identifier);
+        if (!image) {
+            continue;
+        }
+
+        m_cacheSize -= QFileInfo(image->imageFile()).size();
+        m_db.removeImageValidators(image->imageUrl());
+        m_db.updateImageFile(identifier, QString());
+    }
+
+    scheduleDbWrite();
+    m_evictionTimer.start();
+}
+
 void FacebookImageDownloaderWorkerObject::quitGracefully()
 {
     m_quitMutex.lock();
-    // Note: we cannot dbWrite() / dbClose() here.
-    // Most likely, the database has already been closed
-    // by the time this function is called.
-    // So any attempt to lock, will result in a crash.
-    // Thus, set m_killed to avoid possibility of doing that.
+    // Save the images that are already downloaded, and close the
+    // database from this thread, that is the one that is using it.
+    // Downloads that are still running are aborted, so that they
+    // do not leave partially written files behind.
+    m_evictionTimer.stop();
+    m_packTimer.stop();
+    cancelAll();
+    if (m_initialized && m_db.isValid()) {
+        m_db.write();
+        m_db.closeDatabase();
+    }
+    m_initialized = false;
+    // Then set m_killed, so that nothing touches the
+    // database while the object is being destroyed.
     m_killed = true;
     // We also need to push this object to the null
     // thread to stop event processing (so that we
@@ -130,14 +545,19 @@ void FacebookImageDownloaderWorkerObject::quitGracefully()
     m_quitMutex.unlock();
 }
 
-FacebookImageDownloaderPrivate::FacebookImageDownloaderPrivate(FacebookImageDownloader *q)
-    : QObject(), q_ptr(q), m_workerObject(new FacebookImageDownloaderWorkerObject())
+static QMutex serviceMutex;
+static FacebookImageDownloaderService *service = 0;
+
+FacebookImageDownloaderService::FacebookImageDownloaderService()
+    : m_workerObject(new FacebookImageDownloaderWorkerObject())
+    , m_contentAddressed(false), m_maximumCacheSize(0)
+    , m_thumbnailSize(DEFAULT_THUMBNAIL_SIZE, DEFAULT_THUMBNAIL_SIZE), m_thumbnailAtlas(false)
 {
     m_workerThread.start(QThread::IdlePriority);
     m_workerObject->moveToThread(&m_workerThread);
 }
 
-FacebookImageDownloaderPrivate::~FacebookImageDownloaderPrivate()
+FacebookImageDownloaderService::~FacebookImageDownloaderService()
 {
     if (m_workerThread.isRunning()) {
         // tell worker object to quit gracefully.
@@ -155,6 +575,148 @@ FacebookImageDownloaderPrivate::~FacebookImageDownloaderPrivate()
     delete m_workerObject;
 }
 
+// Get the service, creating it if it do not exist yet.
+// Each call should be balanced with a call to release.
+FacebookImageDownloaderService * FacebookImageDownloaderService::acquire(
+        FacebookImageDownloader *downloader)
+{
+    QMutexLocker locker (&serviceMutex);
+    Q_UNUSED(locker)
+
+    if (!service) {
+        service = new FacebookImageDownloaderService();
+    }
+    service->m_downloaders.append(downloader);
+    return service;
+}
+
+void FacebookImageDownloaderService::release(FacebookImageDownloader *downloader)
+{
+    QMutexLocker locker (&serviceMutex);
+    Q_UNUSED(locker)
+
+    m_downloaders.removeOne(downloader);
+    if (!m_downloaders.isEmpty()) {
+        return;
+    }
+
+    if (service == this) {
+        service = 0;
+    }
+    delete this;
+}
+
+FacebookImageDownloaderWorkerObject * FacebookImageDownloaderService::workerObject() const
+{
+    return m_workerObject;
+}
+
+bool FacebookImageDownloaderService::isContentAddressed() const
+{
+    return m_contentAddressed;
+}
+
+void FacebookImageDownloaderService::setContentAddressed(bool contentAddressed)
+{
+    if (m_contentAddressed != contentAddressed) {
+        m_contentAddressed = contentAddressed;
+        QMetaObject::invokeMethod(m_workerObject, "setContentAddressed",
+                                  Qt::QueuedConnection, Q_ARG(bool, contentAddressed));
+        foreach (FacebookImageDownloader *downloader, m_downloaders) {
+            emit downloader->contentAddressedChanged();
+        }
+    }
+}
+
+int FacebookImageDownloaderService::maximumCacheSize() const
+{
+    return m_maximumCacheSize;
+}
+
+void FacebookImageDownloaderService::setMaximumCacheSize(int maximumCacheSize)
+{
+    if (m_maximumCacheSize != maximumCacheSize) {
+        m_maximumCacheSize = maximumCacheSize;
+        QMetaObject::invokeMethod(m_workerObject, "setMaximumCacheSize",
+                                  Qt::QueuedConnection, Q_ARG(int, maximumCacheSize));
+        foreach (FacebookImageDownloader *downloader, m_downloaders) {
+            emit downloader->maximumCacheSizeChanged();
+        }
+    }
+}
+
+QSize FacebookImageDownloaderService::thumbnailSize() const
+{
+    return m_thumbnailSize;
+}
+
+void FacebookImageDownloaderService::setThumbnailSize(const QSize &thumbnailSize)
+{
+    if (m_thumbnailSize != thumbnailSize) {
+        m_thumbnailSize = thumbnailSize;
+        QMetaObject::invokeMethod(m_workerObject, "setThumbnailSize",
+                                  Qt::QueuedConnection, Q_ARG(QSize, thumbnailSize));
+        foreach (FacebookImageDownloader *downloader, m_downloaders) {
+            emit downloader->thumbnailSizeChanged();
+        }
+    }
+}
+
+bool FacebookImageDownloaderService::hasThumbnailAtlas() const
+{
+    return m_thumbnailAtlas;
+}
+
+void FacebookImageDownloaderService::setThumbnailAtlas(bool thumbnailAtlas)
+{
+    if (m_thumbnailAtlas != thumbnailAtlas) {
+        m_thumbnailAtlas = thumbnailAtlas;
+        QMetaObject::invokeMethod(m_workerObject, "setThumbnailAtlas",
+                                  Qt::QueuedConnection, Q_ARG(bool, thumbnailAtlas));
+        foreach (FacebookImageDownloader *downloader, m_downloaders) {
+            emit downloader->thumbnailAtlasChanged();
+        }
+    }
+}
+
+void FacebookImageDownloaderService::setFlushPolicy(int maximumBatchSize, int maximumLatency,
+                                                    qint64 maximumBytes)
+{
+    QMetaObject::invokeMethod(m_workerObject, "setFlushPolicy", Qt::QueuedConnection,
+                              Q_ARG(int, maximumBatchSize), Q_ARG(int, maximumLatency),
+                              Q_ARG(qint64, maximumBytes));
+}
+
+void FacebookImageDownloaderService::setSharding(int levels, int width)
+{
+    QMetaObject::invokeMethod(m_workerObject, "setSharding", Qt::QueuedConnection,
+                              Q_ARG(int, levels), Q_ARG(int, width));
+}
+
+FacebookImageDownloaderPrivate::FacebookImageDownloaderPrivate(FacebookImageDownloader *q)
+    : QObject(), q_ptr(q), m_service(FacebookImageDownloaderService::acquire(q))
+    , m_workerObject(m_service->workerObject())
+{
+    connect(m_workerObject, &AbstractImageDownloader::metricsUpdated,
+            this, &FacebookImageDownloaderPrivate::updateMetrics);
+}
+
+FacebookImageDownloaderPrivate::~FacebookImageDownloaderPrivate()
+{
+    // The worker object is destroyed with the service, once
+    // it is not used by any downloader anymore.
+    m_service->release(q_ptr);
+}
+
+void FacebookImageDownloaderPrivate::updateMetrics(const QVariantMap &metrics)
+{
+    Q_Q(FacebookImageDownloader);
+    m_metrics = metrics;
+    emit q->metricsChanged();
+}
+
+// Downloaders share a worker object, and their settings. Settings
+// changed through a downloader are notified by all the downloaders.
 FacebookImageDownloader::FacebookImageDownloader(QObject *parent) :
     QObject(parent), d_ptr(new FacebookImageDownloaderPrivate(this))
 {
@@ -169,3 +731,85 @@ FacebookImageDownloaderWorkerObject * FacebookImageDownloader::workerObject() co
     Q_D(const FacebookImageDownloader);
     return d->m_workerObject;
 }
+
+bool FacebookImageDownloader::isContentAddressed() const
+{
+    Q_D(const FacebookImageDownloader);
+    return d->m_service->isContentAddressed();
+}
+
+// Store images by the hash of their content, so that an image
+// shared by several identifiers is only stored once.
+void FacebookImageDownloader::setContentAddressed(bool contentAddressed)
+{
+    Q_D(FacebookImageDownloader);
+    d->m_service->setContentAddressed(contentAddressed);
+}
+
+int FacebookImageDownloader::maximumCacheSize() const
+{
+    Q_D(const FacebookImageDownloader);
+    return d->m_service->maximumCacheSize();
+}
+
+// Maximum size in MB of the cached images, 0 meaning no limit
+void FacebookImageDownloader::setMaximumCacheSize(int maximumCacheSize)
+{
+    Q_D(FacebookImageDownloader);
+    d->m_service->setMaximumCacheSize(maximumCacheSize);
+}
+
+QSize FacebookImageDownloader::thumbnailSize() const
+{
+    Q_D(const FacebookImageDownloader);
+    return d->m_service->thumbnailSize();
+}
+
+// Size covered by the thumbnails that are produced from downloaded
+// full images, instead of being downloaded. An invalid size disables it.
+void FacebookImageDownloader::setThumbnailSize(const QSize &thumbnailSize)
+{
+    Q_D(FacebookImageDownloader);
+    d->m_service->setThumbnailSize(thumbnailSize);
+}
+
+bool FacebookImageDownloader::hasThumbnailAtlas() const
+{
+    Q_D(const FacebookImageDownloader);
+    return d->m_service->hasThumbnailAtlas();
+}
+
+// Store decoded thumbnails in an atlas. The atlasThumbnail role
+// of FacebookImageCacheModel provides them.
+void FacebookImageDownloader::setThumbnailAtlas(bool thumbnailAtlas)
+{
+    Q_D(FacebookImageDownloader);
+    d->m_service->setThumbnailAtlas(thumbnailAtlas);
+}
+
+// Activity of the downloader, as described by AbstractImageDownloader::metrics()
+//
+// It is updated at most once per second while images are downloaded.
+QVariantMap FacebookImageDownloader::metrics() const
+{
+    Q_D(const FacebookImageDownloader);
+    return d->m_metrics;
+}
+
+// Set when downloaded images are saved in the database, as
+// described by AbstractImageDownloader::setFlushPolicy
+void FacebookImageDownloader::setFlushPolicy(int maximumBatchSize, int maximumLatency,
+                                             int maximumBytes)
+{
+    Q_D(FacebookImageDownloader);
+    d->m_service->setFlushPolicy(maximumBatchSize, maximumLatency, maximumBytes);
+}
+
+// Set the layout of the directories in which images are stored, as
+// described by AbstractImageDownloader::setSharding. Cached images are
+// moved to the new layout the next time the database is used.
+void FacebookImageDownloader::setSharding(int levels, int width)
+{
+    Q_D(FacebookImageDownloader);
+    d->m_service->setSharding(levels, width);
+}
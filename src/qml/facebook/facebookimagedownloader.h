@@ -21,16 +21,52 @@
 #define FACEBOOKIMAGEDOWNLOADER_H
 
 #include <QtCore/QObject>
+#include <QtCore/QSize>
+#include <QtCore/QVariantMap>
 
 class FacebookImageDownloaderWorkerObject;
 class FacebookImageDownloaderPrivate;
 class FacebookImageDownloader : public QObject
 {
     Q_OBJECT
+    Q_PROPERTY(bool contentAddressed READ isContentAddressed WRITE setContentAddressed
+               NOTIFY contentAddressedChanged)
+    Q_PROPERTY(int maximumCacheSize READ maximumCacheSize WRITE setMaximumCacheSize
+               NOTIFY maximumCacheSizeChanged)
+    Q_PROPERTY(QSize thumbnailSize READ thumbnailSize WRITE setThumbnailSize
+               NOTIFY thumbnailSizeChanged)
+    Q_PROPERTY(bool thumbnailAtlas READ hasThumbnailAtlas WRITE setThumbnailAtlas
+               NOTIFY thumbnailAtlasChanged)
+    Q_PROPERTY(QVariantMap metrics READ metrics NOTIFY metricsChanged)
 public:
     explicit FacebookImageDownloader(QObject *parent = 0);
     virtual ~FacebookImageDownloader();
     FacebookImageDownloaderWorkerObject * workerObject() const;
+
+    bool isContentAddressed() const;
+    void setContentAddressed(bool contentAddressed);
+
+    int maximumCacheSize() const;
+    void setMaximumCacheSize(int maximumCacheSize);
+
+    QSize thumbnailSize() const;
+    void setThumbnailSize(const QSize &thumbnailSize);
+
+    bool hasThumbnailAtlas() const;
+    void setThumbnailAtlas(bool thumbnailAtlas);
+
+    QVariantMap metrics() const;
+
+    Q_INVOKABLE void setFlushPolicy(int maximumBatchSize, int maximumLatency, int maximumBytes);
+    Q_INVOKABLE void setSharding(int levels, int width);
+
+Q_SIGNALS:
+    void contentAddressedChanged();
+    void maximumCacheSizeChanged();
+    void thumbnailSizeChanged();
+    void thumbnailAtlasChanged();
+    void metricsChanged();
+
 protected:
     QScopedPointer<FacebookImageDownloaderPrivate> d_ptr;
 private:
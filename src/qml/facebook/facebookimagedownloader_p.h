@@ -20,17 +20,63 @@
 #ifndef FACEBOOKIMAGEDOWNLOADER_P_H
 #define FACEBOOKIMAGEDOWNLOADER_P_H
 
+#include <QtCore/QList>
 #include <QtCore/QObject>
 #include <QtCore/QThread>
 #include <QtCore/QMutex>
 #include <QtCore/QWaitCondition>
+#include <QtCore/QTimer>
 
 #include "abstractimagedownloader.h"
 #include "facebookimagesdatabase.h"
+#include "imageatlas.h"
 
 class FacebookImageDownloaderWorkerObject;
 class AbstractSocialCacheModel;
 class FacebookImageDownloader;
+
+// FacebookImageDownloaderService owns the worker object, and the thread
+// it lives in. It is shared by all the FacebookImageDownloader of a
+// process, so that they use one network stack and one database
+// connection. It is destroyed when the last downloader releases it.
+//
+// Settings are process-wide, since they apply to the shared worker.
+// They are stored by the service, so that a new downloader reports
+// the current settings, and a setting changed through a downloader
+// is notified by all the downloaders. Settings are changed from the
+// thread the downloaders live in.
+class FacebookImageDownloaderService
+{
+public:
+    static FacebookImageDownloaderService * acquire(FacebookImageDownloader *downloader);
+    void release(FacebookImageDownloader *downloader);
+
+    FacebookImageDownloaderWorkerObject * workerObject() const;
+
+    bool isContentAddressed() const;
+    void setContentAddressed(bool contentAddressed);
+    int maximumCacheSize() const;
+    void setMaximumCacheSize(int maximumCacheSize);
+    QSize thumbnailSize() const;
+    void setThumbnailSize(const QSize &thumbnailSize);
+    bool hasThumbnailAtlas() const;
+    void setThumbnailAtlas(bool thumbnailAtlas);
+    void setFlushPolicy(int maximumBatchSize, int maximumLatency, qint64 maximumBytes);
+    void setSharding(int levels, int width);
+
+private:
+    explicit FacebookImageDownloaderService();
+    ~FacebookImageDownloaderService();
+
+    QThread m_workerThread;
+    FacebookImageDownloaderWorkerObject *m_workerObject;
+    QList<FacebookImageDownloader *> m_downloaders;
+    bool m_contentAddressed;
+    int m_maximumCacheSize;
+    QSize m_thumbnailSize;
+    bool m_thumbnailAtlas;
+};
+
 class FacebookImageDownloaderPrivate: public QObject
 {
     Q_OBJECT
@@ -42,9 +88,13 @@ public:
 protected:
     FacebookImageDownloader * const q_ptr;
 
+private Q_SLOTS:
+    void updateMetrics(const QVariantMap &metrics);
+
 private:
-    QThread m_workerThread;
+    FacebookImageDownloaderService *m_service;
     FacebookImageDownloaderWorkerObject *m_workerObject;
+    QVariantMap m_metrics;
     Q_DECLARE_PUBLIC(FacebookImageDownloader)
 };
 
@@ -81,22 +131,51 @@ public:
 
 public Q_SLOTS:
     void quitGracefully();
+    void setMaximumCacheSize(int maximumCacheSize);
+    void touchImages(const QStringList &identifiers);
+    void setThumbnailSize(const QSize &thumbnailSize);
+    void setThumbnailAtlas(bool thumbnailAtlas);
 
 protected:
     QString outputFile(const QString &url, const QVariantMap &data) const;
+    QString contentFile(const QByteArray &contentHash, const QString &url,
+                        const QVariantMap &data) const;
+    QList<ImageDerivation> derivations(const QString &url, const QVariantMap &data,
+                                       const QString &file);
     bool dbInit();
     void dbQueueImage(const QString &url, const QVariantMap &data, const QString &file);
+    bool dbValidators(const QString &url, const QVariantMap &data, ImageValidators *validators);
+    void dbQueueValidators(const QString &url, const QVariantMap &data,
+                           const ImageValidators &validators);
     void dbWrite();
     bool dbClose();
 
+private Q_SLOTS:
+    void evictImages();
+    void packThumbnails();
+
 private:
+    void scheduleEviction();
+    qint64 computeCacheSize() const;
+    bool packThumbnail(const QString &identifier, const QString &file);
+    void migrateFiles();
+
     bool m_initialized;
     FacebookImagesDatabase m_db;
 
+    qint64 m_maximumCacheSize;
+    qint64 m_cacheSize;
+    QTimer m_evictionTimer;
+    QSize m_thumbnailSize;
+    QScopedPointer<ImageAtlas> m_atlas;
+    QTimer m_packTimer;
+    int m_migratedShardLevels;
+    int m_migratedShardWidth;
+
     bool m_killed;
 
 private:
-    friend class FacebookImageDownloaderPrivate;
+    friend class FacebookImageDownloaderService;
     QMutex m_quitMutex;
     QWaitCondition m_quitWC;
 };
@@ -22,5 +22,12 @@
 
 static const char *IDENTIFIER_KEY = "identifier";
 static const char *TYPE_KEY = "type";
+static const char *THUMBNAIL_URL_KEY = "thumbnailUrl";
+static const char *REQUESTER_KEY = "requester";
+static const char *REQUESTERS_KEY = "requesters";
+
+// Thumbnail atlas, that is served by the image provider with this id
+static const char *ATLAS_PROVIDER_ID = "facebookthumbnails";
+static const int ATLAS_SLOT_SIZE = 128;
 
 #endif // FACEBOOKIMAGEDOWNLOADERCONSTANTS_P_H
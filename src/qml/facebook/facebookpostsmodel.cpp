@@ -35,12 +35,16 @@ public:
     void finalCleanup();
 
 private:
+    SocialCacheModelData postsData(const QList<SocialPost::ConstPtr> &posts,
+                                   const QList<SocialPostMatches> &matches = QList<SocialPostMatches>());
+
     FacebookPostsDatabase m_db;
     bool m_enabled;
+    qint64 m_watermark;
 };
 
 FacebookPostsWorkerObject::FacebookPostsWorkerObject()
-    : AbstractWorkerObject(), m_enabled(false)
+    : AbstractWorkerObject(), m_enabled(false), m_watermark(-1)
 {
 }
 
@@ -60,11 +64,48 @@ void FacebookPostsWorkerObject::refresh()
     if (!m_enabled) {
         m_db.initDatabase();
         m_enabled = true;
+
+        if (m_db.isValid()) {
+            watchDatabase(&m_db, QStringList() << QLatin1String("posts"));
+        }
+    }
+
+    // Once posts are reported, only the posts that changed are read again.
+    // Changes that happen while reading are read again next time.
+    bool ok = false;
+    qint64 watermark = m_db.changeSequence(&ok);
+    if (!ok) {
+        watermark = -1;
+    }
+
+    // Searches are ranked, so their results are reported again entirely
+    if (!query().search.isEmpty()) {
+        QList<SocialPostMatches> matches;
+        QList<SocialPost::ConstPtr> posts = m_db.search(query(), &matches);
+        m_watermark = watermark;
+        emitData(postsData(posts, matches));
+        return;
     }
 
+    if (hasEmittedData() && watermark >= 0 && m_watermark >= 0 && watermark >= m_watermark
+        && m_db.isChangeLogComplete(m_watermark)) {
+        QStringList identifiers = m_db.postIds(&ok, query());
+        if (ok && emitDelta(identifiers, postsData(m_db.posts(m_watermark, query())))) {
+            m_watermark = watermark;
+            return;
+        }
+    }
+
+    m_watermark = watermark;
+    emitData(postsData(m_db.posts(query())));
+}
+
+SocialCacheModelData FacebookPostsWorkerObject::postsData(const QList<SocialPost::ConstPtr> &posts,
+                                                          const QList<SocialPostMatches> &matches)
+{
     SocialCacheModelData data;
-    QList<SocialPost::ConstPtr> postsData = m_db.posts();
-    foreach (const SocialPost::ConstPtr &post, postsData) {
+    for (int i = 0; i < posts.count(); ++i) {
+        const SocialPost::ConstPtr &post = posts.at(i);
         QMap<int, QVariant> eventMap;
         eventMap.insert(FacebookPostsModel::FacebookId, post->identifier());
         eventMap.insert(FacebookPostsModel::Name, post->name());
@@ -92,10 +133,11 @@ void FacebookPostsWorkerObject::refresh()
             accountsVariant.append(account);
         }
         eventMap.insert(FacebookPostsModel::Accounts, accountsVariant);
+        eventMap.insert(FacebookPostsModel::SearchMatches, createMatchesData(matches.value(i)));
         data.append(eventMap);
     }
 
-    emit dataUpdated(data);
+    return data;
 }
 
 class FacebookPostsModelPrivate: public AbstractSocialCacheModelPrivate
@@ -136,6 +178,7 @@ QHash<int, QByteArray> FacebookPostsModel::roleNames() const
     roleNames.insert(AllowComment, "allowComment");
     roleNames.insert(ClientId, "clientId");
     roleNames.insert(Accounts, "accounts");
+    roleNames.insert(SearchMatches, "searchMatches");
     return roleNames;
 }
 
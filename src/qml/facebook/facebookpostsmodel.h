@@ -41,7 +41,8 @@ public:
         AllowLike,
         AllowComment,
         ClientId,
-        Accounts
+        Accounts,
+        SearchMatches
     };
     explicit FacebookPostsModel(QObject *parent = 0);
     QHash<int, QByteArray> roleNames() const;
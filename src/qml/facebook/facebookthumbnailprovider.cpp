@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ * Contact: Lucien Xu <lucien.xu@jollamobile.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "facebookthumbnailprovider.h"
+#include "facebookimagedownloaderconstants_p.h"
+#include "imageatlas.h"
+
+// Serves thumbnails packed in the atlas by FacebookImageDownloader
+//
+// Ids are formatted as "slot/facebookId/generation". Only the slot
+// is used, the identifier and the generation of the slot make the
+// url unique, so that a slot that is written again is not served
+// from the pixmap cache.
+FacebookThumbnailProvider::FacebookThumbnailProvider()
+    : QQuickImageProvider(QQuickImageProvider::Image)
+    , m_atlas(new ImageAtlas(ImageAtlas::makeAtlasPath(SocialSyncInterface::Facebook,
+                                                       SocialSyncInterface::Images),
+                             QSize(ATLAS_SLOT_SIZE, ATLAS_SLOT_SIZE)))
+{
+}
+
+FacebookThumbnailProvider::~FacebookThumbnailProvider()
+{
+    delete m_atlas;
+}
+
+QImage FacebookThumbnailProvider::requestImage(const QString &id, QSize *size,
+                                               const QSize &requestedSize)
+{
+    bool ok = false;
+    int slot = id.section(QLatin1Char('/'), 0, 0).toInt(&ok);
+    if (!ok) {
+        return QImage();
+    }
+
+    QImage image = m_atlas->read(slot);
+    if (size) {
+        *size = image.size();
+    }
+
+    if (!image.isNull() && requestedSize.isValid() && requestedSize != image.size()) {
+        return image.scaled(requestedSize, Qt::KeepAspectRatioByExpanding,
+                            Qt::SmoothTransformation);
+    }
+
+    return image;
+}
@@ -27,6 +27,8 @@
 
 #include "facebook/facebookimagecachemodel.h"
 #include "facebook/facebookpostsmodel.h"
+#include "facebook/facebookthumbnailprovider.h"
+#include "facebook/facebookimagedownloaderconstants_p.h"
 #include "twitter/twitterpostsmodel.h"
 
 #ifndef NO_DEPS
@@ -76,6 +78,9 @@ public:
         AppTranslator *translator = new AppTranslator(engine);
         engineeringEnglish->load("socialcache_eng_en", "/usr/share/translations");
         translator->load(QLocale(), "socialcache", "-", "/usr/share/translations");
+
+        engine->addImageProvider(QLatin1String(ATLAS_PROVIDER_ID),
+                                 new FacebookThumbnailProvider);
     }
 
     virtual void registerTypes(const char *uri)
@@ -83,6 +88,7 @@ public:
         Q_ASSERT(QLatin1String(uri) == QLatin1String("org.nemomobile.socialcache"));
         qRegisterMetaType<SocialCacheModelRow>("SocialCacheModelRow");
         qRegisterMetaType<SocialCacheModelData>("SocialCacheModelData");
+        qRegisterMetaType<SocialCacheModelDelta>("SocialCacheModelDelta");
 
         qmlRegisterType<FacebookImageCacheModel>(uri, 1, 0, "FacebookImageCacheModel");
         qmlRegisterType<FacebookPostsModel>(uri, 1, 0, "FacebookPostsModel");
@@ -26,6 +26,8 @@ static const char *URL_KEY = "url";
 static const char *TYPE_KEY = "type";
 static const char *TYPE_PHOTO = "photo";
 static const char *TYPE_VIDEO = "video";
+static const char *POSITION_KEY = "position";
+static const char *LENGTH_KEY = "length";
 
 inline static QVariantMap createImageData(const SocialPostImage::ConstPtr &image)
 {
@@ -42,4 +44,16 @@ inline static QVariantMap createImageData(const SocialPostImage::ConstPtr &image
     return imageData;
 }
 
+inline static QVariantList createMatchesData(const SocialPostMatches &matches)
+{
+    QVariantList matchesData;
+    foreach (const SocialPostMatches::value_type &match, matches) {
+        QVariantMap matchData;
+        matchData.insert(QLatin1String(POSITION_KEY), match.first);
+        matchData.insert(QLatin1String(LENGTH_KEY), match.second);
+        matchesData.append(matchData);
+    }
+    return matchesData;
+}
+
 #endif // POSTIMAGEHELPER_P_H
@@ -11,7 +11,7 @@ LIBS += -L../lib -lsocialcache
 INCLUDEPATH += ../lib/
 
 
-QT += gui qml sql network dbus
+QT += gui qml quick sql network dbus
 CONFIG += plugin
 
 CONFIG(nodeps):{
@@ -29,6 +29,7 @@ SOURCES += synchelper.cpp \
 HEADERS += \
     abstractsocialcachemodel.h \
     abstractsocialcachemodel_p.h \
+    socialcacheworkerpool_p.h \
     postimagehelper_p.h \
     synchronizelists_p.h \
     facebook/facebookimagecachemodel.h \
@@ -36,13 +37,16 @@ HEADERS += \
     facebook/facebookimagedownloader_p.h \
     facebook/facebookimagedownloaderconstants_p.h \
     facebook/facebookpostsmodel.h \
+    facebook/facebookthumbnailprovider.h \
     twitter/twitterpostsmodel.h
 
 SOURCES += plugin.cpp \
     abstractsocialcachemodel.cpp \
+    socialcacheworkerpool.cpp \
     facebook/facebookimagecachemodel.cpp \
     facebook/facebookimagedownloader.cpp \
     facebook/facebookpostsmodel.cpp \
+    facebook/facebookthumbnailprovider.cpp \
     twitter/twitterpostsmodel.cpp
 
 OTHER_FILES += qmldir
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ * Contact: Lucien Xu <lucien.xu@jollamobile.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "socialcacheworkerpool_p.h"
+#include "abstractsocialcachemodel_p.h"
+
+#include <QtCore/QThread>
+
+// Worker objects are spread over at most MAXIMUM_THREADS threads.
+// A worker object stays in the same thread, since its database
+// connection can only be used in the thread that created it.
+static const int MAXIMUM_THREADS = 3;
+
+static SocialCacheWorkerPool *workerPool = 0;
+
+SocialCacheWorkerPool::SocialCacheWorkerPool()
+    : m_references(0)
+{
+}
+
+SocialCacheWorkerPool::~SocialCacheWorkerPool()
+{
+    // Worker objects scheduled for deletion are deleted when threads finish
+    foreach (QThread *thread, m_threads) {
+        thread->quit();
+    }
+
+    foreach (QThread *thread, m_threads) {
+        thread->wait();
+        delete thread;
+    }
+}
+
+// Should only be called from the GUI thread
+SocialCacheWorkerPool *SocialCacheWorkerPool::acquire()
+{
+    if (!workerPool) {
+        workerPool = new SocialCacheWorkerPool;
+    }
+
+    ++workerPool->m_references;
+    return workerPool;
+}
+
+void SocialCacheWorkerPool::release()
+{
+    if (workerPool && --workerPool->m_references == 0) {
+        delete workerPool;
+        workerPool = 0;
+    }
+}
+
+// Move a worker object to the thread with the fewest worker objects
+void SocialCacheWorkerPool::addWorker(AbstractWorkerObject *workerObject)
+{
+    QThread *thread = availableThread();
+    m_workers.insert(workerObject, thread);
+    ++m_workerCounts[thread];
+    workerObject->moveToThread(thread);
+}
+
+void SocialCacheWorkerPool::removeWorker(AbstractWorkerObject *workerObject)
+{
+    QThread *thread = m_workers.take(workerObject);
+    if (thread) {
+        --m_workerCounts[thread];
+    }
+}
+
+QThread *SocialCacheWorkerPool::availableThread()
+{
+    QThread *available = 0;
+    foreach (QThread *thread, m_threads) {
+        if (!available || m_workerCounts.value(thread) < m_workerCounts.value(available)) {
+            available = thread;
+        }
+    }
+
+    const int maximumThreads = qBound(1, QThread::idealThreadCount(), MAXIMUM_THREADS);
+    if (available && (m_workerCounts.value(available) == 0 || m_threads.count() >= maximumThreads)) {
+        return available;
+    }
+
+    QThread *thread = new QThread;
+    thread->start(QThread::IdlePriority);
+    m_threads.append(thread);
+    m_workerCounts.insert(thread, 0);
+    return thread;
+}
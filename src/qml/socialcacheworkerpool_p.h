@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ * Contact: Lucien Xu <lucien.xu@jollamobile.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef SOCIALCACHEWORKERPOOL_P_H
+#define SOCIALCACHEWORKERPOOL_P_H
+
+#include <QtCore/QHash>
+#include <QtCore/QList>
+
+class QThread;
+class AbstractWorkerObject;
+
+// A pool of threads shared by the worker objects of all the models
+//
+// Models acquire the pool when they create their worker object, and
+// release it when they are destroyed. The pool is deleted, and its
+// threads are stopped, when it is released by the last model.
+class SocialCacheWorkerPool
+{
+public:
+    static SocialCacheWorkerPool *acquire();
+    static void release();
+
+    void addWorker(AbstractWorkerObject *workerObject);
+    void removeWorker(AbstractWorkerObject *workerObject);
+
+private:
+    explicit SocialCacheWorkerPool();
+    ~SocialCacheWorkerPool();
+    QThread *availableThread();
+
+    QList<QThread *> m_threads;
+    QHash<QThread *, int> m_workerCounts;
+    QHash<AbstractWorkerObject *, QThread *> m_workers;
+    int m_references;
+};
+
+#endif // SOCIALCACHEWORKERPOOL_P_H
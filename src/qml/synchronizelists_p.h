@@ -32,12 +32,44 @@
 #ifndef SYNCHRONIZELISTS_P_H
 #define SYNCHRONIZELISTS_P_H
 
+#include <QtCore/QHash>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
 template <typename T>
 bool compareIdentity(const T &item, const T &reference)
 {
     return item == reference;
 }
 
+// 64-bit FNV-1a hash of the UTF-16 data of a string
+inline quint64 fnv1aHash(const QString &string)
+{
+    quint64 hash = Q_UINT64_C(14695981039346656037);
+    const ushort *data = string.utf16();
+    for (int i = 0; i < string.length(); ++i) {
+        hash ^= data[i];
+        hash *= Q_UINT64_C(1099511628211);
+    }
+    return hash;
+}
+
+// Hash of the identity of an item
+//
+// Items that have the same identity according to compareIdentity
+// must have the same hash.
+template <typename T>
+quint64 identityHash(const T &item)
+{
+    return qHash(item);
+}
+
+template <>
+inline quint64 identityHash<QString>(const QString &item)
+{
+    return fnv1aHash(item);
+}
+
 template <typename Agent, typename ReferenceList>
 int insertRange(Agent *agent, int index, int count, const ReferenceList &source, int sourceIndex)
 {
@@ -52,6 +84,12 @@ int removeRange(Agent *agent, int index, int count)
     return 0;
 }
 
+template <typename Agent>
+void moveRange(Agent *agent, int index, int count, int destination)
+{
+    agent->moveRange(index, count, destination);
+}
+
 template <typename Agent, typename ReferenceList>
 int updateRange(Agent *agent, int index, int count, const ReferenceList &source, int sourceIndex)
 {
@@ -180,6 +218,291 @@ private:
     int &r;
 };
 
+// Synchronizes a whole list with a reference list in near-linear time
+//
+// Identities are indexed by their hash, so that items of the cache are
+// matched with items of the reference list in a single pass. The changes
+// are then applied in three passes: items that are not in the reference
+// list are removed, items that are not in the longest increasing
+// subsequence of the matched items are moved, and new items are inserted.
+// Finally, matched items are updated.
+//
+// Consecutive items are removed, moved, inserted or updated together.
+// The cache is only read before the agent is called.
+template <typename Agent, typename CacheList, typename ReferenceList>
+class HashSynchronizeList
+{
+public:
+    HashSynchronizeList(Agent *agent, const CacheList &cache, const ReferenceList &reference)
+        : agent(agent), reference(reference)
+    {
+        const int cacheCount = cache.count();
+        const int referenceCount = reference.count();
+
+        // Index the reference list. Items that have the same hash
+        // are chained in ascending order.
+        QHash<quint64, int> heads;
+        QVector<int> next (referenceCount, -1);
+        heads.reserve(referenceCount);
+        for (int r = referenceCount - 1; r >= 0; --r) {
+            quint64 hash = identityHash(reference.at(r));
+            QHash<quint64, int>::iterator head = heads.find(hash);
+            if (head != heads.end()) {
+                next[r] = head.value();
+                head.value() = r;
+            } else {
+                heads.insert(hash, r);
+            }
+        }
+
+        // Match the items of the cache with the first unmatched
+        // reference item that has the same identity.
+        QVector<int> cacheToReference (cacheCount, -1);
+        QVector<bool> matched (referenceCount, false);
+        for (int c = 0; c < cacheCount; ++c) {
+            typename CacheList::const_reference cacheItem = cache.at(c);
+            QHash<quint64, int>::iterator head = heads.find(identityHash(cacheItem));
+            if (head == heads.end()) {
+                continue;
+            }
+
+            int previous = -1;
+            for (int r = head.value(); r != -1; previous = r, r = next.at(r)) {
+                if (!compareIdentity(cacheItem, reference.at(r))) {
+                    continue;
+                }
+
+                cacheToReference[c] = r;
+                matched[r] = true;
+
+                // Matched items are unlinked from their chain
+                if (previous == -1) {
+                    if (next.at(r) == -1) {
+                        heads.erase(head);
+                    } else {
+                        head.value() = next.at(r);
+                    }
+                } else {
+                    next[previous] = next.at(r);
+                }
+                break;
+            }
+        }
+
+        remove(cacheToReference);
+        move(cacheToReference, matched);
+        insert(matched);
+        update(matched);
+    }
+
+private:
+    // Remove the items that are not in the reference list, starting
+    // from the end so that the indexes of the remaining items are valid.
+    void remove(const QVector<int> &cacheToReference)
+    {
+        int c = cacheToReference.count() - 1;
+        while (c >= 0) {
+            if (cacheToReference.at(c) != -1) {
+                --c;
+                continue;
+            }
+
+            int last = c;
+            while (c >= 0 && cacheToReference.at(c) == -1) {
+                --c;
+            }
+            removeRange(agent, c + 1, last - c);
+        }
+    }
+
+    // Reorder the remaining items to follow the order of the reference list.
+    // Items in the longest increasing subsequence of reference indexes
+    // are not moved, and every other item is moved after its predecessor.
+    //
+    // A moved item ends up after the closest stable item that precedes it
+    // in the reference list, so the order of the cache is known in advance
+    // as a list of slots, where each item is followed by the items that are
+    // moved after it. Occupied slots are counted in a Fenwick tree, so that
+    // the index of an item is found in O(log n).
+    void move(const QVector<int> &cacheToReference, const QVector<bool> &matched)
+    {
+        QVector<int> current;
+        current.reserve(cacheToReference.count());
+        foreach (int r, cacheToReference) {
+            if (r != -1) {
+                current.append(r);
+            }
+        }
+
+        QVector<bool> stable (reference.count(), false);
+        markLongestIncreasingSequence(current, &stable);
+
+        QVector<int> target;
+        target.reserve(current.count());
+        for (int r = 0; r < matched.count(); ++r) {
+            if (matched.at(r)) {
+                target.append(r);
+            }
+        }
+
+        const int itemCount = current.count();
+        QVector<int> positions (reference.count(), -1);
+        for (int p = 0; p < itemCount; ++p) {
+            positions[current.at(p)] = p;
+        }
+
+        // Moved items are grouped after the item they follow. The
+        // first group holds the items that are moved to the front.
+        QVector<int> groups (itemCount, -1);
+        QVector<int> groupSizes (itemCount + 1, 0);
+        int group = 0;
+        int slotCount = itemCount;
+        for (int i = 0; i < itemCount; ++i) {
+            if (stable.at(target.at(i))) {
+                group = positions.at(target.at(i)) + 1;
+            } else {
+                groups[i] = group;
+                ++groupSizes[group];
+                ++slotCount;
+            }
+        }
+
+        QVector<int> slots (reference.count(), -1);
+        QVector<int> groupSlots (itemCount + 1, 0);  // next free slot of each group
+        QVector<int> tree (slotCount, 0);
+        int slot = 0;
+        for (int g = 0; g <= itemCount; ++g) {
+            if (g > 0) {
+                slots[current.at(g - 1)] = slot;
+                addToTree(&tree, slot, 1);
+                ++slot;
+            }
+            groupSlots[g] = slot;
+            slot += groupSizes.at(g);
+        }
+
+        int i = 0;
+        while (i < itemCount) {
+            if (stable.at(target.at(i))) {
+                ++i;
+                continue;
+            }
+
+            int index = countBefore(tree, slots.at(target.at(i)));
+            int destination = i == 0 ? 0 : countBefore(tree, slots.at(target.at(i - 1))) + 1;
+            int count = 1;
+            if (index != destination) {
+                while (i + count < itemCount && !stable.at(target.at(i + count))
+                       && countBefore(tree, slots.at(target.at(i + count))) == index + count) {
+                    ++count;
+                }
+
+                moveRange(agent, index, count, destination);
+            }
+
+            // Items that are already in place also take a slot in their
+            // group, so that the items moved after them are placed correctly
+            for (int j = i; j < i + count; ++j) {
+                int r = target.at(j);
+                addToTree(&tree, slots.at(r), -1);
+                slots[r] = groupSlots[groups.at(j)]++;
+                addToTree(&tree, slots.at(r), 1);
+            }
+
+            i += count;
+        }
+    }
+
+    // Insert the items that are not in the cache. Once the matched items are
+    // ordered, the index of an inserted item is its index in the reference list.
+    void insert(const QVector<bool> &matched)
+    {
+        int r = 0;
+        while (r < matched.count()) {
+            if (matched.at(r)) {
+                ++r;
+                continue;
+            }
+
+            int first = r;
+            while (r < matched.count() && !matched.at(r)) {
+                ++r;
+            }
+            insertRange(agent, first, r - first, reference, first);
+        }
+    }
+
+    void update(const QVector<bool> &matched)
+    {
+        int r = 0;
+        while (r < matched.count()) {
+            if (!matched.at(r)) {
+                ++r;
+                continue;
+            }
+
+            int first = r;
+            while (r < matched.count() && matched.at(r)) {
+                ++r;
+            }
+            updateRange(agent, first, r - first, reference, first);
+        }
+    }
+
+    // Add a value to a slot of a Fenwick tree
+    static void addToTree(QVector<int> *tree, int slot, int value)
+    {
+        for (int i = slot + 1; i <= tree->count(); i += i & -i) {
+            (*tree)[i - 1] += value;
+        }
+    }
+
+    // Number of occupied slots before a slot
+    static int countBefore(const QVector<int> &tree, int slot)
+    {
+        int count = 0;
+        for (int i = slot; i > 0; i -= i & -i) {
+            count += tree.at(i - 1);
+        }
+        return count;
+    }
+
+    // Patience sorting, in O(n log n)
+    static void markLongestIncreasingSequence(const QVector<int> &values, QVector<bool> *marks)
+    {
+        QVector<int> tails;         // index of the last value of the sequences of each length
+        QVector<int> predecessors (values.count(), -1);
+        for (int i = 0; i < values.count(); ++i) {
+            int low = 0;
+            int high = tails.count();
+            while (low < high) {
+                int middle = (low + high) / 2;
+                if (values.at(tails.at(middle)) < values.at(i)) {
+                    low = middle + 1;
+                } else {
+                    high = middle;
+                }
+            }
+
+            if (low > 0) {
+                predecessors[i] = tails.at(low - 1);
+            }
+            if (low == tails.count()) {
+                tails.append(i);
+            } else {
+                tails[low] = i;
+            }
+        }
+
+        for (int i = tails.isEmpty() ? -1 : tails.last(); i != -1; i = predecessors.at(i)) {
+            (*marks)[values.at(i)] = true;
+        }
+    }
+
+    Agent * const agent;
+    const ReferenceList &reference;
+};
+
 template <typename Agent, typename CacheList, typename ReferenceList>
 void completeSynchronizeList(
         Agent *agent,
@@ -211,14 +534,12 @@ void synchronizeList(
                 agent, cache, cacheIndex, reference, referenceIndex);
 }
 
+// Synchronizes a whole list, moving the items that were reordered.
+// The agent should implement insertRange, removeRange and moveRange.
 template <typename Agent, typename CacheList, typename ReferenceList>
 void synchronizeList(Agent *agent, const CacheList &cache, const ReferenceList &reference)
 {
-    int cacheIndex = 0;
-    int referenceIndex = 0;
-    SynchronizeList<Agent, CacheList, ReferenceList>(
-                agent, cache, cacheIndex, reference, referenceIndex);
-    completeSynchronizeList(agent, cache, cacheIndex, reference, referenceIndex);
+    HashSynchronizeList<Agent, CacheList, ReferenceList>(agent, cache, reference);
 }
 
 #endif
@@ -38,7 +38,8 @@ public:
         Retweeter,
         ConsumerKey,
         ConsumerSecret,
-        Accounts
+        Accounts,
+        SearchMatches
     };
     explicit TwitterPostsModel(QObject *parent = 0);
     QHash<int, QByteArray> roleNames() const;
@@ -1,2 +1,2 @@
 TEMPLATE = subdirs
-SUBDIRS = tst_abstractsocialcachedatabase tst_facebookimage
+SUBDIRS = tst_abstractsocialcachedatabase tst_abstractsocialcachemodel tst_facebookimage tst_facebookimagedownloader tst_synchronizelists
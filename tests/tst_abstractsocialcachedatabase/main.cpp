@@ -32,7 +32,12 @@
 #include <QtTest/QTest>
 #include "abstractsocialcachedatabase.h"
 #include "abstractsocialcachedatabase_p.h"
+#include "abstractsocialpostcachedatabase.h"
+#include "abstractsocialpostcachedatabase_p.h"
+#include "socialcachedatabasewatcher.h"
+#include <QtTest/QSignalSpy>
 #include <QtCore/QStandardPaths>
+#include <QtCore/QDateTime>
 #include <QtCore/QDebug>
 #include <QtCore/QDir>
 #include <QtSql/QSqlQuery>
@@ -330,6 +335,11 @@ protected:
             return false;
         }
 
+        if (!dbCreateChangeLog(QLatin1String("tests"), QLatin1String("id"),
+                               QLatin1String("tests"))) {
+            return false;
+        }
+
         query.prepare( "CREATE TABLE IF NOT EXISTS albums ("
                        "id INTEGER UNIQUE PRIMARY KEY AUTOINCREMENT,"
                        "value TEXT)");
@@ -371,6 +381,11 @@ protected:
             return false;
         }
 
+        query.prepare("DROP TABLE IF EXISTS changes");
+        if (!query.exec()) {
+            return false;
+        }
+
         return true;
     }
 private:
@@ -378,11 +393,75 @@ private:
 };
 
 
+class DummyPostDatabase: public AbstractSocialPostCacheDatabase
+{
+public:
+    explicit DummyPostDatabase()
+    {
+        initDatabase();
+    }
+
+    void initDatabase()
+    {
+        dbInit(QLatin1String("Test"), QLatin1String("Posts"),
+               QLatin1String("posts.db"), POST_DB_VERSION);
+    }
+
+    bool hasSearchIndex() const
+    {
+        Q_D(const AbstractSocialPostCacheDatabase);
+        return d->searchIndex;
+    }
+
+    // Search with LIKE patterns, as when FTS5 is not available
+    void disableSearchIndex()
+    {
+        Q_D(AbstractSocialPostCacheDatabase);
+        d->searchIndex = false;
+    }
+
+    int indexedPosts() const
+    {
+        Q_D(const AbstractSocialPostCacheDatabase);
+        QSqlQuery query(d->db);
+        if (!query.exec(QLatin1String("SELECT COUNT(*) FROM posts_fts")) || !query.next()) {
+            return -1;
+        }
+        return query.value(0).toInt();
+    }
+
+    void addTestPost(const QString &identifier, const QString &name, const QString &body,
+                     uint timestamp, const QVariantMap &extra, int account)
+    {
+        addPost(identifier, name, body, QDateTime::fromTime_t(timestamp), QString(),
+                QList<QPair<QString, SocialPostImage::ImageType> >(), extra, account);
+    }
+private:
+    Q_DECLARE_PRIVATE(AbstractSocialPostCacheDatabase)
+};
+
+
 class AbstractSocialCacheDatabaseTest: public QObject
 {
     Q_OBJECT
 private:
     DummyDatabase *db;
+
+    static QStringList identifiers(const QList<SocialPost::ConstPtr> &posts)
+    {
+        QStringList result;
+        foreach (const SocialPost::ConstPtr &post, posts) {
+            result.append(post->identifier());
+        }
+        return result;
+    }
+
+    static SocialCacheQuery searchQuery(const QString &search)
+    {
+        SocialCacheQuery query;
+        query.search = search;
+        return query;
+    }
 private slots:
     // Perform some cleanups
     // we basically remove the whole ~/.local/share/system/privileged. While it is
@@ -407,6 +486,171 @@ private slots:
         QVERIFY(db->checkDelete());
     }
 
+    void testWatcher()
+    {
+        SocialCacheDatabaseWatcher watcher (db);
+        QSignalSpy changed (&watcher, SIGNAL(changed()));
+        QSignalSpy tableChanged (&watcher, SIGNAL(tableChanged(QString)));
+
+        // Changes committed by another connection
+        DummyDatabase writer;
+        QVERIFY(writer.isValid());
+        QVERIFY(writer.testInsert());
+        QTRY_COMPARE(changed.count(), 1);
+        QCOMPARE(tableChanged.count(), 1);
+        QCOMPARE(tableChanged.at(0).at(0).toString(), QLatin1String("tests"));
+        QVERIFY(writer.closeDatabase());
+
+        // Changes committed by the connection of the database
+        QVERIFY(db->testUpdate());
+        QTRY_COMPARE(changed.count(), 2);
+        QCOMPARE(tableChanged.count(), 2);
+    }
+
+    void testQueryClauses()
+    {
+        QHash<QString, QString> columns;
+        columns.insert(QLatin1String("account"), QLatin1String("id IN (SELECT id FROM a WHERE a %1)"));
+        columns.insert(QLatin1String("name"), QLatin1String("t.name"));
+        columns.insert(QLatin1String("time"), QLatin1String("t.time"));
+
+        SocialCacheQuery query;
+        query.sortField = QLatin1String("time");
+        query.sortOrder = Qt::DescendingOrder;
+        query.filters.insert(QLatin1String("account"), QVariantList() << 1 << 2);
+        query.filters.insert(QLatin1String("name"), QLatin1String("a"));
+        query.filters.insert(QLatin1String("unknown"), 1);
+
+        QVariantMap range;
+        range.insert(QLatin1String("from"), QDateTime::fromTime_t(10));
+        range.insert(QLatin1String("to"), 20);
+        query.filters.insert(QLatin1String("time"), range);
+
+        QStringList conditions;
+        QString orderBy;
+        QVariantMap values;
+        AbstractSocialCacheDatabasePrivate::queryClauses(query, columns, &conditions, &orderBy,
+                                                         &values);
+        QCOMPARE(conditions, QStringList()
+                 << QLatin1String("id IN (SELECT id FROM a WHERE a IN (:query0, :query1))")
+                 << QLatin1String("t.name = :query2")
+                 << QLatin1String("t.time >= :query3")
+                 << QLatin1String("t.time <= :query4"));
+        QCOMPARE(orderBy, QLatin1String("t.time DESC"));
+        QCOMPARE(values.value(QLatin1String(":query1")).toInt(), 2);
+        QCOMPARE(values.value(QLatin1String(":query3")).toUInt(), 10u);
+
+        // Only columns can be used for sorting
+        query.sortField = QLatin1String("account");
+        orderBy.clear();
+        AbstractSocialCacheDatabasePrivate::queryClauses(query, columns, &conditions, &orderBy,
+                                                         &values);
+        QVERIFY(orderBy.isEmpty());
+    }
+
+    void testSearch()
+    {
+        DummyPostDatabase posts;
+        QVERIFY(posts.isValid());
+
+        QVariantMap extra;
+        extra.insert(QLatin1String("caption"), QLatin1String("Holiday pictures"));
+        posts.addTestPost(QLatin1String("a"), QLatin1String("Alice"),
+                          QLatin1String("The quick brown fox jumps over the lazy dog"),
+                          10, extra, 1);
+        posts.addTestPost(QLatin1String("b"), QLatin1String("Bob"), QLatin1String("Fox fox"),
+                          20, QVariantMap(), 1);
+        posts.addTestPost(QLatin1String("c"), QLatin1String("Carol"),
+                          QLatin1String("100% done_now"), 30, QVariantMap(), 2);
+        QVERIFY(posts.write());
+
+        // Names and bodies are read back in their own columns
+        QList<SocialPost::ConstPtr> all = posts.posts();
+        QCOMPARE(identifiers(all), QStringList() << QLatin1String("c") << QLatin1String("b")
+                                                 << QLatin1String("a"));
+        QCOMPARE(all.at(2)->name(), QLatin1String("Alice"));
+        QCOMPARE(all.at(2)->body(), QLatin1String("The quick brown fox jumps over the lazy dog"));
+
+        if (!posts.hasSearchIndex()) {
+            QSKIP("FTS5 is not available");
+        }
+        QCOMPARE(posts.indexedPosts(), 3);
+
+        // The post where the word is more frequent ranks first
+        QList<SocialPostMatches> matches;
+        QList<SocialPost::ConstPtr> found = posts.search(searchQuery(QLatin1String("fox")),
+                                                         &matches);
+        QCOMPARE(identifiers(found), QStringList() << QLatin1String("b") << QLatin1String("a"));
+        QCOMPARE(matches.count(), 2);
+        QCOMPARE(matches.at(0), SocialPostMatches() << qMakePair(0, 3) << qMakePair(4, 3));
+        QCOMPARE(matches.at(1), SocialPostMatches() << qMakePair(16, 3));
+
+        // Extra values are indexed, but only bodies are highlighted
+        matches.clear();
+        found = posts.search(searchQuery(QLatin1String("holiday")), &matches);
+        QCOMPARE(identifiers(found), QStringList() << QLatin1String("a"));
+        QCOMPARE(matches, QList<SocialPostMatches>() << SocialPostMatches());
+
+        // Every word should match
+        found = posts.search(searchQuery(QLatin1String("fox dog")));
+        QCOMPARE(identifiers(found), QStringList() << QLatin1String("a"));
+
+        // A post written again is indexed again
+        posts.addTestPost(QLatin1String("b"), QLatin1String("Bob"), QLatin1String("A cat"),
+                          20, QVariantMap(), 1);
+        QVERIFY(posts.write());
+        QCOMPARE(posts.indexedPosts(), 3);
+        QCOMPARE(identifiers(posts.search(searchQuery(QLatin1String("fox")))),
+                 QStringList() << QLatin1String("a"));
+        QCOMPARE(identifiers(posts.search(searchQuery(QLatin1String("cat")))),
+                 QStringList() << QLatin1String("b"));
+
+        QVERIFY(posts.closeDatabase());
+    }
+
+    void testSearchWithoutIndex()
+    {
+        DummyPostDatabase posts;
+        QVERIFY(posts.isValid());
+        posts.disableSearchIndex();
+
+        // Wildcards of LIKE patterns are matched as they are
+        QList<SocialPostMatches> matches;
+        QList<SocialPost::ConstPtr> found = posts.search(searchQuery(QLatin1String("%")),
+                                                         &matches);
+        QCOMPARE(identifiers(found), QStringList() << QLatin1String("c"));
+        QCOMPARE(matches, QList<SocialPostMatches>()
+                          << (SocialPostMatches() << qMakePair(3, 1)));
+        QCOMPARE(identifiers(posts.search(searchQuery(QLatin1String("e_n")))),
+                 QStringList() << QLatin1String("c"));
+        QVERIFY(posts.search(searchQuery(QLatin1String("1_0"))).isEmpty());
+
+        // Names and extra values are searched, as with the index
+        QCOMPARE(identifiers(posts.search(searchQuery(QLatin1String("carol")))),
+                 QStringList() << QLatin1String("c"));
+        QCOMPARE(identifiers(posts.search(searchQuery(QLatin1String("holiday")))),
+                 QStringList() << QLatin1String("a"));
+
+        QVERIFY(posts.closeDatabase());
+    }
+
+    void testRemovePosts()
+    {
+        DummyPostDatabase posts;
+        QVERIFY(posts.isValid());
+
+        posts.removePosts(2);
+        QVERIFY(posts.write());
+        QCOMPARE(identifiers(posts.posts()), QStringList() << QLatin1String("b")
+                                                           << QLatin1String("a"));
+        QVERIFY(posts.search(searchQuery(QLatin1String("carol"))).isEmpty());
+        if (posts.hasSearchIndex()) {
+            QCOMPARE(posts.indexedPosts(), 2);
+        }
+
+        QVERIFY(posts.closeDatabase());
+    }
+
     void insertionBenchmarkBatch()
     {
         db->clean();
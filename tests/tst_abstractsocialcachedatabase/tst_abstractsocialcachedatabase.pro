@@ -8,9 +8,14 @@ INCLUDEPATH += ../../src/lib/
 
 HEADERS +=  ../../src/lib/abstractsocialcachedatabase.h \
             ../../src/lib/abstractsocialcachedatabase_p.h \
-            ../../src/lib/semaphore_p.h
+            ../../src/lib/abstractsocialpostcachedatabase.h \
+            ../../src/lib/abstractsocialpostcachedatabase_p.h \
+            ../../src/lib/semaphore_p.h \
+            ../../src/lib/socialcachedatabasewatcher.h
 
 SOURCES +=  ../../src/lib/abstractsocialcachedatabase.cpp \
+            ../../src/lib/abstractsocialpostcachedatabase.cpp \
             ../../src/lib/semaphore_p.cpp \
+            ../../src/lib/socialcachedatabasewatcher.cpp \
             main.cpp
 
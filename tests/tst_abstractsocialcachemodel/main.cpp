@@ -0,0 +1,426 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * Neither the name of Nemo Mobile nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include <QtTest/QTest>
+#include <QtTest/QSignalSpy>
+#include <QtCore/QDateTime>
+#include <QtCore/QDir>
+#include <QtCore/QStandardPaths>
+#include <QtCore/QStringList>
+
+#include "abstractsocialcachemodel.h"
+#include "abstractsocialcachemodel_p.h"
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+static const int ROW_COUNT = 50000;
+static const int ROLE_COUNT = 12;
+
+// Bytes allocated on the heap, or -1 if unknown
+static qint64 allocatedBytes()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    return mallinfo2().uordblks;
+#elif defined(__GLIBC__)
+    return mallinfo().uordblks;
+#else
+    return -1;
+#endif
+}
+
+class DummyModelPrivate: public AbstractSocialCacheModelPrivate
+{
+public:
+    explicit DummyModelPrivate(AbstractSocialCacheModel *q)
+        : AbstractSocialCacheModelPrivate(q)
+    {
+    }
+
+protected:
+    bool isLazySupported() const
+    {
+        return true;
+    }
+};
+
+class DummyModel: public AbstractSocialCacheModel
+{
+public:
+    explicit DummyModel()
+        : AbstractSocialCacheModel(*(new DummyModelPrivate(this)))
+    {
+    }
+
+    AbstractSocialCacheModelPrivate *d() const
+    {
+        return d_ptr.data();
+    }
+};
+
+class AbstractSocialCacheModelTest: public QObject
+{
+    Q_OBJECT
+private:
+    // Rows shaped like the rows of the image model. The strings are
+    // created beforehand, so that only the rows are allocated.
+    SocialCacheModelData createRows(const QStringList &identifiers)
+    {
+        QDateTime dateTime = QDateTime::currentDateTime();
+        SocialCacheModelData data;
+        for (int i = 0; i < identifiers.count(); ++i) {
+            SocialCacheModelRow row;
+            row.insert(0, identifiers.at(i));
+            for (int role = 1; role < ROLE_COUNT; ++role) {
+                if (role % 3 == 0) {
+                    row.insert(role, dateTime);
+                } else if (role % 3 == 1) {
+                    row.insert(role, identifiers.at(i));
+                } else {
+                    row.insert(role, i);
+                }
+            }
+            data.append(row);
+        }
+        return data;
+    }
+
+    QStringList createIdentifiers(int count)
+    {
+        QStringList identifiers;
+        for (int i = 0; i < count; ++i) {
+            identifiers.append(QString::number(i));
+        }
+        return identifiers;
+    }
+
+private slots:
+    void initTestCase()
+    {
+        QStandardPaths::enableTestMode(true);
+
+        QDir dir (PRIVILEGED_DATA_DIR + QLatin1String("Snapshots"));
+        dir.removeRecursively();
+    }
+
+    void testFields()
+    {
+        DummyModel model;
+        model.updateData(createRows(createIdentifiers(3)));
+        QCOMPARE(model.count(), 3);
+        QCOMPARE(model.getField(1, 0).toString(), QLatin1String("1"));
+        QCOMPARE(model.getField(2, 2).toInt(), 2);
+        QVERIFY(!model.getField(0, ROLE_COUNT).isValid());
+        QVERIFY(!model.getField(0, -1).isValid());
+        QVERIFY(!model.getField(3, 0).isValid());
+
+        SocialCacheModelRow row;
+        row.insert(2, 42);
+        row.insert(ROLE_COUNT + 1, QLatin1String("extra"));
+        model.updateRow(1, row);
+        QCOMPARE(model.getField(1, 0).toString(), QLatin1String("1"));
+        QCOMPARE(model.getField(1, 2).toInt(), 42);
+        QVERIFY(!model.getField(1, ROLE_COUNT).isValid());
+        QCOMPARE(model.getField(1, ROLE_COUNT + 1).toString(), QLatin1String("extra"));
+    }
+
+    void testSignals()
+    {
+        QStringList identifiers = createIdentifiers(400);
+        SocialCacheModelData rows = createRows(identifiers);
+
+        DummyModel model;
+        model.updateData(rows.mid(0, 200));
+
+        QSignalSpy inserted (&model, SIGNAL(rowsInserted(QModelIndex,int,int)));
+        QSignalSpy reset (&model, SIGNAL(modelReset()));
+        QSignalSpy changed (&model, SIGNAL(dataChanged(QModelIndex,QModelIndex)));
+
+        // A few insertions are reported one by one
+        SocialCacheModelData data = rows.mid(0, 200);
+        data.insert(100, rows.at(300));
+        data.insert(0, rows.at(301));
+        model.updateData(data);
+        QCOMPARE(inserted.count(), 2);
+        QCOMPARE(reset.count(), 0);
+        QCOMPARE(model.getField(0, 0).toString(), QLatin1String("301"));
+        QCOMPARE(model.getField(101, 0).toString(), QLatin1String("300"));
+
+        // Many insertions are reported as a reset
+        data.clear();
+        for (int i = 0; i < 200; ++i) {
+            data.append(rows.at(i));
+            data.append(rows.at(200 + i));
+        }
+        model.updateData(data);
+        QCOMPARE(inserted.count(), 2);
+        QCOMPARE(reset.count(), 1);
+        QCOMPARE(model.count(), 400);
+        QCOMPARE(model.getField(399, 0).toString(), QLatin1String("399"));
+
+        // Updates are reported at once
+        changed.clear();
+        for (int i = 10; i < 20; ++i) {
+            data[i].insert(2, -i);
+        }
+        model.updateData(data);
+        QCOMPARE(changed.count(), 1);
+        QCOMPARE(changed.at(0).at(0).value<QModelIndex>().row(), 0);
+        QCOMPARE(changed.at(0).at(1).value<QModelIndex>().row(), 399);
+        QCOMPARE(model.getField(15, 2).toInt(), -15);
+    }
+
+    void testIdentifierRow()
+    {
+        QStringList identifiers = createIdentifiers(10);
+        SocialCacheModelData rows = createRows(identifiers);
+
+        DummyModel model;
+        model.updateData(rows);
+        QCOMPARE(model.d()->identifierRow(QLatin1String("5")), 5);
+        QCOMPARE(model.d()->identifierRow(QLatin1String("10")), -1);
+
+        // Rows are found after they are inserted, removed or moved
+        SocialCacheModelData data = rows;
+        data.removeAt(7);
+        data.move(2, 0);
+        data.prepend(createRows(QStringList() << QLatin1String("10")).first());
+        model.updateData(data);
+        QCOMPARE(model.d()->identifierRow(QLatin1String("10")), 0);
+        QCOMPARE(model.d()->identifierRow(QLatin1String("2")), 1);
+        QCOMPARE(model.d()->identifierRow(QLatin1String("5")), 6);
+        QCOMPARE(model.d()->identifierRow(QLatin1String("7")), -1);
+        QCOMPARE(model.d()->identifierRow(QLatin1String("9")), 9);
+    }
+
+    void testUpdateDelay()
+    {
+        qRegisterMetaType<QVector<int> >();
+
+        DummyModel model;
+        model.updateData(createRows(createIdentifiers(10)));
+        QCOMPARE(model.updateDelay(), 16);
+
+        QSignalSpy changed (&model, SIGNAL(dataChanged(QModelIndex,QModelIndex,QVector<int>)));
+
+        // Changed fields are reported later, by ranges of rows
+        SocialCacheModelRow row;
+        row.insert(2, 42);
+        model.updateRow(3, row);
+        model.updateRow(4, row);
+        row.clear();
+        row.insert(1, QLatin1String("a"));
+        model.updateRow(5, row);
+        model.updateRow(8, row);
+        QCOMPARE(model.getField(4, 2).toInt(), 42);
+        QCOMPARE(changed.count(), 0);
+
+        QTRY_COMPARE(changed.count(), 2);
+        QCOMPARE(changed.at(0).at(0).value<QModelIndex>().row(), 3);
+        QCOMPARE(changed.at(0).at(1).value<QModelIndex>().row(), 5);
+        QCOMPARE(changed.at(0).at(2).value<QVector<int> >(), QVector<int>() << 2 << 1);
+        QCOMPARE(changed.at(1).at(0).value<QModelIndex>().row(), 8);
+        QCOMPARE(changed.at(1).at(2).value<QVector<int> >(), QVector<int>() << 1);
+
+        // Without delay, they are reported immediately
+        model.setUpdateDelay(0);
+        model.updateRow(1, row);
+        QCOMPARE(changed.count(), 3);
+    }
+
+    void testSnapshot()
+    {
+        SocialCacheModelData rows = createRows(createIdentifiers(10));
+
+        DummyModel *model = new DummyModel;
+        model->setSnapshotEnabled(true);
+        model->setNodeIdentifier(QLatin1String("node"));
+        model->updateData(rows);
+        delete model;
+
+        // Snapshots are only shown for the same node
+        DummyModel otherModel;
+        otherModel.setSnapshotEnabled(true);
+        otherModel.setNodeIdentifier(QLatin1String("other"));
+        otherModel.refresh();
+        QCOMPARE(otherModel.count(), 0);
+
+        // and for the same sorting and filters
+        DummyModel sortedModel;
+        sortedModel.setSnapshotEnabled(true);
+        sortedModel.setNodeIdentifier(QLatin1String("node"));
+        sortedModel.setSortField(QLatin1String("value"));
+        sortedModel.refresh();
+        QCOMPARE(sortedModel.count(), 0);
+
+        DummyModel snapshotModel;
+        snapshotModel.setSnapshotEnabled(true);
+        snapshotModel.setNodeIdentifier(QLatin1String("node"));
+        snapshotModel.refresh();
+        QCOMPARE(snapshotModel.count(), 10);
+        QCOMPARE(snapshotModel.getField(3, 0).toString(), QLatin1String("3"));
+        QCOMPARE(snapshotModel.getField(3, 2).toInt(), 3);
+    }
+
+    void testLazy()
+    {
+        const int count = 2000;
+        QStringList identifiers = createIdentifiers(count);
+        SocialCacheModelData rows = createRows(identifiers);
+        SocialCacheModelData identityRows;
+        foreach (const QString &identifier, identifiers) {
+            SocialCacheModelRow row;
+            row.insert(0, identifier);
+            identityRows.append(row);
+        }
+
+        DummyModel model;
+        model.setLazy(true);
+        model.updateData(identityRows);
+        QCOMPARE(model.count(), count);
+
+        QSignalSpy requested (model.d(), SIGNAL(rowsRequested(int,QStringList)));
+        QSignalSpy changed (&model, SIGNAL(dataChanged(QModelIndex,QModelIndex)));
+
+        // The page of the row is requested, and the next one is read ahead
+        QVERIFY(!model.getField(30, 1).isValid());
+        QCOMPARE(model.getField(30, 0).toString(), QLatin1String("30"));
+        QCOMPARE(requested.count(), 2);
+        QCOMPARE(requested.at(0).at(0).toInt(), 0);
+        QCOMPARE(requested.at(0).at(1).toStringList(), identifiers.mid(0, 50));
+        QCOMPARE(requested.at(1).at(0).toInt(), 50);
+
+        // Contiguous rows are reported at once
+        model.d()->updateRows(0, rows.mid(0, 50));
+        QCOMPARE(changed.count(), 1);
+        QCOMPARE(model.getField(30, 2).toInt(), 30);
+        QCOMPARE(requested.count(), 2);
+
+        // Rows that moved since they were requested are found
+        SocialCacheModelData moved = identityRows;
+        moved.move(60, 0);
+        model.updateData(moved);
+        model.d()->updateRows(50, rows.mid(50, 50));
+        QCOMPARE(model.getField(0, 2).toInt(), 60);
+        QCOMPARE(model.getField(61, 2).toInt(), 61);
+
+        // Only the most recently used pages are kept
+        while (model.canFetchMore(QModelIndex())) {
+            int index = requested.count();
+            model.fetchMore(QModelIndex());
+            QCOMPARE(requested.count(), index + 1);
+            int first = requested.at(index).at(0).toInt();
+            QStringList requestedIdentifiers = requested.at(index).at(1).toStringList();
+            SocialCacheModelData fetched;
+            foreach (const QString &identifier, requestedIdentifiers) {
+                fetched.append(rows.at(identifier.toInt()));
+            }
+            model.d()->updateRows(first, fetched);
+        }
+
+        int materialized = 0;
+        for (int row = 0; row < count; ++row) {
+            if (model.d()->isMaterialized(row)) {
+                ++materialized;
+            }
+        }
+        QCOMPARE(materialized, 20 * 50);
+        QVERIFY(model.d()->isMaterialized(count - 1));
+        QVERIFY(!model.d()->isMaterialized(0));
+    }
+
+    void benchmarkMemory()
+    {
+        if (allocatedBytes() < 0) {
+            QSKIP("Heap usage is not known on this platform");
+        }
+
+        QStringList identifiers = createIdentifiers(ROW_COUNT);
+
+        qint64 before = allocatedBytes();
+        SocialCacheModelData data = createRows(identifiers);
+        qint64 mapBytes = allocatedBytes() - before;
+
+        DummyModel model;
+        before = allocatedBytes();
+        model.updateData(data);
+        qint64 modelBytes = allocatedBytes() - before;
+
+        qDebug() << "Bytes per row:" << mapBytes / ROW_COUNT << "in maps,"
+                 << modelBytes / ROW_COUNT << "in the model";
+        QCOMPARE(model.count(), ROW_COUNT);
+        QVERIFY(modelBytes < mapBytes);
+        QTest::setBenchmarkResult(modelBytes / ROW_COUNT, QTest::BytesAllocated);
+    }
+
+    void benchmarkLookup_data()
+    {
+        QTest::addColumn<bool>("map");
+
+        QTest::newRow("map") << true;
+        QTest::newRow("model") << false;
+    }
+
+    void benchmarkLookup()
+    {
+        QFETCH(bool, map);
+
+        SocialCacheModelData data = createRows(createIdentifiers(ROW_COUNT));
+        DummyModel model;
+        model.updateData(data);
+
+        int valid = 0;
+        QBENCHMARK {
+            valid = 0;
+            for (int row = 0; row < ROW_COUNT; ++row) {
+                for (int role = 0; role < ROLE_COUNT; ++role) {
+                    QVariant value = map ? data.at(row).value(role) : model.getField(row, role);
+                    if (value.isValid()) {
+                        ++valid;
+                    }
+                }
+            }
+        }
+
+        QCOMPARE(valid, ROW_COUNT * ROLE_COUNT);
+    }
+
+    void cleanupTestCase()
+    {
+        QDir dir (PRIVILEGED_DATA_DIR + QLatin1String("Snapshots"));
+        dir.removeRecursively();
+    }
+};
+
+QTEST_MAIN(AbstractSocialCacheModelTest)
+
+#include "main.moc"
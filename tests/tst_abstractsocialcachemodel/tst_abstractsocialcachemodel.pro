@@ -0,0 +1,24 @@
+include(../../common.pri)
+
+TEMPLATE = app
+TARGET = tst_abstractsocialcachemodel
+QT += sql testlib
+
+INCLUDEPATH += ../../src/lib/
+INCLUDEPATH += ../../src/qml/
+
+HEADERS +=  ../../src/lib/semaphore_p.h \
+            ../../src/lib/abstractsocialcachedatabase.h \
+            ../../src/lib/abstractsocialcachedatabase_p.h \
+            ../../src/lib/socialcachedatabasewatcher.h \
+            ../../src/qml/synchronizelists_p.h \
+            ../../src/qml/abstractsocialcachemodel.h \
+            ../../src/qml/abstractsocialcachemodel_p.h \
+            ../../src/qml/socialcacheworkerpool_p.h
+
+SOURCES +=  ../../src/lib/semaphore_p.cpp \
+            ../../src/lib/abstractsocialcachedatabase.cpp \
+            ../../src/lib/socialcachedatabasewatcher.cpp \
+            ../../src/qml/abstractsocialcachemodel.cpp \
+            ../../src/qml/socialcacheworkerpool.cpp \
+            main.cpp
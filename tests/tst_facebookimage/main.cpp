@@ -122,6 +122,89 @@ private slots:
         QCOMPARE(model.count(), 2);
     }
 
+    void testImageValidators()
+    {
+        const QString url = QLatin1String("http://example.com/image.jpg");
+        const QString file = QLatin1String("/tmp/image.jpg");
+
+        QVERIFY(!fbDb->imageValidators(url, 0, 0, 0, 0));
+
+        fbDb->updateImageValidators(url, file, QLatin1String("\"abc\""),
+                                    QLatin1String("Wed, 02 Jan 2013 12:34:56 GMT"), 1234);
+
+        // Queued validators are already visible
+        QString etag;
+        qint64 size = -1;
+        QVERIFY(fbDb->imageValidators(url, 0, &etag, 0, &size));
+        QCOMPARE(etag, QLatin1String("\"abc\""));
+        QCOMPARE(size, qint64(1234));
+
+        QVERIFY(fbDb->write());
+
+        QSqlQuery query (*checkDb);
+        query.prepare("SELECT url, file, etag, lastModified, size FROM validators");
+        QVERIFY(query.exec());
+        QVERIFY(query.next());
+        QCOMPARE(query.value(0).toString(), url);
+        QCOMPARE(query.value(1).toString(), file);
+        QCOMPARE(query.value(2).toString(), QLatin1String("\"abc\""));
+        QCOMPARE(query.value(3).toString(), QLatin1String("Wed, 02 Jan 2013 12:34:56 GMT"));
+        QCOMPARE(query.value(4).toLongLong(), qint64(1234));
+        QVERIFY(!query.next());
+
+        QString validatorFile;
+        QString lastModified;
+        QVERIFY(fbDb->imageValidators(url, &validatorFile, &etag, &lastModified, &size));
+        QCOMPARE(validatorFile, file);
+        QCOMPARE(etag, QLatin1String("\"abc\""));
+        QCOMPARE(lastModified, QLatin1String("Wed, 02 Jan 2013 12:34:56 GMT"));
+        QCOMPARE(size, qint64(1234));
+    }
+
+    void testSearchNames()
+    {
+        QDateTime time (QDate(2013, 1, 2), QTime(12, 34, 56));
+
+        fbDb->addUser("g", time, QString::fromUtf8("\xc3\x89mile Zola"));
+        fbDb->addAlbum("h", "g", time, time, QLatin1String("Summer holidays 2013"), 0);
+        fbDb->addAlbum("i", "g", time, time, QLatin1String("Winter"), 0);
+        QVERIFY(fbDb->write());
+
+        // Words are matched by prefix, ignoring case and diacritics
+        QList<FacebookUser::ConstPtr> users = fbDb->users(QLatin1String("emi"));
+        QCOMPARE(users.count(), 1);
+        QCOMPARE(users[0]->fbUserId(), QLatin1String("g"));
+        QCOMPARE(fbDb->users(QLatin1String("zola E")).count(), 1);
+        QCOMPARE(fbDb->users(QLatin1String("mile")).count(), 0);
+
+        QList<FacebookAlbum::ConstPtr> albums = fbDb->albums(QString(), QLatin1String("HOL 2013"));
+        QCOMPARE(albums.count(), 1);
+        QCOMPARE(albums[0]->fbAlbumId(), QLatin1String("h"));
+        QCOMPARE(fbDb->albums(QLatin1String("g"), QLatin1String("w")).count(), 1);
+        QCOMPARE(fbDb->albums(QLatin1String("a"), QLatin1String("w")).count(), 0);
+
+        // Renamed albums are indexed again
+        fbDb->addAlbum("i", "g", time, time, QLatin1String("Autumn"), 0);
+        QVERIFY(fbDb->write());
+        QCOMPARE(fbDb->albums(QString(), QLatin1String("win")).count(), 0);
+        QCOMPARE(fbDb->albums(QString(), QLatin1String("aut")).count(), 1);
+
+        // Names of removed albums are removed
+        fbDb->removeAlbum(QLatin1String("h"));
+        QCOMPARE(fbDb->albums(QString(), QLatin1String("summer")).count(), 0);
+
+        QSqlQuery query (*checkDb);
+        query.prepare("SELECT token FROM nameTokens WHERE identifier = 'h'");
+        QVERIFY(query.exec());
+        QVERIFY(!query.next());
+
+        // Letters outside of the BMP are part of words
+        fbDb->addAlbum("j", "g", time, time, QString::fromUtf8("\xf0\xa0\x80\x80\xf0\xa0\x80\x81"), 0);
+        QVERIFY(fbDb->write());
+        QCOMPARE(fbDb->albums(QString(), QString::fromUtf8("\xf0\xa0\x80\x80")).count(), 1);
+        QCOMPARE(fbDb->albums(QString(), QString::fromUtf8("\xf0\xa0\x80\x81")).count(), 0);
+    }
+
     // TODO: more tests
 
 
@@ -2,7 +2,7 @@ include(../../common.pri)
 
 TEMPLATE = app
 TARGET = tst_facebookimage
-QT += network sql testlib
+QT += gui network sql testlib
 
 DEFINES += NO_KEY_PROVIDER
 
@@ -16,8 +16,11 @@ HEADERS +=  ../../src/lib/semaphore_p.h \
             ../../src/lib/facebookimagesdatabase.h \
             ../../src/lib/abstractimagedownloader.h \
             ../../src/lib/abstractimagedownloader_p.h \
+            ../../src/lib/imageatlas.h \
+            ../../src/lib/socialcachedatabasewatcher.h \
             ../../src/qml/abstractsocialcachemodel.h \
             ../../src/qml/abstractsocialcachemodel_p.h \
+            ../../src/qml/socialcacheworkerpool_p.h \
             ../../src/qml/facebook/facebookimagecachemodel.h \
             ../../src/qml/facebook/facebookimagedownloader_p.h \
             ../../src/qml/facebook/facebookimagedownloader.h
@@ -27,7 +30,10 @@ SOURCES +=  ../../src/lib/semaphore_p.cpp \
             ../../src/lib/abstractsocialcachedatabase.cpp \
             ../../src/lib/facebookimagesdatabase.cpp \
             ../../src/lib/abstractimagedownloader.cpp \
+            ../../src/lib/imageatlas.cpp \
+            ../../src/lib/socialcachedatabasewatcher.cpp \
             ../../src/qml/abstractsocialcachemodel.cpp \
+            ../../src/qml/socialcacheworkerpool.cpp \
             ../../src/qml/facebook/facebookimagecachemodel.cpp \
             ../../src/qml/facebook/facebookimagedownloader.cpp \
             main.cpp
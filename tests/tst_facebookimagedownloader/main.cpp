@@ -0,0 +1,688 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd. <lucien.xu@jollamobile.com>
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * Neither the name of Nemo Mobile nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include <QtTest/QTest>
+#include <QtTest/QSignalSpy>
+#include "facebookimagesdatabase.h"
+#include "socialsyncinterface.h"
+#include "facebook/facebookimagedownloader_p.h"
+#include "facebook/facebookimagedownloaderconstants_p.h"
+#include <QtCore/QBuffer>
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDebug>
+#include <QtCore/QDir>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QStandardPaths>
+#include <QtCore/QTimer>
+#include <QtGui/QImage>
+#include <QtNetwork/QTcpServer>
+#include <QtNetwork/QTcpSocket>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlQuery>
+
+// A local HTTP server standing in for the Facebook CDN
+//
+// Every path is answered with the same fixture JPEG, with an ETag,
+// so that conditional requests are answered with 304 until the
+// fixture is changed. Paths starting with redirect/ are redirected
+// to the rest of the path, as Graph picture URLs are. Latency,
+// bandwidth, error rate and connection resets can be configured.
+class HttpServer: public QTcpServer
+{
+    Q_OBJECT
+public:
+    explicit HttpServer(const QByteArray &body)
+        : body(body), etag("\"fixture\""), latency(0), bandwidth(0), errorRate(0), resetRate(0)
+        , requestCount(0), notModifiedCount(0), redirectCount(0), errorCount(0)
+        , resetCount(0), connectionCount(0)
+    {
+        connect(this, &QTcpServer::newConnection, this, &HttpServer::acceptConnections);
+    }
+
+    QString url(const QString &path) const
+    {
+        return QString(QLatin1String("http://127.0.0.1:%1/%2")).arg(serverPort()).arg(path);
+    }
+
+    void resetCounters()
+    {
+        requestCount = 0;
+        notModifiedCount = 0;
+        redirectCount = 0;
+        errorCount = 0;
+        resetCount = 0;
+        connectionCount = 0;
+    }
+
+    QByteArray body;
+    QByteArray etag;
+    int latency;        // ms before answering a request
+    qint64 bandwidth;   // bytes per second per connection, 0 for no limit
+    int errorRate;      // percentage of requests answered with 500
+    int resetRate;      // percentage of requests answered by closing the connection
+
+    int requestCount;
+    int notModifiedCount;
+    int redirectCount;
+    int errorCount;
+    int resetCount;
+    int connectionCount;
+
+private Q_SLOTS:
+    void acceptConnections();
+};
+
+class HttpConnection: public QObject
+{
+    Q_OBJECT
+public:
+    explicit HttpConnection(HttpServer *server, QTcpSocket *socket)
+        : QObject(socket), m_server(server), m_socket(socket)
+    {
+        m_latencyTimer.setSingleShot(true);
+        connect(&m_latencyTimer, &QTimer::timeout, this, &HttpConnection::sendResponse);
+        m_bandwidthTimer.setInterval(10);
+        connect(&m_bandwidthTimer, &QTimer::timeout, this, &HttpConnection::writeChunk);
+        connect(m_socket, &QIODevice::readyRead, this, &HttpConnection::readRequest);
+        connect(m_socket, &QAbstractSocket::disconnected, m_socket, &QObject::deleteLater);
+    }
+
+private Q_SLOTS:
+    void readRequest()
+    {
+        m_request.append(m_socket->readAll());
+        if (m_latencyTimer.isActive() || !m_response.isEmpty()) {
+            return; // Requests are not pipelined
+        }
+
+        int end = m_request.indexOf("\r\n\r\n");
+        if (end < 0) {
+            return;
+        }
+
+        QByteArray headers = m_request.left(end);
+        QByteArray path = headers.left(headers.indexOf("\r\n")).split(' ').value(1);
+        m_request.remove(0, end + 4);
+        m_server->requestCount ++;
+
+        int draw = qrand() % 100;
+        if (draw < m_server->resetRate) {
+            m_server->resetCount ++;
+            m_socket->abort();
+            m_socket->deleteLater();
+            return;
+        }
+
+        if (draw < m_server->resetRate + m_server->errorRate) {
+            m_server->errorCount ++;
+            m_response = "HTTP/1.1 500 Internal Server Error\r\n"
+                         "Content-Type: text/plain\r\n"
+                         "Content-Length: 5\r\n\r\n"
+                         "error";
+        } else if (path.startsWith("/redirect/")) {
+            m_server->redirectCount ++;
+            m_response = "HTTP/1.1 302 Found\r\n"
+                         "Location: " + m_server->url(QString::fromLatin1(path.mid(10))).toLatin1()
+                         + "\r\n"
+                         "Content-Length: 0\r\n\r\n";
+        } else if (headers.contains("If-None-Match: " + m_server->etag)) {
+            m_server->notModifiedCount ++;
+            m_response = "HTTP/1.1 304 Not Modified\r\n"
+                         "ETag: " + m_server->etag + "\r\n"
+                         "Content-Length: 0\r\n\r\n";
+        } else {
+            m_response = "HTTP/1.1 200 OK\r\n"
+                         "Content-Type: image/jpeg\r\n"
+                         "ETag: " + m_server->etag + "\r\n"
+                         "Content-Length: " + QByteArray::number(m_server->body.size())
+                         + "\r\n\r\n" + m_server->body;
+        }
+
+        m_latencyTimer.start(m_server->latency);
+    }
+
+    void sendResponse()
+    {
+        if (m_server->bandwidth > 0) {
+            m_bandwidthTimer.start();
+            writeChunk();
+        } else {
+            m_socket->write(m_response);
+            responseSent();
+        }
+    }
+
+    void writeChunk()
+    {
+        qint64 chunk = qMax<qint64>(1, m_server->bandwidth / 100);
+        m_socket->write(m_response.left(chunk));
+        m_response.remove(0, chunk);
+        if (m_response.isEmpty()) {
+            m_bandwidthTimer.stop();
+            responseSent();
+        }
+    }
+
+private:
+    void responseSent()
+    {
+        m_response.clear();
+        if (!m_request.isEmpty()) {
+            readRequest();
+        }
+    }
+
+    HttpServer *m_server;
+    QTcpSocket *m_socket;
+    QByteArray m_request;
+    QByteArray m_response;
+    QTimer m_latencyTimer;
+    QTimer m_bandwidthTimer;
+};
+
+void HttpServer::acceptConnections()
+{
+    while (QTcpSocket *socket = nextPendingConnection()) {
+        connectionCount ++;
+        new HttpConnection(this, socket);
+    }
+}
+
+static int environmentValue(const char *name, int defaultValue)
+{
+    bool ok = false;
+    int value = qgetenv(name).toInt(&ok);
+    return ok ? value : defaultValue;
+}
+
+// Peak resident memory of the process, in kB
+static int peakMemory()
+{
+    QFile status (QLatin1String("/proc/self/status"));
+    if (!status.open(QIODevice::ReadOnly)) {
+        return -1;
+    }
+
+    foreach (const QByteArray &line, status.readAll().split('\n')) {
+        if (line.startsWith("VmHWM:")) {
+            return line.mid(6).trimmed().split(' ').first().toInt();
+        }
+    }
+    return -1;
+}
+
+static int openFileDescriptors()
+{
+    QDir fds (QLatin1String("/proc/self/fd"));
+    return fds.entryList(QDir::AllEntries | QDir::System | QDir::NoDotAndDotDot).count();
+}
+
+static QString imagesDirectory()
+{
+    return QString(QLatin1String("%1/%2/%3")).arg(PRIVILEGED_DATA_DIR,
+            SocialSyncInterface::dataType(SocialSyncInterface::Images),
+            SocialSyncInterface::socialNetwork(SocialSyncInterface::Facebook));
+}
+
+// Path of a cached file with the layout used before it was recorded,
+// that is a single level of directories named after one hex character
+static QString legacyFile(const QString &directory, const QString &name, const QByteArray &hash)
+{
+    return QString(QLatin1String("%1/%2/%3.jpg")).arg(directory,
+                                                      QString::fromLatin1(hash.left(1)), name);
+}
+
+static bool writeFile(const QString &path, const QByteArray &data)
+{
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    QFile file (path);
+    return file.open(QIODevice::WriteOnly) && file.write(data) == data.size();
+}
+
+class FacebookImageDownloaderTest: public QObject
+{
+    Q_OBJECT
+private:
+    FacebookImagesDatabase *fbDb;
+    HttpServer *server;
+    int imageCount;
+
+    // Add images whose thumbnails are served by the local server
+    QStringList seedImages(int count)
+    {
+        QStringList identifiers;
+        QDateTime time (QDate(2013, 1, 2), QTime(12, 34, 56));
+        for (int i = 0; i < count; ++i) {
+            QString identifier = QString(QLatin1String("image%1")).arg(imageCount + i);
+            fbDb->addImage(identifier, QLatin1String("album"), QLatin1String("user"), time,
+                           time, identifier, 256, 256,
+                           server->url(QString(QLatin1String("thumbnails/%1.jpg")).arg(identifier)),
+                           server->url(QString(QLatin1String("images/%1.jpg")).arg(identifier)));
+            identifiers.append(identifier);
+        }
+        imageCount += count;
+        fbDb->write();
+        return identifiers;
+    }
+
+    // Download the thumbnails of images, and wait until they are all reported
+    //
+    // Returns the number of milliseconds it took, or -1 on timeout.
+    qint64 download(FacebookImageDownloaderWorkerObject *worker, const QStringList &identifiers,
+                    int timeout, int *peakDescriptors = 0)
+    {
+        QSignalSpy spy (worker, SIGNAL(imageDownloaded(QString,QString,QVariantMap)));
+        QElapsedTimer timer;
+        timer.start();
+
+        foreach (const QString &identifier, identifiers) {
+            QString url = server->url(QString(QLatin1String("thumbnails/%1.jpg")).arg(identifier));
+            QVariantMap metadata;
+            metadata.insert(QLatin1String(TYPE_KEY),
+                            FacebookImageDownloaderWorkerObject::ThumbnailImage);
+            metadata.insert(QLatin1String(IDENTIFIER_KEY), identifier);
+            worker->queue(url, metadata);
+        }
+
+        while (spy.count() < identifiers.count()) {
+            if (timer.elapsed() > timeout) {
+                return -1;
+            }
+            QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents, 100);
+            if (peakDescriptors) {
+                *peakDescriptors = qMax(*peakDescriptors, openFileDescriptors());
+            }
+        }
+
+        return timer.elapsed();
+    }
+
+private slots:
+    void initTestCase()
+    {
+        QStandardPaths::enableTestMode(true);
+        qsrand(42);
+
+        QDir dir (PRIVILEGED_DATA_DIR);
+        dir.removeRecursively();
+
+        QImage image (256, 256, QImage::Format_RGB32);
+        for (int y = 0; y < image.height(); ++y) {
+            for (int x = 0; x < image.width(); ++x) {
+                image.setPixel(x, y, qRgb(x, y, (x + y) / 2));
+            }
+        }
+
+        QByteArray body;
+        QBuffer buffer (&body);
+        buffer.open(QIODevice::WriteOnly);
+        QVERIFY(image.save(&buffer, "JPG"));
+
+        server = new HttpServer(body);
+        QVERIFY(server->listen(QHostAddress::LocalHost));
+
+        fbDb = new FacebookImagesDatabase();
+        fbDb->initDatabase();
+        imageCount = 0;
+    }
+
+    // Runs first, as the layout is recorded by the first downloader
+    void testMigration()
+    {
+        const QString root = imagesDirectory();
+        const QString layoutFile = root + QLatin1String("/.layout");
+        QVERIFY(!QFile::exists(layoutFile));
+
+        // Thumbnails are named after their identifiers, and
+        // full images are in the content-addressed store
+        const QByteArray blobHash = QCryptographicHash::hash(server->body,
+                                                             QCryptographicHash::Sha1).toHex();
+        const QString blob = legacyFile(root + QLatin1String("/blobs"),
+                                        QString::fromLatin1(blobHash), blobHash);
+        QVERIFY(writeFile(blob, server->body));
+
+        QStringList identifiers = seedImages(5);
+        QMap<QString, QString> thumbnails;
+        foreach (const QString &identifier, identifiers) {
+            QString name = identifier
+                    + QString::number(FacebookImageDownloaderWorkerObject::ThumbnailImage);
+            QString thumbnail = legacyFile(root, name,
+                                           QCryptographicHash::hash(name.toLocal8Bit(),
+                                                                    QCryptographicHash::Md5).toHex());
+            QVERIFY(writeFile(thumbnail, server->body));
+            thumbnails.insert(identifier, thumbnail);
+
+            fbDb->updateImageThumbnail(identifier, thumbnail);
+            fbDb->updateImageFile(identifier, blob);
+            fbDb->updateImageValidators(fbDb->image(identifier)->thumbnailUrl(), thumbnail,
+                                        QLatin1String("\"fixture\""), QString(),
+                                        server->body.size());
+        }
+        QVERIFY(fbDb->write());
+
+        {
+            // Open the database with the previous layout, so that
+            // nothing is migrated yet
+            FacebookImageDownloaderWorkerObject worker;
+            worker.setSharding(1, 1);
+            worker.touchImages(identifiers);
+
+            // Files are moved, but the layout is not recorded
+            // when the database can not be updated
+            QSqlDatabase lockDb = QSqlDatabase::addDatabase(QLatin1String("QSQLITE"),
+                                                            QLatin1String("lock"));
+            lockDb.setDatabaseName(QString(QLatin1String("%1/%2/facebook.db")).arg(
+                    PRIVILEGED_DATA_DIR, SocialSyncInterface::dataType(SocialSyncInterface::Images)));
+            QVERIFY(lockDb.open());
+            QVERIFY(QSqlQuery(lockDb).exec(QLatin1String("BEGIN IMMEDIATE TRANSACTION")));
+
+            worker.setSharding(2, 2);
+            worker.touchImages(identifiers);
+
+            QVERIFY(QSqlQuery(lockDb).exec(QLatin1String("ROLLBACK")));
+            lockDb.close();
+
+            QVERIFY(!QFile::exists(layoutFile));
+            QVERIFY(!QFile::exists(blob));
+            foreach (const QString &identifier, identifiers) {
+                QVERIFY(!QFile::exists(thumbnails.value(identifier)));
+                QCOMPARE(fbDb->image(identifier)->thumbnailFile(), thumbnails.value(identifier));
+            }
+        }
+        QSqlDatabase::removeDatabase(QLatin1String("lock"));
+
+        // The migration is done again, and the database is updated
+        FacebookImageDownloaderWorkerObject worker;
+        worker.touchImages(identifiers);
+
+        QFile layout (layoutFile);
+        QVERIFY(layout.open(QIODevice::ReadOnly));
+        QCOMPARE(layout.readAll(), QByteArray("2 2"));
+
+        foreach (const QString &identifier, identifiers) {
+            FacebookImage::ConstPtr image = fbDb->image(identifier);
+            const QString thumbnail = image->thumbnailFile();
+            const QString name = QFileInfo(thumbnail).completeBaseName();
+            const QByteArray hash = QCryptographicHash::hash(name.toLocal8Bit(),
+                                                             QCryptographicHash::Md5).toHex();
+            QCOMPARE(thumbnail, QString(QLatin1String("%1/%2/%3/%4.jpg")).arg(root,
+                     QString::fromLatin1(hash.left(2)), QString::fromLatin1(hash.mid(2, 2)), name));
+            QCOMPARE(QFileInfo(thumbnail).size(), qint64(server->body.size()));
+
+            QCOMPARE(image->imageFile(), QString(QLatin1String("%1/blobs/%2/%3/%4.jpg")).arg(root,
+                     QString::fromLatin1(blobHash.left(2)), QString::fromLatin1(blobHash.mid(2, 2)),
+                     QString::fromLatin1(blobHash)));
+            QVERIFY(QFile::exists(image->imageFile()));
+
+            QString validatorFile;
+            QVERIFY(fbDb->imageValidators(image->thumbnailUrl(), &validatorFile, 0, 0, 0));
+            QCOMPARE(validatorFile, thumbnail);
+        }
+    }
+
+    void testDownload()
+    {
+        QStringList identifiers = seedImages(100);
+        FacebookImageDownloaderWorkerObject worker;
+        server->resetCounters();
+
+        QVERIFY(download(&worker, identifiers, 30000) >= 0);
+        QCOMPARE(server->requestCount, identifiers.count());
+
+        foreach (const QString &identifier, identifiers) {
+            FacebookImage::ConstPtr image = fbDb->image(identifier);
+            QVERIFY(!image.isNull());
+            QVERIFY(!image->thumbnailFile().isEmpty());
+            QCOMPARE(QFileInfo(image->thumbnailFile()).size(), qint64(server->body.size()));
+        }
+
+        QVariantMap metrics = worker.metrics();
+        QCOMPARE(metrics.value(QLatin1String("completedCount")).toInt(), identifiers.count());
+        QCOMPARE(metrics.value(QLatin1String("failedCount")).toInt(), 0);
+        QCOMPARE(metrics.value(QLatin1String("queueDepth")).toInt(), 0);
+        QCOMPARE(metrics.value(QLatin1String("runningCount")).toInt(), 0);
+    }
+
+    void testRevalidation()
+    {
+        QStringList identifiers = seedImages(50);
+        FacebookImageDownloaderWorkerObject worker;
+        QVERIFY(download(&worker, identifiers, 30000) >= 0);
+
+        // Cached files are revalidated, not downloaded again
+        server->resetCounters();
+        QVERIFY(download(&worker, identifiers, 30000) >= 0);
+        QCOMPARE(server->notModifiedCount, identifiers.count());
+
+        foreach (const QString &identifier, identifiers) {
+            FacebookImage::ConstPtr image = fbDb->image(identifier);
+            QCOMPARE(QFileInfo(image->thumbnailFile()).size(), qint64(server->body.size()));
+        }
+    }
+
+    void testFailedRevalidation()
+    {
+        QStringList identifiers = seedImages(10);
+        FacebookImageDownloaderWorkerObject worker;
+        QVERIFY(download(&worker, identifiers, 30000) >= 0);
+
+        // Failed conditional requests leave the cached files and their validators
+        server->resetCounters();
+        server->errorRate = 100;
+        QCOMPARE(download(&worker, identifiers, 500), qint64(-1));
+        server->errorRate = 0;
+        QVERIFY(server->errorCount > 0);
+
+        foreach (const QString &identifier, identifiers) {
+            FacebookImage::ConstPtr image = fbDb->image(identifier);
+            QCOMPARE(QFileInfo(image->thumbnailFile()).size(), qint64(server->body.size()));
+
+            QString etag;
+            QVERIFY(fbDb->imageValidators(image->thumbnailUrl(), 0, &etag, 0, 0));
+            QCOMPARE(etag, QLatin1String("\"fixture\""));
+        }
+    }
+
+    void testContentAddressedRevalidation()
+    {
+        QStringList identifiers = seedImages(10);
+        FacebookImageDownloaderWorkerObject worker;
+        worker.setContentAddressed(true);
+        QVERIFY(download(&worker, identifiers, 30000) >= 0);
+
+        // Images with the same content share a file in the store
+        const QString previousFile = fbDb->image(identifiers.first())->thumbnailFile();
+        QVERIFY(QFile::exists(previousFile));
+
+        QImage changedImage (256, 256, QImage::Format_RGB32);
+        changedImage.fill(qRgb(255, 0, 0));
+        QByteArray body;
+        QBuffer buffer (&body);
+        buffer.open(QIODevice::WriteOnly);
+        QVERIFY(changedImage.save(&buffer, "JPG"));
+
+        const QByteArray previousBody = server->body;
+        server->body = body;
+        server->etag = "\"changed\"";
+
+        // Changed images are stored again, and the stored files are not
+        // moved to the paths of the images
+        server->resetCounters();
+        QVERIFY(download(&worker, identifiers, 30000) >= 0);
+        QCOMPARE(server->notModifiedCount, 0);
+
+        const QString file = fbDb->image(identifiers.first())->thumbnailFile();
+        QVERIFY(file != previousFile);
+        foreach (const QString &identifier, identifiers) {
+            FacebookImage::ConstPtr image = fbDb->image(identifier);
+            QCOMPARE(image->thumbnailFile(), file);
+
+            QString validatorFile;
+            QString etag;
+            QVERIFY(fbDb->imageValidators(image->thumbnailUrl(), &validatorFile, &etag, 0, 0));
+            QCOMPARE(validatorFile, file);
+            QCOMPARE(etag, QLatin1String("\"changed\""));
+        }
+        QCOMPARE(QFileInfo(file).size(), qint64(body.size()));
+
+        // The stored file is still there to be revalidated
+        server->resetCounters();
+        QVERIFY(download(&worker, identifiers, 30000) >= 0);
+        QCOMPARE(server->notModifiedCount, identifiers.count());
+        QCOMPARE(QFileInfo(file).size(), qint64(body.size()));
+
+        server->body = previousBody;
+        server->etag = "\"fixture\"";
+    }
+
+    void testRedirect()
+    {
+        QStringList identifiers = seedImages(10);
+        FacebookImageDownloaderWorkerObject worker;
+        QSignalSpy spy (&worker, SIGNAL(imageDownloaded(QString,QString,QVariantMap)));
+        server->resetCounters();
+
+        // Redirections are followed to the image
+        foreach (const QString &identifier, identifiers) {
+            QVariantMap metadata;
+            metadata.insert(QLatin1String(TYPE_KEY),
+                            FacebookImageDownloaderWorkerObject::ThumbnailImage);
+            metadata.insert(QLatin1String(IDENTIFIER_KEY), identifier);
+            worker.queue(server->url(QString(QLatin1String("redirect/thumbnails/%1.jpg"))
+                                     .arg(identifier)), metadata);
+        }
+        QTRY_COMPARE_WITH_TIMEOUT(spy.count(), identifiers.count(), 30000);
+        QCOMPARE(server->redirectCount, identifiers.count());
+
+        foreach (const QString &identifier, identifiers) {
+            FacebookImage::ConstPtr image = fbDb->image(identifier);
+            QCOMPARE(QFileInfo(image->thumbnailFile()).size(), qint64(server->body.size()));
+        }
+
+        QVariantMap metrics = worker.metrics();
+        QCOMPARE(metrics.value(QLatin1String("failedCount")).toInt(), 0);
+    }
+
+    void testUnreliableServer()
+    {
+        QStringList identifiers = seedImages(200);
+        FacebookImageDownloaderWorkerObject worker;
+        server->resetCounters();
+        server->latency = 5;
+        server->bandwidth = 256 * 1024;
+        server->errorRate = 5;
+        server->resetRate = 5;
+
+        // Failed requests are retried until every image is downloaded
+        qint64 elapsed = download(&worker, identifiers, 60000);
+
+        server->latency = 0;
+        server->bandwidth = 0;
+        server->errorRate = 0;
+        server->resetRate = 0;
+
+        QVERIFY(elapsed >= 0);
+        QVariantMap metrics = worker.metrics();
+        QVERIFY(metrics.value(QLatin1String("completedCount")).toInt() > identifiers.count());
+        QVERIFY(metrics.value(QLatin1String("failedCount")).toInt() > 0);
+        QCOMPARE(metrics.value(QLatin1String("retryCount")).toInt(),
+                 metrics.value(QLatin1String("failedCount")).toInt());
+        QCOMPARE(metrics.value(QLatin1String("parkedCount")).toInt(), 0);
+        QCOMPARE(metrics.value(QLatin1String("runningCount")).toInt(), 0);
+
+        foreach (const QString &identifier, identifiers) {
+            FacebookImage::ConstPtr image = fbDb->image(identifier);
+            QCOMPARE(QFileInfo(image->thumbnailFile()).size(), qint64(server->body.size()));
+        }
+    }
+
+    // Push many images through the downloader and report how it behaves
+    //
+    // The load can be changed with the SOCIALCACHE_BENCHMARK_IMAGES,
+    // SOCIALCACHE_BENCHMARK_LATENCY (ms), SOCIALCACHE_BENCHMARK_BANDWIDTH
+    // (bytes/s), SOCIALCACHE_BENCHMARK_ERROR_RATE and
+    // SOCIALCACHE_BENCHMARK_RESET_RATE (%) environment variables.
+    void benchmarkDownload()
+    {
+        int count = environmentValue("SOCIALCACHE_BENCHMARK_IMAGES", 10000);
+        server->latency = environmentValue("SOCIALCACHE_BENCHMARK_LATENCY", 0);
+        server->bandwidth = environmentValue("SOCIALCACHE_BENCHMARK_BANDWIDTH", 0);
+        server->errorRate = environmentValue("SOCIALCACHE_BENCHMARK_ERROR_RATE", 0);
+        server->resetRate = environmentValue("SOCIALCACHE_BENCHMARK_RESET_RATE", 0);
+
+        QStringList identifiers = seedImages(count);
+        FacebookImageDownloaderWorkerObject worker;
+        server->resetCounters();
+
+        int initialDescriptors = openFileDescriptors();
+        int peakDescriptors = initialDescriptors;
+        qint64 elapsed = download(&worker, identifiers, 3600000, &peakDescriptors);
+        QVERIFY(elapsed >= 0);
+
+        QVariantMap metrics = worker.metrics();
+        qint64 bytes = metrics.value(QLatin1String("bytesReceived")).toLongLong();
+        qDebug() << "Images:" << count << "in" << elapsed << "ms,"
+                 << (count * 1000.0 / qMax<qint64>(elapsed, 1)) << "images/s,"
+                 << (bytes / 1024.0 * 1000.0 / qMax<qint64>(elapsed, 1)) << "kB/s";
+        qDebug() << "Latency p50/p90/p99:" << metrics.value(QLatin1String("latencyP50")).toInt()
+                 << metrics.value(QLatin1String("latencyP90")).toInt()
+                 << metrics.value(QLatin1String("latencyP99")).toInt() << "ms";
+        qDebug() << "Peak memory:" << peakMemory() << "kB";
+        qDebug() << "File descriptors:" << initialDescriptors << "before," << peakDescriptors
+                 << "at peak," << openFileDescriptors() << "after";
+        qDebug() << "Connections:" << server->connectionCount
+                 << "requests:" << server->requestCount
+                 << "failures:" << metrics.value(QLatin1String("failures")).toMap();
+        qDebug() << "Database writes:" << metrics.value(QLatin1String("dbFlushCount")).toInt();
+
+        QVERIFY(metrics.value(QLatin1String("completedCount")).toInt() >= count);
+
+        server->latency = 0;
+        server->bandwidth = 0;
+        server->errorRate = 0;
+        server->resetRate = 0;
+    }
+
+    void cleanupTestCase()
+    {
+        delete fbDb;
+        delete server;
+
+        QDir dir (PRIVILEGED_DATA_DIR);
+        dir.removeRecursively();
+    }
+};
+
+QTEST_GUILESS_MAIN(FacebookImageDownloaderTest)
+
+#include "main.moc"
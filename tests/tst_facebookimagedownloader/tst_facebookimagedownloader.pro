@@ -0,0 +1,30 @@
+include(../../common.pri)
+
+TEMPLATE = app
+TARGET = tst_facebookimagedownloader
+QT += gui network sql testlib
+
+DEFINES += NO_KEY_PROVIDER
+
+INCLUDEPATH += ../../src/lib/
+INCLUDEPATH += ../../src/qml/
+
+HEADERS +=  ../../src/lib/semaphore_p.h \
+            ../../src/lib/socialsyncinterface.h \
+            ../../src/lib/abstractsocialcachedatabase.h \
+            ../../src/lib/abstractsocialcachedatabase_p.h \
+            ../../src/lib/facebookimagesdatabase.h \
+            ../../src/lib/abstractimagedownloader.h \
+            ../../src/lib/abstractimagedownloader_p.h \
+            ../../src/lib/imageatlas.h \
+            ../../src/qml/facebook/facebookimagedownloader_p.h \
+            ../../src/qml/facebook/facebookimagedownloader.h
+
+SOURCES +=  ../../src/lib/semaphore_p.cpp \
+            ../../src/lib/socialsyncinterface.cpp \
+            ../../src/lib/abstractsocialcachedatabase.cpp \
+            ../../src/lib/facebookimagesdatabase.cpp \
+            ../../src/lib/abstractimagedownloader.cpp \
+            ../../src/lib/imageatlas.cpp \
+            ../../src/qml/facebook/facebookimagedownloader.cpp \
+            main.cpp
@@ -0,0 +1,280 @@
+/*
+ * Copyright (C) 2013 Jolla Ltd.
+ *
+ * You may use this file under the terms of the BSD license as follows:
+ *
+ * "Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in
+ *     the documentation and/or other materials provided with the
+ *     distribution.
+ *   * Neither the name of Nemo Mobile nor the names of its contributors
+ *     may be used to endorse or promote products derived from this
+ *     software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE."
+ */
+
+#include <QtTest/QTest>
+#include <QtCore/QStringList>
+
+#include "synchronizelists_p.h"
+
+// Applies the changes to a list, and counts them
+class ListAgent
+{
+public:
+    explicit ListAgent(const QStringList &list)
+        : list(list), inserts(0), removes(0), moves(0)
+    {
+    }
+
+    void insertRange(int index, int count, const QStringList &source, int sourceIndex)
+    {
+        QVERIFY(index >= 0 && index <= list.count());
+        for (int i = 0; i < count; ++i) {
+            list.insert(index + i, source.at(sourceIndex + i));
+        }
+        inserts ++;
+    }
+
+    void removeRange(int index, int count)
+    {
+        QVERIFY(index >= 0 && index + count <= list.count());
+        for (int i = 0; i < count; ++i) {
+            list.removeAt(index);
+        }
+        removes ++;
+    }
+
+    void moveRange(int index, int count, int destination)
+    {
+        // Same constraints as QAbstractItemModel::beginMoveRows
+        QVERIFY(destination < index || destination > index + count);
+        QVERIFY(destination >= 0 && destination <= list.count());
+        QStringList moved = list.mid(index, count);
+        for (int i = 0; i < count; ++i) {
+            list.removeAt(index);
+        }
+        int position = destination > index ? destination - count : destination;
+        for (int i = 0; i < count; ++i) {
+            list.insert(position + i, moved.at(i));
+        }
+        moves ++;
+    }
+
+    QStringList list;
+    int inserts;
+    int removes;
+    int moves;
+};
+
+// Only counts the changes, so that benchmarks measure the synchronization
+// rather than the changes made to a list
+class CountingAgent
+{
+public:
+    CountingAgent()
+        : changes(0)
+    {
+    }
+
+    void insertRange(int, int, const QStringList &, int)
+    {
+        changes ++;
+    }
+
+    void removeRange(int, int)
+    {
+        changes ++;
+    }
+
+    void moveRange(int, int, int)
+    {
+        changes ++;
+    }
+
+    int changes;
+};
+
+static QStringList makeList(int count)
+{
+    QStringList list;
+    for (int i = 0; i < count; ++i) {
+        list.append(QString::number(i));
+    }
+    return list;
+}
+
+static QStringList shuffled(const QStringList &list)
+{
+    QStringList result = list;
+    for (int i = result.count() - 1; i > 0; --i) {
+        result.swap(i, qrand() % (i + 1));
+    }
+    return result;
+}
+
+class SynchronizeListsTest: public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase()
+    {
+        qsrand(42);
+    }
+
+    void testSynchronize_data()
+    {
+        QTest::addColumn<QStringList>("cache");
+        QTest::addColumn<QStringList>("reference");
+        QTest::addColumn<int>("inserts");
+        QTest::addColumn<int>("removes");
+        QTest::addColumn<int>("moves");
+
+        QStringList list = QStringList() << "a" << "b" << "c" << "d" << "e" << "f";
+
+        QTest::newRow("equal") << list << list << 0 << 0 << 0;
+        QTest::newRow("empty cache") << QStringList() << list << 1 << 0 << 0;
+        QTest::newRow("empty reference") << list << QStringList() << 0 << 1 << 0;
+        QTest::newRow("insert")
+                << list << (QStringList() << "a" << "b" << "x" << "y" << "c" << "d" << "e" << "f")
+                << 1 << 0 << 0;
+        QTest::newRow("remove")
+                << list << (QStringList() << "a" << "d" << "e" << "f") << 0 << 1 << 0;
+        QTest::newRow("move first to last")
+                << list << (QStringList() << "b" << "c" << "d" << "e" << "f" << "a") << 0 << 0 << 1;
+        QTest::newRow("move last to first")
+                << list << (QStringList() << "f" << "a" << "b" << "c" << "d" << "e") << 0 << 0 << 1;
+        QTest::newRow("move range")
+                << list << (QStringList() << "a" << "d" << "e" << "b" << "c" << "f") << 0 << 0 << 1;
+        QTest::newRow("mixed")
+                << list << (QStringList() << "x" << "e" << "a" << "c" << "y" << "d")
+                << 2 << 2 << 1;
+        QTest::newRow("duplicates")
+                << (QStringList() << "a" << "b" << "a" << "c")
+                << (QStringList() << "a" << "a" << "b" << "c") << 0 << 0 << 1;
+    }
+
+    void testSynchronize()
+    {
+        QFETCH(QStringList, cache);
+        QFETCH(QStringList, reference);
+        QFETCH(int, inserts);
+        QFETCH(int, removes);
+        QFETCH(int, moves);
+
+        ListAgent agent (cache);
+        synchronizeList(&agent, cache, reference);
+        QCOMPARE(agent.list, reference);
+        QCOMPARE(agent.inserts, inserts);
+        QCOMPARE(agent.removes, removes);
+        QCOMPARE(agent.moves, moves);
+    }
+
+    void testRandom()
+    {
+        for (int i = 0; i < 1000; ++i) {
+            QStringList cache;
+            QStringList reference;
+            int range = 1 + qrand() % 40;
+            for (int j = qrand() % 30; j > 0; --j) {
+                cache.append(QString::number(qrand() % range));
+            }
+            for (int j = qrand() % 30; j > 0; --j) {
+                reference.append(QString::number(qrand() % range));
+            }
+
+            ListAgent agent (cache);
+            synchronizeList(&agent, cache, reference);
+            QCOMPARE(agent.list, reference);
+        }
+    }
+
+    // Compare with the incremental scan of SynchronizeList
+    void benchmarkSynchronize_data()
+    {
+        QTest::addColumn<bool>("hashed");
+        QTest::addColumn<QStringList>("cache");
+        QTest::addColumn<QStringList>("reference");
+
+        QStringList small = makeList(2000);
+        QStringList smallChanged = small.mid(100, 1800);
+        smallChanged.append(QStringLiteral("new"));
+        QStringList smallShuffled = shuffled(small);
+        QStringList large = makeList(20000);
+        QStringList largeShuffled = shuffled(large);
+
+        QTest::newRow("scan, 2000 changed") << false << small << smallChanged;
+        QTest::newRow("hash, 2000 changed") << true << small << smallChanged;
+        QTest::newRow("scan, 2000 reordered") << false << small << smallShuffled;
+        QTest::newRow("hash, 2000 reordered") << true << small << smallShuffled;
+        QTest::newRow("hash, 20000 reordered") << true << large << largeShuffled;
+    }
+
+    // Moves are found in O(n log n), so large lists are reordered
+    // quickly when the changes are not applied to a list
+    void benchmarkReorder_data()
+    {
+        QTest::addColumn<QStringList>("cache");
+        QTest::addColumn<QStringList>("reference");
+
+        QStringList large = makeList(20000);
+        QStringList huge = makeList(200000);
+
+        QTest::newRow("20000 reordered") << large << shuffled(large);
+        QTest::newRow("200000 reordered") << huge << shuffled(huge);
+    }
+
+    void benchmarkReorder()
+    {
+        QFETCH(QStringList, cache);
+        QFETCH(QStringList, reference);
+
+        QBENCHMARK {
+            CountingAgent agent;
+            synchronizeList(&agent, cache, reference);
+            QVERIFY(agent.changes > 0);
+        }
+    }
+
+    void benchmarkSynchronize()
+    {
+        QFETCH(bool, hashed);
+        QFETCH(QStringList, cache);
+        QFETCH(QStringList, reference);
+
+        QBENCHMARK {
+            ListAgent agent (cache);
+            if (hashed) {
+                synchronizeList(&agent, cache, reference);
+            } else {
+                // The scan reads the cache while it is modified
+                int cacheIndex = 0;
+                int referenceIndex = 0;
+                synchronizeList(&agent, agent.list, cacheIndex, reference, referenceIndex);
+                completeSynchronizeList(&agent, agent.list, cacheIndex, reference, referenceIndex);
+            }
+            QCOMPARE(agent.list, reference);
+        }
+    }
+};
+
+QTEST_APPLESS_MAIN(SynchronizeListsTest)
+
+#include "main.moc"
@@ -0,0 +1,11 @@
+include(../../common.pri)
+
+TEMPLATE = app
+TARGET = tst_synchronizelists
+QT += testlib
+
+INCLUDEPATH += ../../src/qml/
+
+HEADERS += ../../src/qml/synchronizelists_p.h
+
+SOURCES += main.cpp